@@ -0,0 +1,364 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+#include "BlackRoot/Pubc/Files.h"
+
+#include "HephaestusBase/Pubc/Action Cache.h"
+#include "HephaestusBase/Pubc/Content Hash.h"
+
+using namespace Hephaestus::Pipeline;
+using namespace Hephaestus::Pipeline::Wrangler;
+namespace fs = std::experimental::filesystem;
+
+namespace {
+        // Object names come out of entries on disk, so they are checked
+        // before they go anywhere near a path
+    bool IsDigest(const std::string & str) {
+        if (str.size() != 64)
+            return false;
+        for (auto c : str) {
+            if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f')))
+                return false;
+        }
+        return true;
+    }
+
+        // Times cross the tool boundary (and the wire) in whole
+        // milliseconds; the monitor allows the same margin
+    bool FileTimeEqualsWithEpsilon(BlackRoot::IO::FileTime lh, BlackRoot::IO::FileTime rh) {
+        auto diff = lh - rh;
+        return diff < std::chrono::milliseconds(5) && diff > std::chrono::milliseconds(-5);
+    }
+
+        // A shared cache is written by others, so an entry may only put
+        // files where this action writes: its out-file, or anything below
+        // the out-file's directory. Nothing may climb out with '..'
+    bool IsOutputOf(const fs::path & out, const fs::path & path) {
+        if (path == out)
+            return true;
+        for (auto & part : path) {
+            if (part == "..")
+                return false;
+        }
+
+        auto dir = out.parent_path();
+        auto p = path.begin();
+        for (auto d = dir.begin(); d != dir.end(); ++d, ++p) {
+            if (p == path.end() || *p != *d)
+                return false;
+        }
+        return p != path.end();
+    }
+
+        // Share the blocks if the filesystem can; otherwise copy. We never
+        // hardlink, as a later tool or user editing the output in place
+        // would quietly change the cached object with it
+    bool CloneOrCopyFile(const fs::path & from, const fs::path & to) {
+#ifdef __linux__
+        int src = ::open(from.c_str(), O_RDONLY | O_CLOEXEC);
+        if (src >= 0) {
+            int dst = ::open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            bool cloned = dst >= 0 && ::ioctl(dst, FICLONE, src) == 0;
+            if (dst >= 0) ::close(dst);
+            ::close(src);
+            if (cloned)
+                return true;
+        }
+#endif
+        std::error_code ec;
+        fs::copy_file(from, to, fs::copy_options::overwrite_existing, ec);
+        return !ec;
+    }
+}
+
+    //  Setup
+    // --------------------
+
+ActionCache::ActionCache()
+{
+    this->TempCounter = 0;
+
+        // Thread ids and counters repeat between processes, so every cache
+        // instance names its temporaries with a random prefix of its own
+    std::random_device random;
+    std::stringstream ss;
+    ss << std::hex << random() << random();
+    this->TempPrefix = ss.str();
+}
+
+void ActionCache::SetDirectory(const Path path)
+{
+    this->Directory = path;
+}
+
+bool ActionCache::IsEnabled() const
+{
+    return !this->Directory.empty();
+}
+
+    //  Keys
+    // --------------------
+
+bool ActionCache::BuildKey(const WranglerTask & task, const std::string & settings, std::vector<Path> reads, JSON & key)
+{
+        // The order the tool read in does not matter, only what it read
+    std::sort(reads.begin(), reads.end());
+    reads.erase(std::unique(reads.begin(), reads.end()), reads.end());
+
+    JSON readList = JSON::array();
+    for (auto & read : reads) {
+        std::string digest;
+        if (!Monitor::DigestFileContents(read, digest))
+            return false;
+        readList.push_back(JSON::array({ read.string(), digest }));
+    }
+
+        // Settings come in as a dump, which orders object keys, so equal
+        // settings always make equal keys
+    key = JSON::object();
+    key["tool"]     = task.ToolName;
+    key["settings"] = settings;
+    key["in"]       = task.FileIn.string();
+    key["out"]      = task.FileOut.string();
+    key["reads"]    = std::move(readList);
+    return true;
+}
+
+std::string ActionCache::DigestKey(const JSON & key)
+{
+    auto str = key.dump();
+
+    Monitor::ContentDigest digest;
+    digest.Update(str.data(), str.size());
+    return digest.Finish();
+}
+
+ActionCache::Path ActionCache::GetEntryPath(const std::string & digest)
+{
+    return this->Directory / "actions" / (digest + ".json");
+}
+
+ActionCache::Path ActionCache::GetObjectPath(const std::string & digest)
+{
+        // Spread over subdirectories, so no directory grows too large
+    return this->Directory / "objects" / digest.substr(0, 2) / digest;
+}
+
+ActionCache::Path ActionCache::GetTempPath()
+{
+    std::stringstream ss;
+    ss << this->TempPrefix << "-" << std::this_thread::get_id() << "-" << this->TempCounter++ << ".tmp";
+    return this->Directory / "tmp" / ss.str();
+}
+
+    //  Objects
+    // --------------------
+
+bool ActionCache::StoreObject(const Path file, std::string & digest)
+{
+    std::error_code ec;
+
+        // Copy first and hash the copy, so a file changed while we store it
+        // can never end up under the digest of something else; an object
+        // already there under the same digest has the same bytes
+    auto temp = this->GetTempPath();
+    fs::create_directories(temp.parent_path(), ec);
+    if (!CloneOrCopyFile(file, temp))
+        return false;
+
+    if (!Monitor::DigestFileContents(temp, digest)) {
+        fs::remove(temp, ec);
+        return false;
+    }
+
+    auto object = this->GetObjectPath(digest);
+    if (fs::exists(object, ec)) {
+        fs::remove(temp, ec);
+        return true;
+    }
+
+    fs::create_directories(object.parent_path(), ec);
+    fs::rename(temp, object, ec);
+    if (ec) {
+        fs::remove(temp, ec);
+        return false;
+    }
+    return true;
+}
+
+bool ActionCache::MaterialiseObject(const Path object, const Path target)
+{
+    std::error_code ec;
+
+        // Go through a temporary next to the target, so whoever watches the
+        // target never sees half a file
+    auto temp = target;
+    temp += ".hepcache";
+
+    fs::create_directories(target.parent_path(), ec);
+    if (!CloneOrCopyFile(object, temp)) {
+        fs::remove(temp, ec);
+        return false;
+    }
+
+    fs::rename(temp, target, ec);
+    if (ec) {
+        fs::remove(temp, ec);
+        return false;
+    }
+    return true;
+}
+
+bool ActionCache::WriteAtomically(const Path path, const std::string & contents)
+{
+    std::error_code ec;
+
+    auto temp = this->GetTempPath();
+    fs::create_directories(temp.parent_path(), ec);
+
+    {
+        std::ofstream out(temp.string(), std::ios::binary | std::ios::trunc);
+        out.write(contents.data(), contents.size());
+        if (!out.good()) {
+            out.close();
+            fs::remove(temp, ec);
+            return false;
+        }
+    }
+
+    fs::create_directories(path.parent_path(), ec);
+    fs::rename(temp, path, ec);
+    if (ec) {
+        fs::remove(temp, ec);
+        return false;
+    }
+    return true;
+}
+
+    //  Actions
+    // --------------------
+
+bool ActionCache::Restore(const WranglerTask & task, const std::string & settings, const std::vector<Path> & previousReads, WranglerTaskResult & result)
+{
+    if (!this->IsEnabled() || previousReads.size() == 0)
+        return false;
+
+    try {
+        JSON key;
+        if (!this->BuildKey(task, settings, previousReads, key))
+            return false;
+
+        auto entryPath = this->GetEntryPath(this->DigestKey(key));
+
+        std::ifstream in(entryPath.string(), std::ios::binary);
+        if (!in.good())
+            return false;
+
+        std::stringstream ss;
+        ss << in.rdbuf();
+        JSON entry = JSON::parse(ss.str());
+
+            // The file name is only a digest of the key; the key decides
+        if (entry["key"] != key)
+            return false;
+
+        auto & written = entry["written"];
+        if (!written.is_array() || written.size() == 0)
+            return false;
+
+        std::vector<std::pair<Path, Path>> outputs;
+        for (auto & it : written) {
+            auto digest = it["object"].get<std::string>();
+            if (!IsDigest(digest))
+                return false;
+
+            Path target = it["path"].get<std::string>();
+            if (!IsOutputOf(task.FileOut, target))
+                return false;
+
+            auto object = this->GetObjectPath(digest);
+            if (!fs::exists(object))
+                return false;
+            outputs.push_back({ object, target });
+        }
+
+        for (auto & it : outputs) {
+            if (!this->MaterialiseObject(it.first, it.second))
+                return false;
+        }
+
+            // Report as if the tool ran; the times are those of now, so the
+            // monitor notices anything that changed since we hashed
+        BlackRoot::IO::BaseFileSource files;
+        for (auto & it : key["reads"]) {
+            Path read = it[0].get<std::string>();
+            result.ReadFiles.push_back({ read, files.LastWriteTime(read) });
+        }
+        for (auto & it : outputs) {
+            result.WrittenFiles.push_back({ it.second });
+        }
+    }
+    catch (...) {
+        result.ReadFiles.clear();
+        result.WrittenFiles.clear();
+        return false;
+    }
+
+    return true;
+}
+
+void ActionCache::Store(const WranglerTask & task, const std::string & settings, const WranglerTaskResult & result)
+{
+        // Without knowing what the tool wrote, restoring would write nothing
+    if (!this->IsEnabled() || result.ReadFiles.size() == 0 || result.WrittenFiles.size() == 0)
+        return;
+
+    try {
+            // If anything the tool read changed since it read it, we cannot
+            // tell what the tool saw, so leave it
+        BlackRoot::IO::BaseFileSource files;
+        std::vector<Path> reads;
+        for (auto & it : result.ReadFiles) {
+            if (!FileTimeEqualsWithEpsilon(files.LastWriteTime(it.Path), it.LastChange))
+                return;
+            reads.push_back(it.Path);
+        }
+
+        JSON key;
+        if (!this->BuildKey(task, settings, reads, key))
+            return;
+
+        JSON written = JSON::array();
+        for (auto & it : result.WrittenFiles) {
+            if (!IsOutputOf(task.FileOut, it.Path))
+                return;
+
+            std::string digest;
+            if (!this->StoreObject(it.Path, digest))
+                return;
+            written.push_back({ { "path", it.Path.string() }, { "object", digest } });
+        }
+
+        JSON entry;
+        entry["key"]     = key;
+        entry["written"] = std::move(written);
+
+        this->WriteAtomically(this->GetEntryPath(this->DigestKey(key)), entry.dump());
+    }
+    catch (...) {
+    }
+}
\ No newline at end of file
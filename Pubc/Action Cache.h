@@ -0,0 +1,74 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+/* {quality} This is very much a sketch
+ */
+
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "BlackRoot/Pubc/Number Types.h"
+#include "BlackRoot/Pubc/Files Types.h"
+#include "BlackRoot/Pubc/JSON.h"
+
+#include "HephaestusBase/Pubc/Pipeline Meta.h"
+
+namespace Hephaestus {
+namespace Pipeline {
+namespace Wrangler {
+
+        // Remembers what a tool wrote for a given tool, settings and the
+        // contents of everything it read, so an identical run can be replaced
+        // by putting the same bytes back.
+        // On disk this is two directories; 'actions' holds one small json
+        // entry per key, 'objects' holds the written files by their SHA-256.
+        // Both are only ever written through a rename, and temporaries are
+        // named per cache instance, so any number of workers (or processes)
+        // can share a cache.
+        // An entry only ever writes the action's out-file, or files below
+        // its directory; entries that say otherwise are not restored.
+        // Nothing is ever evicted; the cache grows with every distinct output.
+        // Anything in it can be deleted at any time, which only costs hits.
+    class ActionCache {
+    public:
+        using Path  = BlackRoot::IO::FilePath;
+        using JSON  = BlackRoot::Format::JSON;
+
+    protected:
+        Path                    Directory;
+        std::string             TempPrefix;
+        std::atomic<uint64>     TempCounter;
+
+        bool        BuildKey(const WranglerTask &, const std::string & settings, std::vector<Path> reads, JSON & key);
+        std::string DigestKey(const JSON &);
+
+        Path    GetEntryPath(const std::string & digest);
+        Path    GetObjectPath(const std::string & digest);
+        Path    GetTempPath();
+
+        bool    StoreObject(const Path, std::string & digest);
+        bool    MaterialiseObject(const Path object, const Path target);
+        bool    WriteAtomically(const Path, const std::string &);
+
+    public:
+        ActionCache();
+
+        void    SetDirectory(const Path);
+        bool    IsEnabled() const;
+
+            // Both are called from worker threads, and neither throws; a cache
+            // that does not work simply never hits.
+            // 'Restore' takes the files the previous run read as what this run
+            // would read; if none of them changed, neither would the tool's
+            // choice of what to read.
+        bool    Restore(const WranglerTask &, const std::string & settings, const std::vector<Path> & previousReads, WranglerTaskResult &);
+        void    Store(const WranglerTask &, const std::string & settings, const WranglerTaskResult &);
+    };
+
+}
+}
+}
\ No newline at end of file
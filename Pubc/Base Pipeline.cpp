@@ -22,6 +22,9 @@ CON_RMR_DEFINE_CLASS(Pipeline);
 
 CON_RMR_REGISTER_FUNC(Pipeline, set_reference_directory);
 CON_RMR_REGISTER_FUNC(Pipeline, set_persistent_directory);
+CON_RMR_REGISTER_FUNC(Pipeline, set_change_detection);
+CON_RMR_REGISTER_FUNC(Pipeline, set_remote_workers);
+CON_RMR_REGISTER_FUNC(Pipeline, start_worker);
 //CON_RMR_REGISTER_FUNC(Pipeline, http);
 
     //  Setup
@@ -34,14 +37,18 @@ void Pipeline::initialise(const JSON param)
     this->Pipe_Props.Monitor.SetReferenceDirectory(env_ref_dir / "../..");
     this->Pipe_Props.Monitor.SetPersistentDirectory(env_ref_dir / "../../.hep");
     this->Pipe_Props.Monitor.SetWrangler(&this->Pipe_Props.Wrangler);
+    this->Pipe_Props.Remote_Active = false;
+    this->Pipe_Props.Processing_Active = false;
 
     for (const auto & it : Hephaestus::Pipeline::PipeRegistry::GetPipeList()) {
         this->Pipe_Props.Wrangler.RegisterTool(it);
+        this->Pipe_Props.Worker.RegisterTool(it);
     }
 }
 
 void Pipeline::deinitialise(const JSON param)
 {
+    this->Pipe_Props.Worker.EndAndWait();
 }
 
 void Pipeline::add_base_hub_file(const Path str)
@@ -62,28 +69,62 @@ void Pipeline::start_processing()
     using cout = BlackRoot::Util::Cout;
     cout{} << "Available pipeline tools: " << std::endl << " " << this->Pipe_Props.Wrangler.GetAvailableTools() << std::endl;
 
+        // The wrangler needs its workers before the monitor sends anything
+    if (this->Pipe_Props.Remote_Active) {
+        this->Pipe_Props.Remote.Begin();
+        cout{} << "Remote workers: " << std::endl << " " << this->Pipe_Props.Remote.GetConnectedWorkers() << std::endl;
+    }
+    else {
+        this->Pipe_Props.Wrangler.Begin();
+    }
     this->Pipe_Props.Monitor.Begin();
-    this->Pipe_Props.Wrangler.Begin();
+    this->Pipe_Props.Processing_Active = true;
 }
 
 void Pipeline::stop_processing()
 {
     this->Pipe_Props.Monitor.EndAndWait();
-    this->Pipe_Props.Wrangler.EndAndWait();
+    if (this->Pipe_Props.Remote_Active) {
+        this->Pipe_Props.Remote.EndAndWait();
+    }
+    else {
+        this->Pipe_Props.Wrangler.EndAndWait();
+    }
+    this->Pipe_Props.Processing_Active = false;
 }
 
 void Pipeline::_set_persistent_directory(Conduits::Raw::IMessage * msg) noexcept
 {
     this->savvy_try_wrap_read_json(msg, "", [&](JSON json) {
         auto dir = Toolbox::Core::Get_Environment()->get_ref_dir();
+        bool useActionCache = false;
 
         if (json.is_object()) {
+                // Optionally keep a readable json copy of the binary state
+            auto exportJSON = json.find("exportJSON");
+            if (exportJSON != json.end()) {
+                DbAssertMsgFatal(exportJSON->is_boolean(), "Malformed JSON: exportJSON must be a boolean");
+                this->Pipe_Props.Monitor.SetPersistentJSONExport(exportJSON->get<bool>());
+            }
+
+                // Optionally remember tool outputs by the contents of what
+                // they read, and put them back instead of running again
+            auto actionCache = json.find("actionCache");
+            if (actionCache != json.end()) {
+                DbAssertMsgFatal(actionCache->is_boolean(), "Malformed JSON: actionCache must be a boolean");
+                useActionCache = actionCache->get<bool>();
+            }
+
             json = json["path"];
         }
 
         DbAssertMsgFatal(json.is_string(), "Malformed JSON: cannot get path");
 
-        this->Pipe_Props.Monitor.SetPersistentDirectory(dir / json.get<JSON::string_t>());
+        auto persistentDir = dir / json.get<JSON::string_t>();
+
+        this->Pipe_Props.Monitor.SetPersistentDirectory(persistentDir);
+        this->Pipe_Props.Wrangler.SetActionCacheDirectory(useActionCache ? persistentDir / "cache" : Path{});
+        this->Pipe_Props.Worker.SetActionCacheDirectory(useActionCache ? persistentDir / "cache" : Path{});
 
         msg->set_OK();
     });
@@ -104,6 +145,86 @@ void Pipeline::_set_reference_directory(Conduits::Raw::IMessage * msg) noexcept
         msg->set_OK();
     });
 }
+
+void Pipeline::_set_change_detection(Conduits::Raw::IMessage * msg) noexcept
+{
+    this->savvy_try_wrap_read_json(msg, 0, [&](JSON json) {
+            // Only trust directory times if asked; see the monitor
+        bool skipDirectories = false;
+        if (json.is_object()) {
+            skipDirectories = json.value("skip-unchanged-directories", false);
+            json = json["mode"];
+        }
+
+        DbAssertMsgFatal(json.is_string(), "Malformed JSON: cannot get mode");
+
+            // "time" only looks at modification times; "content" also hashes
+            // files whose time changed, and ignores them if the bytes did not
+        auto mode = json.get<JSON::string_t>();
+        DbAssertMsgFatal(mode == "time" || mode == "content", "Malformed JSON: mode must be \"time\" or \"content\"");
+
+        this->Pipe_Props.Monitor.SetContentHashing(mode == "content");
+        this->Pipe_Props.Monitor.SetDirectorySkipping(skipDirectories);
+        msg->set_OK();
+    });
+}
+
+void Pipeline::_set_remote_workers(Conduits::Raw::IMessage * msg) noexcept
+{
+    this->savvy_try_wrap_read_json(msg, 0, [&](JSON json) {
+            // The monitor cannot change wranglers while it runs, and the
+            // wranglers are only started and stopped with it
+        DbAssertMsgFatal(!this->Pipe_Props.Processing_Active, "Remote workers must be set before processing starts");
+
+            // Workers only talk to whoever knows their secret
+        std::string secret;
+        if (json.is_object()) {
+            secret = json.value("secret", std::string());
+            json = json["workers"];
+        }
+
+        DbAssertMsgFatal(json.is_array(), "Malformed JSON: cannot get workers");
+
+            // Endpoints like "tcp://host:port" or "unix:/path"; an empty list
+            // goes back to running everything here
+        std::vector<std::string> endpoints;
+        for (auto & it : json) {
+            DbAssertMsgFatal(it.is_string(), "Malformed JSON: workers must be strings");
+            endpoints.push_back(it.get<std::string>());
+        }
+
+        DbAssertMsgFatal(endpoints.size() == 0 || secret.size() > 0, "Malformed JSON: remote workers need a secret");
+
+        this->Pipe_Props.Remote_Active = endpoints.size() > 0;
+        this->Pipe_Props.Remote.SetEndpoints(std::move(endpoints));
+        this->Pipe_Props.Remote.SetSecret(secret);
+
+        if (this->Pipe_Props.Remote_Active) {
+            this->Pipe_Props.Monitor.SetWrangler(&this->Pipe_Props.Remote);
+        }
+        else {
+            this->Pipe_Props.Monitor.SetWrangler(&this->Pipe_Props.Wrangler);
+        }
+        msg->set_OK();
+    });
+}
+
+void Pipeline::_start_worker(Conduits::Raw::IMessage * msg) noexcept
+{
+    this->savvy_try_wrap_read_json(msg, 0, [&](JSON json) {
+        DbAssertMsgFatal(json.is_object(), "Malformed JSON: expected listen and secret");
+
+            // Whoever connects can have us run tools, so they must know this
+        auto secret = json.value("secret", std::string());
+        DbAssertMsgFatal(secret.size() > 0, "Malformed JSON: cannot get secret");
+
+        json = json["listen"];
+        DbAssertMsgFatal(json.is_string(), "Malformed JSON: cannot get listen endpoint");
+
+        this->Pipe_Props.Worker.Begin(json.get<JSON::string_t>(), secret);
+        msg->set_OK();
+    });
+}
         
             // Http
 
@@ -122,6 +243,7 @@ void Pipeline::savvy_handle_http(const JSON httpRequest, JSON & httpReply, std::
 		<< "  <h1>Pipeline</h1>" << std::endl
 		<< "  <div style=\"padding-left:.5em\">" << this->html_create_action_relay_string() << "</div><br/>" << std::endl
 		<< "  <div><b>Available pipeline tools:</b><div style=\"padding-left:.5em\">" << this->Pipe_Props.Wrangler.GetAvailableTools() << "</div><br/>" << std::endl
+		<< "  <div><b>Remote workers:</b><div style=\"padding-left:.5em\">" << (this->Pipe_Props.Remote_Active ? this->Pipe_Props.Remote.GetConnectedWorkers() : "none") << "</div><br/>" << std::endl
 		<< "  <div><b>Hubs tracked:</b></div><div style=\"padding-left:.5em\">";
         
     JSON info = this->Pipe_Props.Monitor.AsynchGetTrackedInformation();
@@ -157,6 +279,17 @@ void Pipeline::savvy_handle_http(const JSON httpRequest, JSON & httpReply, std::
             anyWritten = true;
         }
     }
+
+	ss	<< "  </div><br/><div><b>Queues:</b></div><div style=\"padding-left:.5em\">";
+    JSON queues = info["queues"];
+    if (queues.is_object()) {
+        bool anyWritten = false;
+        for (auto & it : queues.items()) {
+            if (anyWritten) ss << "<br/>";
+		    ss << it.key() << ": " << it.value().dump();
+            anyWritten = true;
+        }
+    }
         
     ss << "</div>" << std::endl
 		<< " </body>" << std::endl
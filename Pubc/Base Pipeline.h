@@ -11,6 +11,8 @@
 #include "HephaestusBase/Pubc/Interface Pipeline.h"
 #include "HephaestusBase/Pubc/File Change Monitor.h"
 #include "HephaestusBase/Pubc/Pipe Wrangler.h"
+#include "HephaestusBase/Pubc/Remote Wrangler.h"
+#include "HephaestusBase/Pubc/Remote Worker.h"
 
 namespace Hephaestus {
 namespace Base {
@@ -20,6 +22,8 @@ namespace Base {
 
         using FileMonitor  = Hephaestus::Pipeline::Monitor::FileChangeMonitor;
         using PipeWrangler = Hephaestus::Pipeline::Wrangler::PipeWrangler;
+        using RemoteWrangler = Hephaestus::Pipeline::Wrangler::RemoteWrangler;
+        using RemoteWorker = Hephaestus::Pipeline::Wrangler::RemoteWorker;
     protected:
 
         struct __PipeProps {
@@ -28,6 +32,13 @@ namespace Base {
             FileMonitor     Monitor;
             PipeWrangler    Wrangler;
 
+                // If set, pipes are sent to workers instead of 'Wrangler'
+            bool            Remote_Active;
+            RemoteWrangler  Remote;
+
+                // Runs pipes for other pipelines, if told to
+            RemoteWorker    Worker;
+
         } Pipe_Props;
 
 	public:
@@ -47,6 +58,9 @@ namespace Base {
 
         CON_RMR_DECLARE_FUNC(set_reference_directory);
         CON_RMR_DECLARE_FUNC(set_persistent_directory);
+        CON_RMR_DECLARE_FUNC(set_change_detection);
+        CON_RMR_DECLARE_FUNC(set_remote_workers);
+        CON_RMR_DECLARE_FUNC(start_worker);
 	};
 
 }
@@ -0,0 +1,289 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include "HephaestusBase/Pubc/Content Hash.h"
+
+using namespace Hephaestus::Pipeline::Monitor;
+
+namespace {
+    const uint64 C1 = 0x87c37b91114253d5ull;
+    const uint64 C2 = 0x4cf5ad432745937full;
+
+    inline uint64 RotL(uint64 v, int r) {
+        return (v << r) | (v >> (64 - r));
+    }
+
+    inline uint64 FMix(uint64 k) {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdull;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ull;
+        k ^= k >> 33;
+        return k;
+    }
+
+    const uint32 DigestRounds[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+    };
+
+    inline uint32 RotR(uint32 v, int r) {
+        return (v >> r) | (v << (32 - r));
+    }
+}
+
+    //  Hasher
+    // --------------------
+
+ContentHasher::ContentHasher()
+{
+    this->State      = 0x9e3779b97f4a7c15ull;
+    this->Length     = 0;
+    this->TailLength = 0;
+}
+
+void ContentHasher::Mix(uint64 k)
+{
+    k *= C1;
+    k  = RotL(k, 31);
+    k *= C2;
+
+    this->State ^= k;
+    this->State  = RotL(this->State, 27) * 5 + 0x52dce729;
+}
+
+void ContentHasher::Update(const void * data, std::size_t length)
+{
+    auto * bytes = static_cast<const uint8*>(data);
+    this->Length += length;
+
+        // Finish a word we started last time
+    while (this->TailLength > 0 && this->TailLength < 8 && length > 0) {
+        this->Tail[this->TailLength++] = *bytes++;
+        length--;
+    }
+    if (this->TailLength == 8) {
+        uint64 k;
+        std::memcpy(&k, this->Tail, 8);
+        this->Mix(k);
+        this->TailLength = 0;
+    }
+
+    while (length >= 8) {
+        uint64 k;
+        std::memcpy(&k, bytes, 8);
+        this->Mix(k);
+        bytes  += 8;
+        length -= 8;
+    }
+
+    while (length > 0) {
+        this->Tail[this->TailLength++] = *bytes++;
+        length--;
+    }
+}
+
+uint64 ContentHasher::Finish()
+{
+    uint64 k = 0;
+    for (uint32 i = 0; i < this->TailLength; i++) {
+        k |= uint64(this->Tail[i]) << (i * 8);
+    }
+    if (this->TailLength > 0) {
+        this->State ^= RotL(k * C1, 31) * C2;
+    }
+
+    return FMix(this->State ^ this->Length);
+}
+
+    //  Digest
+    // --------------------
+
+ContentDigest::ContentDigest()
+{
+    const uint32 initial[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+    std::memcpy(this->State, initial, sizeof(initial));
+
+    this->Length      = 0;
+    this->BlockLength = 0;
+}
+
+void ContentDigest::Compress(const uint8 * block)
+{
+    uint32 w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32(block[i * 4]) << 24) | (uint32(block[i * 4 + 1]) << 16) |
+               (uint32(block[i * 4 + 2]) << 8) | uint32(block[i * 4 + 3]);
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32 s0 = RotR(w[i - 15], 7) ^ RotR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32 s1 = RotR(w[i - 2], 17) ^ RotR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32 a = this->State[0], b = this->State[1], c = this->State[2], d = this->State[3];
+    uint32 e = this->State[4], f = this->State[5], g = this->State[6], h = this->State[7];
+
+    for (int i = 0; i < 64; i++) {
+        uint32 s1  = RotR(e, 6) ^ RotR(e, 11) ^ RotR(e, 25);
+        uint32 ch  = (e & f) ^ (~e & g);
+        uint32 t1  = h + s1 + ch + DigestRounds[i] + w[i];
+        uint32 s0  = RotR(a, 2) ^ RotR(a, 13) ^ RotR(a, 22);
+        uint32 maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32 t2  = s0 + maj;
+
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    this->State[0] += a; this->State[1] += b; this->State[2] += c; this->State[3] += d;
+    this->State[4] += e; this->State[5] += f; this->State[6] += g; this->State[7] += h;
+}
+
+void ContentDigest::Update(const void * data, std::size_t length)
+{
+    auto * bytes = static_cast<const uint8*>(data);
+    this->Length += length;
+
+        // Finish a block we started last time
+    if (this->BlockLength > 0) {
+        auto take = std::min<std::size_t>(64 - this->BlockLength, length);
+        std::memcpy(this->Block + this->BlockLength, bytes, take);
+        this->BlockLength += uint32(take);
+        bytes  += take;
+        length -= take;
+
+        if (this->BlockLength < 64)
+            return;
+        this->Compress(this->Block);
+        this->BlockLength = 0;
+    }
+
+    while (length >= 64) {
+        this->Compress(bytes);
+        bytes  += 64;
+        length -= 64;
+    }
+
+    std::memcpy(this->Block, bytes, length);
+    this->BlockLength = uint32(length);
+}
+
+std::string ContentDigest::Finish()
+{
+    uint64 bits = this->Length * 8;
+
+        // Pad with a single one bit, zeroes, and the length in bits
+    uint8 padding[72] = { 0x80 };
+    std::size_t padLength = (this->BlockLength < 56 ? 56 : 120) - this->BlockLength;
+    for (int i = 0; i < 8; i++) {
+        padding[padLength + i] = uint8(bits >> (56 - i * 8));
+    }
+    this->Update(padding, padLength + 8);
+
+    static const char hex[] = "0123456789abcdef";
+
+    std::string digest;
+    digest.reserve(64);
+    for (auto word : this->State) {
+        for (int i = 28; i >= 0; i -= 4) {
+            digest.push_back(hex[(word >> i) & 0xF]);
+        }
+    }
+    return digest;
+}
+
+    //  Files
+    // --------------------
+
+bool Hephaestus::Pipeline::Monitor::HashFileContents(const BlackRoot::IO::FilePath path, uint64 & hash)
+{
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream)
+        return false;
+
+    ContentHasher hasher;
+    char buffer[64 * 1024];
+
+    while (stream) {
+        stream.read(buffer, sizeof(buffer));
+        hasher.Update(buffer, std::size_t(stream.gcount()));
+    }
+    if (stream.bad())
+        return false;
+
+    hash = hasher.Finish();
+    return true;
+}
+
+bool Hephaestus::Pipeline::Monitor::DigestFileContents(const BlackRoot::IO::FilePath path, std::string & digest)
+{
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream)
+        return false;
+
+    ContentDigest hasher;
+    char buffer[64 * 1024];
+
+    while (stream) {
+        stream.read(buffer, sizeof(buffer));
+        hasher.Update(buffer, std::size_t(stream.gcount()));
+    }
+    if (stream.bad())
+        return false;
+
+    digest = hasher.Finish();
+    return true;
+}
+
+#ifdef _WIN32
+
+bool Hephaestus::Pipeline::Monitor::ReadFileStamp(const BlackRoot::IO::FilePath path, FileStamp & stamp)
+{
+    HANDLE file = CreateFileW(path.wstring().c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    BY_HANDLE_FILE_INFORMATION info;
+    bool ok = GetFileInformationByHandle(file, &info) != 0;
+    CloseHandle(file);
+    if (!ok)
+        return false;
+
+    stamp.Size = (uint64(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+    return true;
+}
+
+#else
+
+bool Hephaestus::Pipeline::Monitor::ReadFileStamp(const BlackRoot::IO::FilePath path, FileStamp & stamp)
+{
+    struct stat st;
+    if (stat(path.string().c_str(), &st) != 0)
+        return false;
+
+    stamp.Size = uint64(st.st_size);
+    return true;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,67 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+/* {quality} This is very much a sketch
+ */
+
+#pragma once
+
+#include <string>
+
+#include "BlackRoot/Pubc/Number Types.h"
+#include "BlackRoot/Pubc/Files Types.h"
+
+namespace Hephaestus {
+namespace Pipeline {
+namespace Monitor {
+
+        // What we can learn about a file without reading it
+    struct FileStamp {
+        uint64      Size;
+    };
+
+        // All return false if the file cannot be read; none throws
+    bool    ReadFileStamp(const BlackRoot::IO::FilePath, FileStamp &);
+    bool    HashFileContents(const BlackRoot::IO::FilePath, uint64 & hash);
+    bool    DigestFileContents(const BlackRoot::IO::FilePath, std::string & digest);
+
+        // Fast non-cryptographic 64-bit hash; it only needs to tell apart
+        // versions of the same file, not resist anyone trying to collide it
+    class ContentHasher {
+    protected:
+        uint64      State, Length;
+        uint8       Tail[8];
+        uint32      TailLength;
+
+        void    Mix(uint64);
+
+    public:
+        ContentHasher();
+
+        void    Update(const void *, std::size_t);
+        uint64  Finish();
+    };
+
+        // SHA-256, for where equal digests have to mean equal contents, as
+        // when outputs are put back by what they and their inputs hash to;
+        // 'Finish' gives the digest as 64 lowercase hex characters
+    class ContentDigest {
+    protected:
+        uint32      State[8];
+        uint64      Length;
+        uint8       Block[64];
+        uint32      BlockLength;
+
+        void    Compress(const uint8 *);
+
+    public:
+        ContentDigest();
+
+        void        Update(const void *, std::size_t);
+        std::string Finish();
+    };
+
+}
+}
+}
\ No newline at end of file
@@ -0,0 +1,129 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "HephaestusBase/Pubc/Directory Stat.h"
+
+using namespace Hephaestus::Pipeline::Monitor;
+
+#ifdef _WIN32
+
+namespace {
+    BlackRoot::IO::FileTime FromFileTime(const FILETIME & time)
+    {
+            // 100ns intervals since 1601, to the unix epoch
+        uint64 ticks = (uint64(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+        ticks -= 116444736000000000ull;
+        return BlackRoot::IO::FileTime{} + std::chrono::duration_cast<BlackRoot::IO::FileTime::duration>(std::chrono::nanoseconds(ticks * 100));
+    }
+
+        // Names on Windows do not care about case, so neither may we; the
+        // invariant upper case is what ordinal case-insensitive compares use
+    std::wstring FoldCase(const std::wstring & name)
+    {
+        std::wstring folded(name);
+        if (folded.size() > 0) {
+            LCMapStringEx(LOCALE_NAME_INVARIANT, LCMAP_UPPERCASE, name.c_str(), int(name.size()),
+                          &folded[0], int(folded.size()), nullptr, nullptr, 0);
+        }
+        return folded;
+    }
+}
+
+bool Hephaestus::Pipeline::Monitor::StatDirectoryEntries(const BlackRoot::IO::FilePath dir, const std::vector<std::string> & names, std::vector<EntryStat> & stats)
+{
+    stats.assign(names.size(), EntryStat{ false, {} });
+
+        // Names that differ only in case are the same file
+    std::unordered_map<std::wstring, std::vector<std::size_t>> wanted;
+    for (std::size_t i = 0; i < names.size(); i++) {
+        wanted[FoldCase(BlackRoot::IO::FilePath(names[i]).wstring())].push_back(i);
+    }
+
+        // One listing gives us the name, attributes and time of everything
+    WIN32_FIND_DATAW data;
+    HANDLE find = FindFirstFileExW((dir / "*").wstring().c_str(), FindExInfoBasic, &data,
+                                   FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+    if (find == INVALID_HANDLE_VALUE)
+        return false;
+
+    do {
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            continue;
+        auto found = wanted.find(FoldCase(data.cFileName));
+        if (found == wanted.end())
+            continue;
+        for (auto index : found->second) {
+            auto & stat = stats[index];
+            stat.Exists    = true;
+            stat.WriteTime = FromFileTime(data.ftLastWriteTime);
+        }
+    } while (FindNextFileW(find, &data));
+
+    FindClose(find);
+    return true;
+}
+
+bool Hephaestus::Pipeline::Monitor::ReadDirectoryWriteTime(const BlackRoot::IO::FilePath dir, BlackRoot::IO::FileTime & time)
+{
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExW(dir.wstring().c_str(), GetFileExInfoStandard, &data))
+        return false;
+    time = FromFileTime(data.ftLastWriteTime);
+    return true;
+}
+
+#else
+
+namespace {
+    BlackRoot::IO::FileTime FromTimespec(const struct timespec & time)
+    {
+        auto since = std::chrono::seconds(time.tv_sec) + std::chrono::nanoseconds(time.tv_nsec);
+        return BlackRoot::IO::FileTime{} + std::chrono::duration_cast<BlackRoot::IO::FileTime::duration>(since);
+    }
+}
+
+bool Hephaestus::Pipeline::Monitor::StatDirectoryEntries(const BlackRoot::IO::FilePath dir, const std::vector<std::string> & names, std::vector<EntryStat> & stats)
+{
+    stats.assign(names.size(), EntryStat{ false, {} });
+
+        // Every stat is relative to the open directory, so the path up to
+        // it is only walked the once
+    int fd = open(dir.string().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    for (std::size_t i = 0; i < names.size(); i++) {
+        struct stat st;
+        if (fstatat(fd, names[i].c_str(), &st, 0) != 0 || !S_ISREG(st.st_mode))
+            continue;
+        stats[i].Exists    = true;
+        stats[i].WriteTime = FromTimespec(st.st_mtim);
+    }
+
+    close(fd);
+    return true;
+}
+
+bool Hephaestus::Pipeline::Monitor::ReadDirectoryWriteTime(const BlackRoot::IO::FilePath dir, BlackRoot::IO::FileTime & time)
+{
+    struct stat st;
+    if (stat(dir.string().c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+        return false;
+    time = FromTimespec(st.st_mtim);
+    return true;
+}
+
+#endif
\ No newline at end of file
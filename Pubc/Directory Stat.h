@@ -0,0 +1,38 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+/* {quality} This is very much a sketch
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "BlackRoot/Pubc/Number Types.h"
+#include "BlackRoot/Pubc/Files Types.h"
+
+namespace Hephaestus {
+namespace Pipeline {
+namespace Monitor {
+
+    struct EntryStat {
+        bool                    Exists;
+        BlackRoot::IO::FileTime WriteTime;
+    };
+
+        // Looks up many files of one directory at once; the directory is
+        // resolved a single time, and on Windows a single listing of it has
+        // everything. Only regular files exist as far as this is concerned.
+        // Returns false if the directory cannot be read, in which case none
+        // of the entries exist
+    bool    StatDirectoryEntries(const BlackRoot::IO::FilePath dir, const std::vector<std::string> & names, std::vector<EntryStat> & stats);
+
+        // The time entries were last added, removed or renamed; writing to
+        // a file in place does not change it
+    bool    ReadDirectoryWriteTime(const BlackRoot::IO::FilePath dir, BlackRoot::IO::FileTime &);
+
+}
+}
+}
\ No newline at end of file
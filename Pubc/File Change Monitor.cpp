@@ -3,8 +3,6 @@
  * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
 
  /* {todo}
-  * - Currently this uses a single mutex to reserve quite a lot; if this sees more
-  *   action, that will becom a bottleneck.
   * - Property use move semantics
   * - Detect circular dependancies (hub files can link in themselves!)
   * - Timeout for error files could increase upon repeated errors (?)
@@ -23,15 +21,53 @@
 #include "BlackRoot/Pubc/Files.h"
 #include "BlackRoot/Pubc/JSON.h"
 #include "BlackRoot/Pubc/Stringstream.h"
-#include "BlackRoot/Pubc/File Wildcard.h"
 
 #include "HephaestusBase/Pubc/File Change Monitor.h"
+#include "HephaestusBase/Pubc/Pipe Tool.h"
 
 using namespace Hephaestus::Pipeline;
 using namespace Hephaestus::Pipeline::Monitor;
 
 namespace fs = std::experimental::filesystem;
 
+namespace {
+
+    void HashCombine(Fingerprint & seed, Fingerprint value)
+    {
+        seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    }
+
+    void EraseFromIndex(std::unordered_multimap<Fingerprint, InternalID> & index, Fingerprint key, InternalID id)
+    {
+        auto range = index.equal_range(key);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second != id)
+                continue;
+            index.erase(it);
+            return;
+        }
+    }
+
+    void LinkReverse(std::unordered_map<InternalID, std::unordered_set<InternalID>> & index, InternalID key, InternalID user)
+    {
+        if (key == InternalIDNone)
+            return;
+        index[key].insert(user);
+    }
+
+    void UnlinkReverse(std::unordered_map<InternalID, std::unordered_set<InternalID>> & index, InternalID key, InternalID user)
+    {
+        auto it = index.find(key);
+        if (it == index.end())
+            return;
+        it->second.erase(user);
+        if (it->second.size() == 0) {
+            index.erase(it);
+        }
+    }
+
+}
+
     //  Setup
     // --------------------
 
@@ -43,11 +79,26 @@ FileChangeMonitor::FileChangeMonitor()
 
     this->OriginalHubDependancy = this->GetNewID();
 
-    this->WranglerResultCount = 0;
 
     this->PendingSaveChanges = true;
 
-    this->FileSource = new BlackRoot::IO::BaseFileSource();
+    this->TrackedInformationRequested = true;
+    this->PendingTrackedChanges       = true;
+
+    this->PersistStop        = false;
+    this->PersistGeneration  = 0;
+    this->JournalRecordCount = 0;
+    this->JournalValidLength = 0;
+
+    this->ExportPersistentJSON = false;
+    this->UseContentHashes     = false;
+    this->ScanThreads          = std::min(3u, std::thread::hardware_concurrency());
+    this->SkipUnchangedDirectories = false;
+
+        // Persistence is written from its own thread, so it gets its own source
+    this->FileSource        = new BlackRoot::IO::BaseFileSource();
+    this->PersistFileSource = new BlackRoot::IO::BaseFileSource();
+    this->Notifier          = Monitor::CreateChangeNotifier();
 }
 
 FileChangeMonitor::~FileChangeMonitor()
@@ -58,6 +109,8 @@ FileChangeMonitor::~FileChangeMonitor()
         cout{} << "!!Change monitor was not stopped before being destructed!";
     }
 
+    delete this->Notifier;
+    delete this->PersistFileSource;
     delete this->FileSource;
 }
 
@@ -66,8 +119,11 @@ FileChangeMonitor::~FileChangeMonitor()
 
 void FileChangeMonitor::UpdateCycle()
 {
+        // All monitor state is owned by this thread, so none of this takes a
+        // lock; other threads only hand over work or read published snapshots
     while (this->TargetState == State::Running) {
-        std::unique_lock<std::mutex> lock(this->MutexAccessFiles);
+        this->UpdateBaseHubFiles();
+
         this->UpdateSuspectPaths();
         this->UpdateSuspectWildcards();
 
@@ -85,104 +141,206 @@ void FileChangeMonitor::UpdateCycle()
         this->UpdatePipeInbox();
 
         if (this->PendingSaveChanges) {
+            this->PendingTrackedChanges = true;
             this->SaveToPersistent();
         }
 
-        lock.unlock();
-        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+        this->PublishTrackedInformation();
+
+            // Block until something may have changed; the notifier never waits
+            // long, as timed out paths, hubs and pipes need to be looked at again
+        this->WaitForChanges();
+    }
+}
+
+void FileChangeMonitor::WaitForChanges()
+{
+    ChangeNotification notification;
+    notification.SetDefault();
+
+    this->Notifier->WaitForChanges(notification, std::chrono::milliseconds(250));
+
+        // If the notifier cannot tell what changed, everything is suspect
+    if (notification.AllSuspect) {
+        for (auto & it : this->MonitoredPaths) {
+            this->FutureSuspectPaths.Push(it.first);
+            this->PolledPaths.insert(it.first);
+        }
+        for (auto & it : this->MonitoredWildcards) {
+            this->FutureSuspectWildcards.Push(it.first);
+        }
+        return;
+    }
+
+    this->FutureSuspectPaths.Push(notification.Paths.begin(), notification.Paths.end());
+    for (auto id : notification.Paths) {
+        this->PolledPaths.erase(id);
+    }
+    this->FutureSuspectWildcards.Push(notification.Wildcards.begin(), notification.Wildcards.end());
+}
+
+void FileChangeMonitor::UpdateBaseHubFiles()
+{
+    std::vector<Monitor::Path> paths;
+
+    std::unique_lock<std::mutex> lock(this->MxBaseHubFiles);
+    paths.swap(this->PendingBaseHubFiles);
+    lock.unlock();
+
+    for (auto & path : paths) {
+        HubProp hub;
+        hub.SetDefault();
+        hub.HubDependency = this->OriginalHubDependancy;
+        hub.Path = path;
+
+            // We always set a variable "cur-dir" to be the parent directory of
+            // the file. Hubs themselves then use this variable as a relative path.
+        hub.InputProcessProp.StringVariables.Set("cur-dir", hub.Path.parent_path().string());
+
+        this->FindOrAddHub(hub);
     }
 }
 
 void FileChangeMonitor::UpdateSuspectWildcards()
 {
-    this->SuspectWildcards.insert(this->SuspectWildcards.end(), this->FutureSuspectWildcards.begin(), this->FutureSuspectWildcards.end());
-    this->FutureSuspectWildcards.resize(0);
+    this->SuspectWildcards.MoveFrom(this->FutureSuspectWildcards);
 
-    while (this->SuspectWildcards.size() > 0) {
+    while (!this->SuspectWildcards.Empty()) {
         if (this->ShouldInterrupt())
             break;
 
             // Select a single path from our suspect list and try to update it
             // If anything fails the update function will put it in the list again
-        auto id = *this->SuspectWildcards.begin();
-        this->SuspectWildcards.erase(std::remove(this->SuspectWildcards.begin(), this->SuspectWildcards.end(), id), this->SuspectWildcards.end());
+        InternalID id;
+        this->SuspectWildcards.Pop(id);
         this->UpdateSuspectWildcard(id);
     }
-
-        // Debug; for now just make all wildcards suspect to check functionality
-    for (auto it : this->MonitoredWildcards) {
-        this->SuspectWildcards.push_back(it.first);
-    }
 }
 
 void FileChangeMonitor::UpdateSuspectPaths()
 {
-    this->SuspectPaths.insert(this->SuspectPaths.end(), this->FutureSuspectPaths.begin(), this->FutureSuspectPaths.end());
-    this->FutureSuspectPaths.resize(0);
+    this->SuspectPaths.MoveFrom(this->FutureSuspectPaths);
 
-    while (this->SuspectPaths.size() > 0) {
+        // Use the current time as a reference for file changes
+    Monitor::TimePoint currentTime = std::chrono::system_clock::now();
+
+    std::vector<PathScan>      scans;
+    std::vector<DirectoryScan> directories;
+    std::unordered_map<std::string, std::size_t> directoryIndex;
+
+    while (!this->SuspectPaths.Empty()) {
         if (this->ShouldInterrupt())
             break;
 
-            // Select a single path from our suspect list and try to update it
-            // If anything fails the update function will put it in the list again
-        auto id = *this->SuspectPaths.begin();
-        this->SuspectPaths.erase(std::remove(this->SuspectPaths.begin(), this->SuspectPaths.end(), id), this->SuspectPaths.end());
-        this->UpdateSuspectPath(id);
+        InternalID id;
+        this->SuspectPaths.Pop(id);
+
+            // Find the path properties
+        auto itProp = this->MonitoredPaths.find(id);
+        if (itProp == this->MonitoredPaths.end()) {
+            this->PolledPaths.erase(id);
+            continue;
+        }
+        auto & prop = itProp->second;
+
+            // A timeout prevents a file from updating;
+            // if we are timed out just put us on the dirty list
+        if (prop.Timeout > currentTime) {
+            this->FutureSuspectPaths.Push(id);
+            continue;
+        }
+
+        PathScan scan;
+        scan.ID         = id;
+        scan.Path       = prop.Path;
+        scan.LastUpdate = prop.LastUpdate;
+        scan.MaySkip    = this->PolledPaths.erase(id) > 0;
+
+            // Group by directory, so every directory is only opened once
+        auto directory = prop.Path.parent_path();
+        auto inserted  = directoryIndex.emplace(directory.string(), directories.size());
+        if (inserted.second) {
+            DirectoryScan dirScan;
+            dirScan.Directory = directory;
+
+            auto previous = this->DirectoryWriteTimes.find(inserted.first->first);
+            dirScan.HasPreviousTime = previous != this->DirectoryWriteTimes.end();
+            if (dirScan.HasPreviousTime) {
+                dirScan.PreviousTime = previous->second;
+            }
+            directories.push_back(std::move(dirScan));
+        }
+
+        directories[inserted.first->second].Scans.push_back(scans.size());
+        scans.push_back(std::move(scan));
     }
 
-        // Debug; for now just make all paths suspect to check functionality
-    for (auto it : this->MonitoredPaths) {
-        this->SuspectPaths.push_back(it.first);
+        // All of the file system calls happen at once, spread over the pool;
+        // only after do we touch any state. If anything fails the update
+        // function will put the path in the list again
+    this->Scanner.ForEach(directories.size(), [&](std::size_t item, std::size_t) {
+        this->ScanSuspectDirectory(directories[item], scans);
+    });
+
+    if (this->SkipUnchangedDirectories) {
+        for (auto & dirScan : directories) {
+            if (dirScan.HasWriteTime) {
+                this->DirectoryWriteTimes[dirScan.Directory.string()] = dirScan.WriteTime;
+            }
+            else {
+                this->DirectoryWriteTimes.erase(dirScan.Directory.string());
+            }
+        }
+    }
+
+    for (auto & scan : scans) {
+        this->ApplySuspectPath(scan);
     }
 }
 
 void FileChangeMonitor::UpdateDirtyHubs()
 {
-    this->DirtyHubs.insert(this->DirtyHubs.end(), this->FutureDirtyHubs.begin(), this->FutureDirtyHubs.end());
-    this->FutureDirtyHubs.resize(0);
+    this->DirtyHubs.MoveFrom(this->FutureDirtyHubs);
 
-    while (this->DirtyHubs.size() > 0) {
+    while (!this->DirtyHubs.Empty()) {
         if (this->ShouldInterrupt())
             break;
 
             // Select a single hub from our suspect list and try to update it
             // If anything fails the update function will put it in the list again
-        auto id = *this->DirtyHubs.begin();
-        this->DirtyHubs.erase(std::remove(this->DirtyHubs.begin(), this->DirtyHubs.end(), id), this->DirtyHubs.end());
+        InternalID id;
+        this->DirtyHubs.Pop(id);
         this->UpdateDirtyHub(id);
     }
 }
 
 void FileChangeMonitor::UpdateDirtyPipeWildcards()
 {
-    this->DirtyPipeWildcards.insert(this->DirtyPipeWildcards.end(), this->FutureDirtyPipeWildcards.begin(), this->FutureDirtyPipeWildcards.end());
-    this->FutureDirtyPipeWildcards.resize(0);
+    this->DirtyPipeWildcards.MoveFrom(this->FutureDirtyPipeWildcards);
 
-    while (this->DirtyPipeWildcards.size() > 0) {
+    while (!this->DirtyPipeWildcards.Empty()) {
         if (this->ShouldInterrupt())
             break;
 
             // Select a wildcard from our dirty list and try to update it
-        auto id = *this->DirtyPipeWildcards.begin();
-        this->DirtyPipeWildcards.erase(std::remove(this->DirtyPipeWildcards.begin(), this->DirtyPipeWildcards.end(), id), this->DirtyPipeWildcards.end());
+        InternalID id;
+        this->DirtyPipeWildcards.Pop(id);
         this->UpdateDirtyPipeWildcard(id);
     }
 }
 
 void FileChangeMonitor::UpdateDirtyPipes()
 {
-    this->DirtyPipes.insert(this->DirtyPipes.end(), this->FutureDirtyPipes.begin(), this->FutureDirtyPipes.end());
-    this->FutureDirtyPipes.resize(0);
+    this->DirtyPipes.MoveFrom(this->FutureDirtyPipes);
 
-    while (this->DirtyPipes.size() > 0) {
+    while (!this->DirtyPipes.Empty()) {
         if (this->ShouldInterrupt())
             break;
 
             // Select a single pipe from our suspect list and try to send it
             // If anything fails the update function will put it in the list again
-        auto id = *this->DirtyPipes.begin();
-        this->DirtyPipes.erase(std::remove(this->DirtyPipes.begin(), this->DirtyPipes.end(), id), this->DirtyPipes.end());
+        InternalID id;
+        this->DirtyPipes.Pop(id);
         this->UpdateDirtyPipe(id);
     }
 }
@@ -190,37 +348,68 @@ void FileChangeMonitor::UpdateDirtyPipes()
     //  Update paths
     // --------------------
 
-void FileChangeMonitor::UpdateSuspectPath(InternalID id)
-{
-    namespace IO = BlackRoot::IO;
-    using cout = BlackRoot::Util::Cout;
-
-        // Use the current time as a reference for file changes
-    Monitor::TimePoint currentTime = std::chrono::system_clock::now();
+void FileChangeMonitor::ScanSuspectDirectory(DirectoryScan & dirScan, std::vector<PathScan> & scans)
+{
+        // Runs on any thread of the scan pool; only reads the file system
+        // and fills in its own scans
+    for (auto index : dirScan.Scans) {
+        auto & scan = scans[index];
+        scan.Exists  = false;
+        scan.Changed = false;
+        scan.Hashed  = false;
+        scan.Skipped = false;
+        scan.Failed  = false;
+    }
+
+    dirScan.HasWriteTime = false;
+    if (this->SkipUnchangedDirectories) {
+        dirScan.HasWriteTime = Monitor::ReadDirectoryWriteTime(dirScan.Directory, dirScan.WriteTime);
+
+            // Nothing came or went, so we take it nothing changed; but a
+            // path the notifier named may well have been written in place
+        if (dirScan.HasWriteTime && dirScan.HasPreviousTime &&
+            this->FileTimeEqualsWithEpsilon(dirScan.PreviousTime, dirScan.WriteTime)) {
+            for (auto index : dirScan.Scans) {
+                scans[index].Skipped = scans[index].MaySkip;
+            }
+        }
+    }
 
-        // Find the path properties
-    auto itProp = this->MonitoredPaths.find(id);
-    if (itProp == this->MonitoredPaths.end())
+        // One lookup of the directory tells us which files exist and when
+        // they were written; a directory that is gone has no files
+    std::vector<std::size_t> looked;
+    std::vector<std::string> names;
+    looked.reserve(dirScan.Scans.size());
+    names.reserve(dirScan.Scans.size());
+    for (auto index : dirScan.Scans) {
+        if (scans[index].Skipped)
+            continue;
+        looked.push_back(index);
+        names.push_back(scans[index].Path.filename().string());
+    }
+    if (looked.size() == 0)
         return;
-    auto & prop = itProp->second;
 
-        // A timeout prevents a file from updating;
-        // if we are timed out just put us on the dirty list
-    if (prop.Timeout > currentTime) {
-        this->FutureSuspectPaths.push_back(id);
-        return;
+    std::vector<Monitor::EntryStat> stats;
+    if (!Monitor::StatDirectoryEntries(dirScan.Directory, names, stats)) {
+            // A directory that is there but cannot be read is an error
+        BlackRoot::IO::FileTime time;
+        if (Monitor::ReadDirectoryWriteTime(dirScan.Directory, time)) {
+            for (auto index : looked) {
+                scans[index].Failed = true;
+            }
+            return;
+        }
     }
 
-    IO::FileTime fileWriteTime;
-    
-        // Safety try in case any files are changed while we are doing this
-    try {
+    for (std::size_t i = 0; i < looked.size(); i++) {
+        auto & scan = scans[looked[i]];
+
             // If the file does not exist we keep trying until it does; if the
             // file is no longer referenced the monitored path will be removed
-        if (!this->FileSource->FileExists(prop.Path)) {
-            this->HandleMonitoredPathMissing(id);
-            return;
-        }
+        if (!stats[i].Exists)
+            continue;
+        scan.Exists = true;
 
             // Check if file was actually updated since last we remember
             // We check whether the update _equals_ to ensure shenanigans so
@@ -228,21 +417,58 @@ void FileChangeMonitor::UpdateSuspectPath(InternalID id)
             // have a minimum impact
             // We take a few ms margin to allow these times to be passed around
             // with millisecond precision (to facilitate non-STD dynlibs etc)
-        fileWriteTime = this->FileSource->LastWriteTime(prop.Path);
-
-        if (this->FileTimeEqualsWithEpsilon(prop.LastUpdate, fileWriteTime)) {
-            return;
+        scan.WriteTime = stats[i].WriteTime;
+        scan.Changed   = !this->FileTimeEqualsWithEpsilon(scan.LastUpdate, scan.WriteTime);
+
+            // The time changed, but that does not mean the contents did; a
+            // checkout or a touch leaves identical bytes behind
+        if (scan.Changed && this->UseContentHashes) {
+            scan.Hashed = Monitor::ReadFileStamp(scan.Path, scan.Stamp) &&
+                          Monitor::HashFileContents(scan.Path, scan.Hash);
         }
     }
-    catch (BlackRoot::Debug::Exception * e) {
-        this->HandleMonitoredPathError(id, e);
+}
+
+void FileChangeMonitor::ApplySuspectPath(PathScan & scan)
+{
+    using cout = BlackRoot::Util::Cout;
+
+    auto id = scan.ID;
+
+    auto itProp = this->MonitoredPaths.find(id);
+    if (itProp == this->MonitoredPaths.end())
         return;
-    }
-    catch (...) {
+    auto & prop = itProp->second;
+
+    if (scan.Skipped)
+        return;
+
+    if (scan.Failed) {
         this->HandleMonitoredPathError(id, nullptr);
         return;
     }
-    
+
+    if (!scan.Exists) {
+        this->HandleMonitoredPathMissing(id);
+        return;
+    }
+
+    if (!scan.Changed)
+        return;
+
+    auto fileWriteTime = scan.WriteTime;
+
+        // A hash we did not keep up to date would later claim contents are
+        // unchanged when they are not; without hashing we forget it
+    if (!this->UseContentHashes) {
+        prop.HasContentHash = false;
+    }
+    else if (!this->UpdateContentHash(prop, scan)) {
+        prop.LastUpdate = fileWriteTime;
+        this->MarkPathForPersist(id);
+        return;
+    }
+
     this->PendingSaveChanges    = true;
     
         // If the file was updated after our last update we consider _all_ things
@@ -258,6 +484,7 @@ void FileChangeMonitor::UpdateSuspectPath(InternalID id)
 
         // Update path meta
     prop.LastUpdate = fileWriteTime;
+    this->MarkPathForPersist(id);
 }
 
     //  Update wildcards
@@ -274,7 +501,9 @@ void FileChangeMonitor::UpdateSuspectWildcard(InternalID id)
         return;
     auto & prop = itProp->second;
 
-    if (prop.Check.Check(this->FileSource)) {
+        // A single wildcard can cover most of a tree, so its walk is
+        // spread over the scan pool
+    if (prop.Check.Check(this->FileSource, &this->Scanner)) {
         this->MakeUsersOfWildcardDirty(id);
     }
 }
@@ -299,24 +528,28 @@ void FileChangeMonitor::UpdateDirtyHub(InternalID id)
         // If we are an orphan we shouldn't update, so add us to
         // a special list to keep track of us
     if (prop.HubDependency == Monitor::InternalIDNone) {
-        this->OrphanedDirtyHubs.push_back(id);
+        this->OrphanedDirtyHubs.Push(id);
         return;
     }
 
         // A timeout prevents a file from updating;
         // if we are timed out just put us on the dirty list
     if (prop.Timeout > currentTime) {
-        this->FutureDirtyHubs.push_back(id);
+        this->FutureDirtyHubs.Push(id);
         return;
     }
     
     this->PendingSaveChanges = true;
-
-        // Make dependants orphan before we even complete the hub process
-    this->MakeDependantsOnHubOrphan(id);
     
     cout{} << "Hub:" << this->SimpleFormatHub(prop) << std::endl << std::endl;
 
+        // Compared against what every entry made last time; only entries
+        // that are new or changed are processed, and only what no entry
+        // made this time is orphaned
+    HubEvaluation eval;
+    eval.Previous = std::move(prop.Entries);
+    prop.Entries.clear();
+
     BlackRoot::IO::BaseFileSource::FCont contents;
     BlackRoot::Format::JSON jsonCont;
 
@@ -326,24 +559,117 @@ void FileChangeMonitor::UpdateDirtyHub(InternalID id)
         jsonCont = BlackRoot::Format::JSON::parse(contents);
         
             // As hub files can have nested properties, we simply process the main file as a group
-        this->ProcessHubGroup(id, prop.InputProcessProp, jsonCont);
+        this->ProcessHubGroup(id, prop.InputProcessProp, jsonCont, eval);
     }
     catch (BlackRoot::Debug::Exception * e) {
+            // A broken hub file leaves what it made before alone; that
+            // includes what was kept or made before it broke
+        prop.Entries = std::move(eval.Previous);
+        for (auto & it : eval.Current) {
+            prop.Entries[it.first] = std::move(it.second);
+        }
         this->HandleHubFileError(id, e);
         return;
     }
     catch (...) {
+        prop.Entries = std::move(eval.Previous);
+        for (auto & it : eval.Current) {
+            prop.Entries[it.first] = std::move(it.second);
+        }
         this->HandleHubFileError(id, nullptr);
         return;
     }
+
+    this->OrphanUnusedHubDependants(id, eval);
+    prop.Entries = std::move(eval.Current);
 }
 
-void FileChangeMonitor::ProcessHubGroup(InternalID id, const ProcessProperties prop, JSON group)
+bool FileChangeMonitor::KeepHubEntry(InternalID id, const std::string & key, HubEvaluation & eval)
+{
+        // The same entry twice in one file makes the same things; the
+        // first copy already accounted for them
+    if (eval.Current.count(key))
+        return true;
+
+    auto found = eval.Previous.find(key);
+    if (found == eval.Previous.end())
+        return false;
+    auto & record = found->second;
+
+        // What it made must still be there, and still be ours
+    for (auto hub : record.Hubs) {
+        auto it = this->HubProperties.find(hub);
+        if (it == this->HubProperties.end() || it->second.HubDependency != id)
+            return false;
+    }
+    for (auto pipe : record.Pipes) {
+        auto it = this->PipeProperties.find(pipe);
+        if (it == this->PipeProperties.end() || it->second.HubDependency != id)
+            return false;
+    }
+    for (auto wild : record.PipeWildcards) {
+        auto it = this->PipeWildcards.find(wild);
+        if (it == this->PipeWildcards.end() || it->second.HubDependency != id)
+            return false;
+    }
+
+    eval.Hubs.insert(record.Hubs.begin(), record.Hubs.end());
+    eval.Pipes.insert(record.Pipes.begin(), record.Pipes.end());
+    eval.PipeWildcards.insert(record.PipeWildcards.begin(), record.PipeWildcards.end());
+    eval.Current[key] = std::move(record);
+    eval.Previous.erase(found);
+    return true;
+}
+
+void FileChangeMonitor::OrphanUnusedHubDependants(InternalID id, HubEvaluation & eval)
+{
+        // The sets are copied as orphaning changes them
+    auto hubs = this->HubChildHubs.find(id);
+    if (hubs != this->HubChildHubs.end()) {
+        InternalIDList children(hubs->second.begin(), hubs->second.end());
+        for (auto child : children) {
+            if (eval.Hubs.count(child))
+                continue;
+            this->SetHubHubDependency(child, Monitor::InternalIDNone);
+            this->PotentiallyOrphanedHubs.Push(child);
+        }
+    }
+
+        // Pipes made by a wildcard live as long as their wildcard entry
+    auto pipes = this->HubChildPipes.find(id);
+    if (pipes != this->HubChildPipes.end()) {
+        InternalIDList children(pipes->second.begin(), pipes->second.end());
+        for (auto child : children) {
+            if (eval.Pipes.count(child))
+                continue;
+            auto wild = this->PipeProperties[child].WildcardDependency;
+            if (wild != Monitor::InternalIDNone && eval.PipeWildcards.count(wild))
+                continue;
+            this->SetPipeHubDependency(child, Monitor::InternalIDNone);
+        }
+    }
+
+        // Wildcards no entry made any more stop making pipes for us
+    for (auto & it : eval.Previous) {
+        for (auto wild : it.second.PipeWildcards) {
+            if (eval.PipeWildcards.count(wild))
+                continue;
+            auto found = this->PipeWildcards.find(wild);
+            if (found != this->PipeWildcards.end() && found->second.HubDependency == id) {
+                this->SetPipeWildcardsHubDependency(wild, Monitor::InternalIDNone);
+            }
+        }
+    }
+}
+
+void FileChangeMonitor::ProcessHubGroup(InternalID id, const ProcessProperties prop, JSON group, HubEvaluation & eval)
 { DbFunctionTry {
     using cout = BlackRoot::Util::Cout;
 
     ProcessProperties subProp = prop;
 
+    auto & hubKey = this->HubProperties[id].PersistentKey;
+
         // Adapt our variables with potential changes based on the hub
     auto & vars = group.find("vars");
     if (vars != group.end()) {
@@ -358,7 +684,7 @@ void FileChangeMonitor::ProcessHubGroup(InternalID id, const ProcessProperties p
         
             // Simply send all subgroups to this function, recursively
         for (auto & elem : subGroups.value()) {
-            this->ProcessHubGroup(id, subProp, elem);
+            this->ProcessHubGroup(id, subProp, elem, eval);
         }
     }
 
@@ -367,7 +693,15 @@ void FileChangeMonitor::ProcessHubGroup(InternalID id, const ProcessProperties p
     if (hubs != group.end()) {
         DbAssertMsgFatal(hubs.value().is_array(), "Hub list must be an array");
 
+        std::string groupKey = "hub\n" + subProp.BuildKey();
+
         for (auto & elem : hubs.value()) {
+                // An entry seen before, with the same variables around it,
+                // still makes the same hub
+            std::string key = groupKey + elem.dump();
+            if (this->KeepHubEntry(id, key, eval))
+                continue;
+
                 // First we update our variables; the path may depend on them
             Monitor::ProcessProperties uniqueProp = subProp;
 
@@ -380,13 +714,14 @@ void FileChangeMonitor::ProcessHubGroup(InternalID id, const ProcessProperties p
                 // Find and process path
             auto & path = elem.find("path");
             DbAssertMsgFatal(path.value().is_string(), "Hub Path must be a string");
-            std::string hubPath = uniqueProp.StringVariables["cur-dir"];
+            auto * curDir = uniqueProp.StringVariables.Find("cur-dir");
+            std::string hubPath = curDir ? *curDir : "";
             hubPath += BlackRoot::System::DirSeperator;
             hubPath += path.value().get<std::string>();
             hubPath = uniqueProp.ProcessString(hubPath);
         
                 // Directly set the directory variable to the child's input path
-            uniqueProp.StringVariables["cur-dir"] = fs::canonical(Monitor::Path(hubPath).parent_path()).string();
+            uniqueProp.StringVariables.Set("cur-dir", fs::canonical(Monitor::Path(hubPath).parent_path()).string());
 
                 // Paths may contain wildcards. A wildcard-containing path spaws its
                 // own objects (TODO) to monitor changes to folder structures which
@@ -404,7 +739,9 @@ void FileChangeMonitor::ProcessHubGroup(InternalID id, const ProcessProperties p
             hub.Path             = hubPath;
             hub.InputProcessProp = uniqueProp;
 
-            this->FindOrAddHub(hub);
+            auto hubId = this->FindOrAddHub(hub);
+            eval.Hubs.insert(hubId);
+            eval.Current[key].Hubs.push_back(hubId);
         }
     }
 
@@ -429,6 +766,10 @@ void FileChangeMonitor::ProcessHubGroup(InternalID id, const ProcessProperties p
                 // Obtain settings
             auto & settings = elem["settings"];
 
+                // Every path is an entry of its own, so editing one line of a
+                // long list only touches that line
+            std::string entryKey = "pipe\n" + uniqueProp.BuildKey() + std::to_string(tool.size()) + ":" + tool + settings.dump() + "\n";
+
                 // Paths are all { "in" : "pairs" }, we create unique items
                 // for all of them
             auto & pathList = elem.find("paths");
@@ -436,6 +777,10 @@ void FileChangeMonitor::ProcessHubGroup(InternalID id, const ProcessProperties p
                 DbAssertMsgFatal(pathList.value().is_array(), "Pipe path list must be array");
                 
                 for (auto & item : pathList.value()) {
+                    std::string key = entryKey + item.dump();
+                    if (this->KeepHubEntry(id, key, eval))
+                        continue;
+
                     std::string pathIn  = item["in"];
                     std::string pathOut = item["out"];
 
@@ -453,6 +798,7 @@ void FileChangeMonitor::ProcessHubGroup(InternalID id, const ProcessProperties p
                         PipeWild pipe;
                         pipe.SetDefault();
                         pipe.HubDependency      = id;
+                        pipe.HubKey             = hubKey;
                         pipe.WildcardDependency = this->FindOrAddMonitoredWildcard(pathIn);
                         pipe.InputProcessProp   = uniqueProp;
                         pipe.Tool               = tool;
@@ -460,7 +806,9 @@ void FileChangeMonitor::ProcessHubGroup(InternalID id, const ProcessProperties p
                         pipe.BasePathOut        = Monitor::Path(pathOut);
                         pipe.Settings           = settings;
 
-                        this->FindOrAddPipeWildcards(pipe);
+                        auto wildId = this->FindOrAddPipeWildcards(pipe);
+                        eval.PipeWildcards.insert(wildId);
+                        eval.Current[key].PipeWildcards.push_back(wildId);
                         continue;
                     }
                     
@@ -476,12 +824,15 @@ void FileChangeMonitor::ProcessHubGroup(InternalID id, const ProcessProperties p
                     PipeProp pipe;
                     pipe.SetDefault();
                     pipe.HubDependency = id;
+                    pipe.HubKey        = hubKey;
                     pipe.Tool          = tool;
                     pipe.BasePathIn    = fs::canonical(Monitor::Path(pathIn));
                     pipe.BasePathOut   = fs::canonical(Monitor::Path(pathOut));
                     pipe.Settings      = settings;
 
-                    this->FindOrAddPipe(pipe);
+                    auto pipeId = this->FindOrAddPipe(pipe);
+                    eval.Pipes.insert(pipeId);
+                    eval.Current[key].Pipes.push_back(pipeId);
                 }
             }
         }
@@ -493,11 +844,13 @@ void FileChangeMonitor::CleanupOrphanedHubs()
 {
     using cout = BlackRoot::Util::Cout;
     
-    for (auto & it : this->PotentiallyOrphanedHubs) {
+        // Orphaning a hub's dependants may push more hubs on the list
+    InternalID it;
+    while (this->PotentiallyOrphanedHubs.Pop(it)) {
             // Find the hub properties
         auto & itProp = this->HubProperties.find(it);
         if (itProp == this->HubProperties.end())
-            return;
+            continue;
         auto & prop = itProp->second;
         
         this->PendingSaveChanges = true;
@@ -510,10 +863,8 @@ void FileChangeMonitor::CleanupOrphanedHubs()
             // We make this hub's dependants orphaned, which at this
             // point makes this function recursively remove all hubs
         this->MakeDependantsOnHubOrphan(it);
-        this->HubProperties.erase(it);
+        this->RemoveHub(it);
     }
-
-    this->PotentiallyOrphanedHubs.resize(0);
 }
 
     //  Update pipes
@@ -530,21 +881,39 @@ void FileChangeMonitor::UpdateDirtyPipeWildcard(InternalID id)
         return;
     auto & prop = itProp->second;
 
-        // Check the paths
-    WildcardCheck check;
-    check.SetCheckPath(prop.BasePathIn);
-    check.SetWildcard("*");
-    check.SetDelimiters("~", "~");
-    check.Check(this->FileSource);
+        // Without a hub we make no pipes; whoever adopts us looks again
+    if (prop.HubDependency == Monitor::InternalIDNone)
+        return;
+
+        // The monitored wildcard has walked the directory already; we
+        // only compare what it found with what we found last time
+    auto itWild = this->MonitoredWildcards.find(prop.WildcardDependency);
+    if (itWild == this->MonitoredWildcards.end())
+        return;
+    auto & found = itWild->second.Check.GetFound();
+
+    auto pass = ++prop.SnapshotPass;
 
-        // For each found path, try to make a pipe
-    for (auto & it : check.GetFound()) {
+    for (auto & it : found) {
+        auto & entry = prop.Snapshot[it.FoundPath.string()];
+
+            // Matches we know cost nothing, as long as their pipe is still
+            // ours; one orphaned since (say by an edit of our hub) is found
+            // again below
+        if (entry.Pass != 0) {
+            auto itPipe = this->PipeProperties.find(entry.Pipe);
+            if (itPipe != this->PipeProperties.end() &&
+                itPipe->second.HubDependency == prop.HubDependency) {
+                entry.Pass = pass;
+                continue;
+            }
+        }
 
             // Every path gets its unique properties, with the
             // wildcard replacements as variables
         Monitor::ProcessProperties uniqueProp = prop.InputProcessProp;
         for (auto & r : it.Replacements) {
-            uniqueProp.StringVariables[r.first] = r.second;
+            uniqueProp.StringVariables.Set(r.first, r.second);
         }
 
         auto uniqueSettings = prop.Settings;
@@ -557,13 +926,30 @@ void FileChangeMonitor::UpdateDirtyPipeWildcard(InternalID id)
         PipeProp pipe;
         pipe.SetDefault();
         pipe.HubDependency      = prop.HubDependency;
+        pipe.HubKey             = prop.HubKey;
         pipe.WildcardDependency = id;
         pipe.Tool               = prop.Tool;
         pipe.BasePathIn         = fs::canonical(it.FoundPath);
         pipe.BasePathOut        = fs::canonical(Monitor::Path(pathOut));
         pipe.Settings           = std::move(uniqueSettings);
 
-        this->FindOrAddPipe(pipe);
+        entry.Pipe = this->FindOrAddPipe(pipe);
+        entry.Pass = pass;
+    }
+
+        // Whatever was not seen this pass is gone; its pipe is orphaned, as
+        // it would be if its hub went away, and is found again if the
+        // file ever comes back
+    for (auto it = prop.Snapshot.begin(); it != prop.Snapshot.end(); ) {
+        if (it->second.Pass == pass) {
+            ++it;
+            continue;
+        }
+        if (it->second.Pass != 0 &&
+            this->PipeProperties.find(it->second.Pipe) != this->PipeProperties.end()) {
+            this->SetPipeHubDependency(it->second.Pipe, Monitor::InternalIDNone);
+        }
+        it = prop.Snapshot.erase(it);
     }
 }
 
@@ -584,26 +970,28 @@ void FileChangeMonitor::UpdateDirtyPipe(InternalID id)
         // If we are an orphan we shouldn't update, so add us to
         // a special list to keep track of us
     if (prop.HubDependency == Monitor::InternalIDNone) {
-        this->OrphanedDirtyPipes.push_back(id);
+        this->OrphanedDirtyPipes.Push(id);
+        this->MarkPipeForPersist(id);
         return;
     }
 
         // A timeout prevents a file from updating;
         // if we are timed out just put us on the dirty list
     if (prop.Timeout > currentTime) {
-        this->FutureDirtyPipes.push_back(id);
+        this->FutureDirtyPipes.Push(id);
+        this->MarkPipeForPersist(id);
         return;
     }
     
-    this->PendingSaveChanges = true;
+    this->MarkPipeForPersist(id);
 
-        // We remove all path dependencies; we 'send off' this pipe and
-        // we do not care about it changing while it is already pending
-        // (with the exception of it being removed, of course)
-    prop.PathDependencies.resize(0);
+        // We keep our path dependencies while we are pending; if one of them
+        // changes before we are done, we are sent off again, and the task
+        // already in flight is cancelled. They are replaced by what the tool
+        // actually read once the result is in.
 
         // Put it in the outbox
-    this->OutboxPipes.push_back(id);
+    this->OutboxPipes.Push(id);
 }
 
 void FileChangeMonitor::CleanupOrphanedPipes()
@@ -614,19 +1002,54 @@ void FileChangeMonitor::CleanupOrphanedPipes()
     //  Asynch
     // --------------------
 
-void FileChangeMonitor::AsynchReceiveTaskResult(const WranglerTaskResult& result)
+void FileChangeMonitor::AsynchReceiveTaskResult(WranglerTaskResult&& result)
 {
-    using cout = BlackRoot::Util::Cout;
+    this->WranglerResults.Push(std::move(result));
 
-    std::unique_lock<std::mutex> lk(this->MxWranglerResults);
-    this->WranglerResults.push_back(result);
-    this->WranglerResultCount += 1;
+        // Do not let the result wait for the notifier to time out
+    this->Notifier->Wake();
 }
 
 JSON FileChangeMonitor::AsynchGetTrackedInformation()
 {
-    std::unique_lock<std::mutex> lock(this->MutexAccessFiles);
-    
+        // We never wait for the update thread; we return whatever was
+        // published last and ask for a fresh snapshot
+    this->TrackedInformationRequested = true;
+    this->Notifier->Wake();
+
+    std::unique_lock<std::mutex> lock(this->MxTrackedInformation);
+    auto info = this->TrackedInformation;
+    lock.unlock();
+
+    if (!info)
+        return JSON::object();
+    return *info;
+}
+
+void FileChangeMonitor::PublishTrackedInformation()
+{
+        // Building the snapshot is not free, so unless somebody asked for
+        // it we only do so every so often, and only if anything changed
+    auto now = std::chrono::steady_clock::now();
+    if (!this->TrackedInformationRequested) {
+        if (!this->PendingTrackedChanges)
+            return;
+        if (now - this->LastTrackedPublish < std::chrono::seconds(1))
+            return;
+    }
+
+    this->TrackedInformationRequested = false;
+    this->PendingTrackedChanges       = false;
+    this->LastTrackedPublish          = now;
+
+    auto info = std::make_shared<const JSON>(this->BuildTrackedInformation());
+
+    std::unique_lock<std::mutex> lock(this->MxTrackedInformation);
+    this->TrackedInformation = std::move(info);
+}
+
+JSON FileChangeMonitor::BuildTrackedInformation()
+{
     JSON paths;
     for (auto & it : this->MonitoredPaths) {
         auto & prop = it.second;
@@ -654,7 +1077,8 @@ JSON FileChangeMonitor::AsynchGetTrackedInformation()
     return {
         { "paths" , paths },
         { "hubs" , hubs },
-        { "wildcards" , wild }
+        { "wildcards" , wild },
+        { "queues" , this->GetQueueDepths() }
     };
 }
 
@@ -665,30 +1089,57 @@ void FileChangeMonitor::UpdatePipeOutbox()
 {
     using cout = BlackRoot::Util::Cout;
 
-    if (this->OutboxPipes.size() == 0)
+    if (this->OutboxPipes.Empty())
         return;
 
     this->PendingSaveChanges    = true;
     
-    cout{} << "Sending off " << this->OutboxPipes.size() << " pipes." << std::endl << std::endl;
+    cout{} << "Sending off " << this->OutboxPipes.Size() << " pipes." << std::endl << std::endl;
 
-    WranglerTaskList tasks(this->OutboxPipes.size());
+    WranglerTaskList tasks(this->OutboxPipes.Size());
+    DurationMemo downstream;
 
     int outputCount = 0;
-    for (auto id : this->OutboxPipes) {
+    InternalID id;
+    while (this->OutboxPipes.Pop(id)) {
         auto & itProp = this->PipeProperties.find(id);
         if (itProp == this->PipeProperties.end())
-            return;
+            continue;
         auto & prop = itProp->second;
 
         WranglerTask task;
         task.Callback = [&](WranglerTaskResult &&r){ this->AsynchReceiveTaskResult(std::move(r)); };
         task.UniqueID = id;
         task.ToolName = prop.Tool;
+
+            // Supersede whatever we sent off before
+        if (prop.Cancel) {
+            prop.Cancel->store(true);
+        }
+        prop.Generation += 1;
+        prop.Cancel      = std::make_shared<std::atomic<bool>>(false);
+
+        task.Generation = prop.Generation;
+        task.Cancel     = prop.Cancel;
+
         task.FileIn   = prop.BasePathIn;
         task.FileOut  = prop.BasePathOut;
         task.Settings = prop.Settings;
 
+        if (!prop.Encoded) {
+            prop.Encoded = EncodedSettings::Encode(prop.Settings);
+        }
+        task.Encoded  = prop.Encoded;
+        bool cutOff = false;
+        task.DownstreamEstimate = this->EstimateDownstreamDuration(id, downstream, 0, cutOff);
+
+        for (auto & dep : prop.PathDependencies) {
+            auto & path = this->MonitoredPaths.find(dep);
+            if (path == this->MonitoredPaths.end())
+                continue;
+            task.PreviousReads.push_back(path->second.Path);
+        }
+
 #ifdef _WIN32
         std::string outFile = task.FileOut.string();
         if (outFile.find(".exe") != outFile.npos && this->FileSource->FileExists(task.FileOut)) {
@@ -709,42 +1160,27 @@ void FileChangeMonitor::UpdatePipeOutbox()
 
 
         tasks[outputCount++] = std::move(task);
+        this->PendingPipes.Push(id);
     }
 
     tasks.resize(outputCount);
     this->Wrangler->AsynchReceiveTasks(tasks);
-    
-    this->PendingPipes.insert(this->PendingPipes.end(), this->OutboxPipes.begin(), this->OutboxPipes.end());
-
-    this->OutboxPipes.resize(0);
 }
 
 void FileChangeMonitor::UpdatePipeInbox()
 {
     using cout = BlackRoot::Util::Cout;
 
-    if (this->PendingPipes.size() == 0)
-        return;
-    if (this->WranglerResultCount == 0)
+        // Even with nothing pending, cancelled and superseded results come
+        // back, and are only let go of here
+    if (this->WranglerResults.Empty())
         return;
-    
-    while (true) {
-            // See if we have wrangler results, and if so, get one
-        std::unique_lock<std::mutex> lk(this->MxWranglerResults);
-
-        auto it = this->WranglerResults.begin();
-        if (it == this->WranglerResults.end()) {
-            this->WranglerResultCount = 0;
-            return;
-        }
 
-        auto val = std::move(*it);
-
-        this->WranglerResults.erase(it);
-        this->WranglerResultCount -= 1;
-
-        lk.unlock();
+        // Take everything the wrangler finished so far in one go
+    std::vector<WranglerTaskResult> results;
+    this->WranglerResults.DrainInto(results);
 
+    for (auto & val : results) {
         this->PendingSaveChanges    = true;
 
             // We gave the wrangler our unique pipe id as unique id
@@ -754,10 +1190,20 @@ void FileChangeMonitor::UpdatePipeInbox()
             // have been removed before the wrangler could even return;
             // this is not a problem for anybody, so just forget about it.
         auto pipeit = this->PipeProperties.find(id);
-        if (pipeit == this->PipeProperties.end())
+        if (pipeit == this->PipeProperties.end()) {
+            delete val.Exception;
             continue;
+        }
         auto & pipe = pipeit->second;
 
+            // A result of an older dispatch was superseded; the latest
+            // dispatch is still pending and will report on its own
+        if (val.Generation != pipe.Generation || val.Cancelled) {
+            delete val.Exception;
+            continue;
+        }
+        pipe.Cancel.reset();
+
             // If there was an error give it to the handler; that probably
             // will schedule it for a timeout and a retry
         if (val.Exception) {
@@ -765,6 +1211,15 @@ void FileChangeMonitor::UpdatePipeInbox()
             continue;
         }
 
+            // Putting back cached outputs says nothing of how long the
+            // tool takes when it does run
+        if (!val.FromCache) {
+            pipe.LastDuration = val.ProcessDuration;
+        }
+
+            // What the tool read this time replaces what it read before
+        this->ClearPipePathDependencies(id);
+
             // Add all read files as paths that this pipe depends on. If
             // any path has a previous time that is past when we read it,
             // we just dirty the pipe immediately again.
@@ -773,10 +1228,10 @@ void FileChangeMonitor::UpdatePipeInbox()
         for (auto & fi : val.ReadFiles) {
             auto prevTime = fi.LastChange;
             auto pathId = this->FindOrAddMonitoredPath(fi.Path, &prevTime);
-            pipe.PathDependencies.push_back(pathId);
+            this->AddPipePathDependency(id, pathId);
 
             if (!this->FileTimeEqualsWithEpsilon(fi.LastChange, prevTime)) {
-                this->DirtyPipes.push_back(id);
+                this->DirtyPipes.Push(id);
             }
         }
         
@@ -784,9 +1239,10 @@ void FileChangeMonitor::UpdatePipeInbox()
 
 
             // This pipe is done!
-        this->PendingPipes.erase(std::remove(this->PendingPipes.begin(), this->PendingPipes.end(), id), this->PendingPipes.end());
+        this->PendingPipes.Remove(id);
+        this->MarkPipeForPersist(id);
         
-        cout{} << "Pipe done: " << pipe.Tool << " (" << val.ProcessDuration.count() << "ms)" << std::endl
+        cout{} << "Pipe done: " << pipe.Tool << " (" << val.ProcessDuration.count() << "ms" << (val.FromCache ? ", cached" : "") << ")" << std::endl
             << " " << this->SimpleFormatPath(pipe.BasePathIn.string()) << std::endl
             << " " << this->SimpleFormatPath(pipe.BasePathOut.string()) << std::endl << std::endl;
     }
@@ -795,152 +1251,653 @@ void FileChangeMonitor::UpdatePipeInbox()
     //  Persistent
     // --------------------
 
-void FileChangeMonitor::LoadFromPersistent()
+void FileChangeMonitor::LoadFromPersistent()
+{
+    using cout = BlackRoot::Util::Cout;
+
+    auto pathBinary  = this->PersistentDirectory / "state.bin";
+    auto pathIn      = this->PersistentDirectory / "state.json";
+    auto pathJournal = this->PersistentDirectory / "state.journal";
+
+    Monitor::PersistentState state;
+    state.SetDefault();
+
+    Monitor::SnapshotView snapshot;
+    bool haveSnapshot = snapshot.Open(pathBinary);
+    
+    BlackRoot::IO::BaseFileSource::FCont contents;
+    BlackRoot::Format::JSON jsonCont;
+    
+        // Without a binary snapshot we fall back to the json state, which is
+        // what older versions wrote and what we may still export
+    try {
+        if (haveSnapshot) {
+            state.Generation = snapshot.GetGeneration();
+        }
+        else if (this->FileSource->Exists(pathIn)) {
+            contents = this->FileSource->ReadFile(pathIn, BlackRoot::IO::FileMode::OpenInstr{}.Default().Share(BlackRoot::IO::FileMode::Share::Read));
+            jsonCont = BlackRoot::Format::JSON::parse(contents);
+
+            state.Generation = jsonCont.value("generation", uint64(0));
+        
+            for (auto & it : jsonCont["paths"]) {
+                Monitor::JournalPathState pathState = {};
+                pathState.Changed = it["changed"].get<long long>();
+                state.Paths[it["path"].get<std::string>()] = pathState;
+            }
+        
+            for (auto & it : jsonCont["pipes"]) {
+                Monitor::JournalPipe pipe;
+                pipe.Hub      = it.value("hub", std::string());
+                pipe.Tool     = it["tool"].get<std::string>();
+                pipe.PathIn   = it["pathIn"].get<std::string>();
+                pipe.PathOut  = it["pathOut"].get<std::string>();
+                pipe.Settings = it["settings"].dump();
+
+                for (auto & pit : it["paths"]) {
+                    DbAssert(pit.is_string());
+                    pipe.Paths.push_back(pit.get<std::string>());
+                }
+
+                state.Pipes[pipe.GetKey()] = std::move(pipe);
+            }
+        }
+    }
+    catch (BlackRoot::Debug::Exception * e) {
+        cout{} << "!!Cannot read monitor state, starting over" << std::endl << " " << e->GetPrettyDescription() << std::endl << std::endl;
+        delete e;
+        state.SetDefault();
+    }
+    catch (...) {
+        cout{} << "!!Cannot read monitor state, starting over" << std::endl << std::endl;
+        state.SetDefault();
+    }
+
+        // Whatever happened since the snapshot was written is in the journal
+    this->JournalValidLength = Monitor::ReplayJournal(pathJournal, state);
+    this->JournalRecordCount = state.JournalRecords;
+    this->PersistGeneration  = state.Generation;
+
+        // Everything we load, so a state that turns out broken halfway can
+        // be forgotten again as a whole
+    std::vector<InternalID> loadedPaths;
+    std::vector<InternalID> loadedPipes;
+    bool loadFailed = false;
+
+    try {
+            // Bulk load the snapshot; as dependencies are stored as indices
+            // we never need to look up a path by its string here. Anything
+            // the journal touched is skipped, and added from the journal below.
+        std::vector<InternalID> snapshotPaths;
+
+        if (haveSnapshot) {
+            bool checkJournal = state.Paths.size() > 0 || state.RemovedPaths.size() > 0;
+
+            snapshotPaths.resize(snapshot.GetPathCount(), InternalIDNone);
+            this->MonitoredPathIndex.reserve(snapshot.GetPathCount() + state.Paths.size());
+
+            for (uint32 i = 0; i < snapshot.GetPathCount(); i++) {
+                auto & rec = snapshot.GetPath(i);
+                std::string path(snapshot.GetString(rec.Path));
+
+                if (checkJournal && (state.Paths.count(path) > 0 || state.RemovedPaths.count(path) > 0))
+                    continue;
+
+                Monitor::JournalPathState pathState;
+                pathState.Changed        = rec.Changed;
+                pathState.Size           = rec.Size;
+                pathState.ContentHash    = rec.ContentHash;
+                pathState.HasContentHash = (rec.Flags & Monitor::SnapshotPath::HasContentHash) != 0;
+
+                auto id = this->FindOrAddMonitoredPath(path, nullptr);
+                this->MonitoredPaths[id].SetPersistentState(pathState);
+                snapshotPaths[i] = id;
+                loadedPaths.push_back(id);
+            }
+        }
+
+        for (auto & it : state.Paths) {
+            auto id = this->FindOrAddMonitoredPath(it.first, nullptr);
+            this->MonitoredPaths[id].SetPersistentState(it.second);
+            loadedPaths.push_back(id);
+        }
+
+        if (haveSnapshot) {
+            bool checkJournal = state.Pipes.size() > 0 || state.RemovedPipes.size() > 0;
+
+            for (uint32 i = 0; i < snapshot.GetPipeCount(); i++) {
+                auto & rec = snapshot.GetPipe(i);
+
+                Monitor::JournalPipe strings;
+                strings.Hub      = snapshot.GetString(rec.Hub);
+                strings.Tool     = snapshot.GetString(rec.Tool);
+                strings.PathIn   = snapshot.GetString(rec.PathIn);
+                strings.PathOut  = snapshot.GetString(rec.PathOut);
+                strings.Settings = snapshot.GetString(rec.Settings);
+
+                if (checkJournal) {
+                    auto key = strings.GetKey();
+                    if (state.Pipes.count(key) > 0 || state.RemovedPipes.count(key) > 0)
+                        continue;
+                }
+
+                PipeProp pipe;
+                pipe.SetDefault();
+                pipe.HubDependency = InternalIDNone;
+                pipe.HubKey        = std::move(strings.Hub);
+                pipe.Tool          = std::move(strings.Tool);
+                pipe.BasePathIn    = strings.PathIn;
+                pipe.BasePathOut   = strings.PathOut;
+                pipe.Settings      = JSON::parse(strings.Settings);
+
+                auto * deps = snapshot.GetDependencies(rec);
+                for (uint32 d = 0; d < rec.DependencyCount; d++) {
+                    auto pathId = snapshotPaths[deps[d]];
+                    if (pathId == InternalIDNone) {
+                        pathId = this->FindOrAddMonitoredPath(std::string(snapshot.GetString(snapshot.GetPath(deps[d]).Path)), nullptr);
+                        loadedPaths.push_back(pathId);
+                    }
+                    pipe.PathDependencies.push_back(pathId);
+                }
+
+                auto pipeId = this->FindOrAddPipe(pipe);
+                this->PersistedPipes.insert(pipeId);
+                loadedPipes.push_back(pipeId);
+            }
+        }
+
+        for (auto & it : state.Pipes) {
+            auto & rec = it.second;
+
+            PipeProp pipe;
+            pipe.SetDefault();
+            pipe.HubDependency = InternalIDNone;
+            pipe.HubKey        = rec.Hub;
+            pipe.Tool          = rec.Tool;
+            pipe.BasePathIn    = rec.PathIn;
+            pipe.BasePathOut   = rec.PathOut;
+            pipe.Settings      = JSON::parse(rec.Settings);
+
+            for (auto & pit : rec.Paths) {
+                auto pathId = this->FindOrAddMonitoredPath(pit, nullptr);
+                pipe.PathDependencies.push_back(pathId);
+                loadedPaths.push_back(pathId);
+            }
+
+            auto pipeId = this->FindOrAddPipe(pipe);
+            this->PersistedPipes.insert(pipeId);
+            loadedPipes.push_back(pipeId);
+        }
+    }
+    catch (BlackRoot::Debug::Exception * e) {
+        cout{} << "!!Cannot load monitor state, starting over" << std::endl << " " << e->GetPrettyDescription() << std::endl << std::endl;
+        delete e;
+        loadFailed = true;
+    }
+    catch (...) {
+        cout{} << "!!Cannot load monitor state, starting over" << std::endl << std::endl;
+        loadFailed = true;
+    }
+
+        // The mapping must be gone before the persist thread replaces the file
+    snapshot.Close();
+
+        // Half a state would look complete to the next compaction; instead
+        // we forget all of it and build everything again, and replace what
+        // is on disk right away so we do not trip over it next time
+    if (loadFailed) {
+        for (auto id : loadedPipes) {
+            auto it = this->PipeProperties.find(id);
+            if (it == this->PipeProperties.end())
+                continue;
+            this->ClearPipePathDependencies(id);
+            this->SetPipeHubDependency(id, Monitor::InternalIDNone);
+            EraseFromIndex(this->PipeIndex, it->second.GetFingerprint(), id);
+            this->PipeProperties.erase(it);
+            this->DirtyPipes.Remove(id);
+            this->OrphanedDirtyPipes.Remove(id);
+            this->FutureDirtyPipes.Remove(id);
+        }
+        for (auto id : loadedPaths) {
+            this->RemoveMonitoredPath(id);
+            this->SuspectPaths.Remove(id);
+        }
+        this->PersistedPipes.clear();
+        this->PersistedPaths.clear();
+    }
+
+        // What we just loaded is exactly what is on disk, so none of it
+        // needs to be journaled again
+    for (auto & it : this->MonitoredPaths) {
+        this->PersistedPaths[it.first] = it.second.Path.string();
+    }
+    this->PersistPaths.Clear();
+    this->PersistPipes.Clear();
+
+    if (loadFailed) {
+        this->CompactPersistent();
+    }
+}
+
+void FileChangeMonitor::SaveToPersistent()
+{
+    std::string records;
+    std::size_t recordCount = 0;
+
+        // Paths go first, as pipes refer to them
+    InternalID id;
+    while (this->PersistPaths.Pop(id)) {
+        Monitor::JournalRecord rec;
+
+        auto it = this->MonitoredPaths.find(id);
+        if (it != this->MonitoredPaths.end()) {
+            rec.Type = Monitor::JournalRecordType::PathSet;
+            rec.Path = it->second.Path.string();
+            it->second.GetPersistentState(rec.PathState);
+            this->PersistedPaths[id] = rec.Path;
+        }
+        else {
+            auto persisted = this->PersistedPaths.find(id);
+            if (persisted == this->PersistedPaths.end())
+                continue;
+            rec.Type = Monitor::JournalRecordType::PathRemoved;
+            rec.Path = std::move(persisted->second);
+            this->PersistedPaths.erase(persisted);
+        }
+
+        Monitor::EncodeJournalRecord(records, rec);
+        recordCount += 1;
+    }
+
+    while (this->PersistPipes.Pop(id)) {
+        if (this->PipeProperties.find(id) == this->PipeProperties.end())
+            continue;
+
+        Monitor::JournalRecord rec;
+
+        if (this->IsPipePersistable(id)) {
+            rec.Type = Monitor::JournalRecordType::PipeSet;
+            this->FillJournalPipe(id, rec.Pipe, true);
+            this->PersistedPipes.insert(id);
+        }
+        else {
+            if (0 == this->PersistedPipes.erase(id))
+                continue;
+            rec.Type = Monitor::JournalRecordType::PipeRemoved;
+            this->FillJournalPipe(id, rec.Pipe, false);
+        }
+
+        Monitor::EncodeJournalRecord(records, rec);
+        recordCount += 1;
+    }
+
+    this->PendingSaveChanges = false;
+
+    if (recordCount == 0)
+        return;
+
+    this->JournalRecordCount += recordCount;
+
+        // Once the journal holds a lot more than the state itself, fold
+        // it into a new snapshot so loading does not need to replay it all
+    std::size_t compactAt = std::max<std::size_t>(4096, 2 * (this->PersistedPaths.size() + this->PersistedPipes.size()));
+    if (this->JournalRecordCount > compactAt) {
+        this->CompactPersistent();
+        return;
+    }
+
+    PersistJob job;
+    job.Compact    = false;
+    job.ExportJSON = false;
+    job.Generation = this->PersistGeneration;
+    job.Records    = std::move(records);
+
+    this->QueuePersistJob(std::move(job));
+}
+
+void FileChangeMonitor::CompactPersistent()
+{
+    Monitor::SnapshotBuilder builder;
+    JSON outData;
+
+    auto clock = std::chrono::system_clock::time_point{}; 
+
+    this->PersistGeneration += 1;
+
+    this->PersistedPaths.clear();
+    this->PersistedPipes.clear();
+
+        // Pipes refer to paths by their position in the snapshot
+    std::unordered_map<InternalID, uint32> pathIndices;
+    pathIndices.reserve(this->MonitoredPaths.size());
+
+    for (auto & it : this->MonitoredPaths) {
+        auto & prop = it.second;
+        auto path = prop.Path.string();
+
+        Monitor::JournalPathState state;
+        prop.GetPersistentState(state);
+
+        Monitor::SnapshotPath rec = {};
+        rec.Flags       = state.HasContentHash ? Monitor::SnapshotPath::HasContentHash : 0;
+        rec.Changed     = state.Changed;
+        rec.Size        = state.Size;
+        rec.ContentHash = state.ContentHash;
+
+        pathIndices[it.first] = builder.AddPath(path, rec);
+        this->PersistedPaths[it.first] = std::move(path);
+    }
+
+    std::vector<uint32> dependencies;
+
+    for (auto & it : this->PipeProperties) {
+        auto & prop = it.second;
+
+        if (!this->IsPipePersistable(it.first))
+            continue;
+
+        dependencies.resize(0);
+        for (auto & pit : prop.PathDependencies) {
+            auto found = pathIndices.find(pit);
+            if (found == pathIndices.end())
+                continue;
+            dependencies.push_back(found->second);
+        }
+
+        builder.AddPipe(prop.HubKey, prop.Tool, prop.BasePathIn.string(), prop.BasePathOut.string(), prop.Settings.dump(), dependencies);
+
+        this->PersistedPipes.insert(it.first);
+    }
+
+        // The json state is only written for people who want to read it
+    if (this->ExportPersistentJSON) {
+        auto & pathData = outData["paths"];
+        auto & pipeData = outData["pipes"];
+
+        outData["generation"] = this->PersistGeneration;
+
+        for (auto & it : this->MonitoredPaths) {
+            auto & prop = it.second;
+
+            pathData += {
+                { "path", prop.Path.string() },
+                { "changed", std::chrono::duration_cast<std::chrono::milliseconds>(prop.LastUpdate - clock).count() }
+            };
+        }
+        for (auto id : this->PersistedPipes) {
+            auto & prop = this->PipeProperties[id];
+
+            JSON pathData;
+
+            for (auto & pit : prop.PathDependencies) {
+                auto & fpath = this->MonitoredPaths.find(pit);
+                if (fpath == this->MonitoredPaths.end())
+                    continue;
+                pathData += fpath->second.Path.string();
+            }
+
+            pipeData += {
+                { "hub", prop.HubKey },
+                { "tool", prop.Tool },
+                { "pathIn", prop.BasePathIn.string() },
+                { "pathOut", prop.BasePathOut.string() },
+                { "settings", prop.Settings },
+                { "paths", pathData }
+            };
+        }
+    }
+
+    this->PersistPaths.Clear();
+    this->PersistPipes.Clear();
+    this->JournalRecordCount = 0;
+
+    PersistJob job;
+    job.Compact    = true;
+    job.Generation = this->PersistGeneration;
+    job.Snapshot   = builder.Finish(this->PersistGeneration);
+    job.ExportJSON = this->ExportPersistentJSON;
+    job.Export     = std::move(outData);
+
+    this->QueuePersistJob(std::move(job));
+}
+
+void FileChangeMonitor::QueuePersistJob(PersistJob && job)
+{
+    std::unique_lock<std::mutex> lk(this->MxPersist);
+    this->PersistJobs.push_back(std::move(job));
+    lk.unlock();
+
+    this->CvPersist.notify_one();
+}
+
+bool FileChangeMonitor::IsPipePersistable(InternalID id)
+{
+    auto & prop = this->PipeProperties[id];
+
+        // If it is orphaned, this is a good moment to forget about it
+    if (prop.HubDependency == InternalIDNone) 
+        return false;
+
+        // If we are dirty or pending, the state of the pipe depends on the executable;
+        // to reflect this we simply do not save this pipe.
+    if (this->DirtyPipes.Contains(id) ||
+        this->FutureDirtyPipes.Contains(id) ||
+        this->OrphanedDirtyPipes.Contains(id) ||
+        this->OutboxPipes.Contains(id) ||
+        this->PendingPipes.Contains(id))
+        return false;
+
+    return true;
+}
+
+void FileChangeMonitor::FillJournalPipe(InternalID id, Monitor::JournalPipe & pipe, bool withPaths)
+{
+    auto & prop = this->PipeProperties[id];
+
+    pipe.Hub      = prop.HubKey;
+    pipe.Tool     = prop.Tool;
+    pipe.PathIn   = prop.BasePathIn.string();
+    pipe.PathOut  = prop.BasePathOut.string();
+    pipe.Settings = prop.Settings.dump();
+
+    if (!withPaths)
+        return;
+
+    for (auto & pit : prop.PathDependencies) {
+        auto & fpath = this->MonitoredPaths.find(pit);
+        if (fpath == this->MonitoredPaths.end())
+            continue;
+        pipe.Paths.push_back(fpath->second.Path.string());
+    }
+}
+
+void FileChangeMonitor::MarkPathForPersist(InternalID id)
+{
+    this->PersistPaths.Push(id);
+    this->PendingSaveChanges = true;
+}
+
+void FileChangeMonitor::MarkPipeForPersist(InternalID id)
+{
+    this->PersistPipes.Push(id);
+    this->PendingSaveChanges = true;
+}
+
+void FileChangeMonitor::BeginPersistThread()
+{
+    this->PersistStop   = false;
+    this->PersistThread = std::thread([&] {
+        this->PersistThreadLoop();
+    });
+}
+
+void FileChangeMonitor::EndPersistThread()
+{
+    std::unique_lock<std::mutex> lk(this->MxPersist);
+    this->PersistStop = true;
+    lk.unlock();
+
+    this->CvPersist.notify_one();
+    this->PersistThread.join();
+}
+
+void FileChangeMonitor::PersistThreadLoop()
+{
+    using cout = BlackRoot::Util::Cout;
+
+        // If this fails the first append opens the journal again
+    try {
+        this->PersistFileSource->CreateDirectories(this->PersistentDirectory);
+        this->Journal.Open(this->PersistentDirectory / "state.journal", this->PersistGeneration, this->JournalValidLength);
+    }
+    catch (BlackRoot::Debug::Exception * e) {
+        cout{} << "!!Cannot open monitor journal" << std::endl << " " << e->GetPrettyDescription() << std::endl << std::endl;
+        delete e;
+    }
+    catch (...) {
+        cout{} << "!!Cannot open monitor journal" << std::endl << std::endl;
+    }
+
+        // Jobs only leave this once they are written; the update thread
+        // already considers them saved, so they may never be dropped
+    std::deque<PersistJob> jobs;
+    auto retryDelay = std::chrono::milliseconds(500);
+
+    std::unique_lock<std::mutex> lk(this->MxPersist);
+
+    while (true) {
+        auto hasWork = [&]{ return this->PersistJobs.size() > 0 || this->PersistStop; };
+        if (jobs.size() == 0) {
+            this->CvPersist.wait(lk, hasWork);
+        }
+        else {
+            this->CvPersist.wait_for(lk, retryDelay, hasWork);
+        }
+
+        for (auto & job : this->PersistJobs) {
+            jobs.push_back(std::move(job));
+        }
+        this->PersistJobs.clear();
+        bool stop = this->PersistStop;
+
+            // Anything pending is written before we honour a stop
+        if (jobs.size() == 0 && stop)
+            break;
+
+        lk.unlock();
+
+            // A snapshot holds everything queued before it, so whatever is
+            // still waiting in front of the newest one need not be written
+        for (std::size_t i = jobs.size(); i-- > 1; ) {
+            if (!jobs[i].Compact)
+                continue;
+            jobs.erase(jobs.begin(), jobs.begin() + i);
+            break;
+        }
+
+        while (jobs.size() > 0 && this->WritePersistJob(jobs.front())) {
+            jobs.pop_front();
+        }
+
+        if (jobs.size() == 0) {
+            retryDelay = std::chrono::milliseconds(500);
+        }
+        else {
+            retryDelay = std::min(retryDelay * 2, std::chrono::milliseconds(16000));
+        }
+
+        lk.lock();
+
+        if (stop && this->PersistJobs.size() == 0) {
+            if (jobs.size() > 0) {
+                cout{} << "!!Could not save " << jobs.size() << " monitor state changes before stopping" << std::endl << std::endl;
+            }
+            break;
+        }
+    }
+
+    this->Journal.Close();
+}
+
+bool FileChangeMonitor::WritePersistJob(PersistJob & job)
 {
     using cout = BlackRoot::Util::Cout;
 
-    auto pathIn   = this->PersistentDirectory / "state.json";
-    
-    if (!this->FileSource->Exists(pathIn))
-        return;
-    
-    BlackRoot::IO::BaseFileSource::FCont contents;
-    BlackRoot::Format::JSON jsonCont;
-    
-    auto clock = std::chrono::system_clock::time_point{};
-
-        // See if we can load the file
     try {
-        contents = this->FileSource->ReadFile(pathIn, BlackRoot::IO::FileMode::OpenInstr{}.Default().Share(BlackRoot::IO::FileMode::Share::Read));
-        jsonCont = BlackRoot::Format::JSON::parse(contents);
-        
-        for (auto & it : jsonCont["paths"]) {
-            std::string path = it["path"];
-            auto time = clock + std::chrono::milliseconds(it["changed"].get<long long>());
-            this->FindOrAddMonitoredPath(it["path"].get<std::string>(), &time);
-        }
-        
-        for (auto & it : jsonCont["pipes"]) {
-            PipeProp pipe;
-            pipe.SetDefault();
-            pipe.HubDependency = InternalIDNone;
-            pipe.Tool          = it["tool"].get<std::string>();
-            pipe.BasePathIn    = it["pathIn"].get<std::string>();
-            pipe.BasePathOut   = it["pathOut"].get<std::string>();
-            pipe.Settings      = it["settings"];
-
-            for (auto & pit : it["paths"]) {
-                DbAssert(pit.is_string());
-                pipe.PathDependencies.push_back(this->FindOrAddMonitoredPath(pit.get<std::string>(), nullptr));
+        if (job.Compact) {
+                // Only once the new snapshot is in place can the journal
+                // start over; if writing it failed the old snapshot and
+                // the journal together still describe everything
+            if (!this->WritePersistentFile("state.bin", job.Snapshot))
+                return false;
+            this->Journal.Reset(job.Generation);
+
+                // A json state that is not kept up to date would only
+                // confuse whoever reads it, so it goes if not exported
+            if (job.ExportJSON) {
+                this->WritePersistentFile("state.json", job.Export.dump(4));
+            }
+            else if (this->PersistFileSource->Exists(this->PersistentDirectory / "state.json")) {
+                this->PersistFileSource->Remove(this->PersistentDirectory / "state.json");
             }
 
-            this->FindOrAddPipe(pipe);
+            cout{} << "Saved\r";
+        }
+        else {
+            this->Journal.Append(job.Records);
         }
     }
     catch (BlackRoot::Debug::Exception * e) {
-        // TODO
+        cout{} << "!!Cannot save monitor state, will retry" << std::endl << " " << e->GetPrettyDescription() << std::endl << std::endl;
         delete e;
-        return;
+        return false;
     }
     catch (...) {
-        // TODO
-        return;
+        cout{} << "!!Cannot save monitor state, will retry" << std::endl << std::endl;
+        return false;
     }
+
+    return true;
 }
 
-void FileChangeMonitor::SaveToPersistent()
+bool FileChangeMonitor::WritePersistentFile(const std::string name, const std::string & contents)
 {
-    using cout = BlackRoot::Util::Cout;
-
-    JSON outData;
-
-        // Create master JSON structure
-    auto & pathData = outData["paths"];
-    auto & pipeData = outData["pipes"];
-    
-    auto clock = std::chrono::system_clock::time_point{}; 
-
-    for (auto & it : this->MonitoredPaths) {
-        auto & prop = it.second;
-
-        pathData += {
-            { "path", prop.Path.string() },
-            { "changed", std::chrono::duration_cast<std::chrono::milliseconds>(prop.LastUpdate - clock).count() }
-        };
-    }
-    for (auto & it : this->PipeProperties) {
-        auto & prop = it.second;
-
-            // If it is orphaned, this is a good moment to forget about it
-        if (prop.HubDependency == InternalIDNone) 
-            continue;
-
-            // If we are dirty or pending, the state of the pipe depends on the executable;
-            // to reflect this we simply do not save this pipe.
-        if (std::find(this->DirtyPipes.begin(), this->DirtyPipes.end(), it.first) != this->DirtyPipes.end())
-            continue;
-        if (std::find(this->FutureDirtyPipes.begin(), this->FutureDirtyPipes.end(), it.first) != this->FutureDirtyPipes.end())
-            continue;
-        if (std::find(this->PendingPipes.begin(), this->PendingPipes.end(), it.first) != this->PendingPipes.end())
-            continue;
-
-        JSON pathData;
-
-        for (auto & pit : prop.PathDependencies) {
-            auto & fpath = this->MonitoredPaths.find(pit);
-            if (fpath == this->MonitoredPaths.end())
-                continue;
-            pathData += fpath->second.Path.string();
-        }
-
-        pipeData += {
-            { "tool", prop.Tool },
-            { "pathIn", prop.BasePathIn.string() },
-            { "pathOut", prop.BasePathOut.string() },
-            { "settings", prop.Settings },
-            { "paths", pathData }
-        };
-    }
-
         // Write to file
     try {
-        auto outPathWrite = this->PersistentDirectory / "~state.json";
-        auto outPathFin   = this->PersistentDirectory / "state.json";
+        auto outPathWrite = this->PersistentDirectory / ("~" + name);
+        auto outPathFin   = this->PersistentDirectory / name;
 
             // Ensure the directory and remove the old ~ file
-        this->FileSource->CreateDirectories(this->PersistentDirectory);
-        if (this->FileSource->Exists(outPathWrite)) {
-            this->FileSource->Remove(outPathWrite);
+        this->PersistFileSource->CreateDirectories(this->PersistentDirectory);
+        if (this->PersistFileSource->Exists(outPathWrite)) {
+            this->PersistFileSource->Remove(outPathWrite);
         }
 
-            // Open a stream and dump the json
-        auto * stream = this->FileSource->OpenFile(this->PersistentDirectory / "~state.json", BlackRoot::IO::IFileSource::OpenInstr{}
+            // Open a stream and write everything
+        auto * stream = this->PersistFileSource->OpenFile(outPathWrite, BlackRoot::IO::IFileSource::OpenInstr{}
                                                     .Creation(BlackRoot::IO::FileMode::Creation::CreateAlways)
                                                     .Access(BlackRoot::IO::FileMode::Access::Read | BlackRoot::IO::FileMode::Access::Write)
                                                     .Share(BlackRoot::IO::FileMode::Share::None) );
 
-        auto str = outData.dump(4);
-        stream->Write((void*)(str.c_str()), str.length());
+        stream->Write((void*)(contents.c_str()), contents.length());
         stream->CloseAndRelease();
         
             // Rename our ~ file to the final name
-        if (this->FileSource->Exists(outPathFin)) {
-            this->FileSource->Remove(outPathFin);
+        if (this->PersistFileSource->Exists(outPathFin)) {
+            this->PersistFileSource->Remove(outPathFin);
         }
-        this->FileSource->Rename(outPathWrite, outPathFin);
+        this->PersistFileSource->Rename(outPathWrite, outPathFin);
     }
     catch (std::exception e) {
         // TODO
-        return;
+        return false;
     }
     catch (...) {
         // TODO
-        return;
+        return false;
     }
 
-    cout{} << "Saved\r";
-
-    this->PendingSaveChanges = false;
+    return true;
 }
 
     //  Debug
@@ -964,14 +1921,14 @@ FileChangeMonitor::InternalID FileChangeMonitor::GetNewID()
 
 FileChangeMonitor::InternalID FileChangeMonitor::FindOrAddMonitoredPath(Path path, TimePoint * prevTimePoint)
 {
-    for (auto it : this->MonitoredPaths) {
-        if (it.second.Path != path)
-            continue;
+    std::string key = path.string();
 
+    auto found = this->MonitoredPathIndex.find(key);
+    if (found != this->MonitoredPathIndex.end()) {
         if (prevTimePoint) {
-            *prevTimePoint = it.second.LastUpdate;
+            *prevTimePoint = this->MonitoredPaths[found->second].LastUpdate;
         }
-        return it.first;
+        return found->second;
     }
 
     MonPath monPath;
@@ -983,19 +1940,22 @@ FileChangeMonitor::InternalID FileChangeMonitor::FindOrAddMonitoredPath(Path pat
 
     auto id = this->GetNewID();
     this->MonitoredPaths[id] = monPath;
+    this->MonitoredPathIndex[key] = id;
+    this->Notifier->WatchPath(id, path);
 
-    this->SuspectPaths.push_back(id);
+    this->SuspectPaths.Push(id);
+    this->MarkPathForPersist(id);
 
     return id;
 }
 
 FileChangeMonitor::InternalID FileChangeMonitor::FindOrAddMonitoredWildcard(Path path)
 {
-    for (auto it : this->MonitoredWildcards) {
-        if (it.second.Check.GetCheckPath() != path)
-            continue;
-        return it.first;
-    }
+    std::string key = path.string();
+
+    auto found = this->MonitoredWildcardIndex.find(key);
+    if (found != this->MonitoredWildcardIndex.end())
+        return found->second;
 
     MonWild monWild;
     monWild.SetDefault();
@@ -1003,73 +1963,104 @@ FileChangeMonitor::InternalID FileChangeMonitor::FindOrAddMonitoredWildcard(Path
 
     auto id = this->GetNewID();
     this->MonitoredWildcards[id] = monWild;
+    this->MonitoredWildcardIndex[key] = id;
+    this->Notifier->WatchWildcard(id, this->GetWildcardBaseDirectory(path.string()));
 
-    this->SuspectWildcards.push_back(id);
+    this->SuspectWildcards.Push(id);
 
     return id;
 }
 
 FileChangeMonitor::InternalID FileChangeMonitor::FindOrAddHub(HubProp hub)
 {
-    for (auto & it : this->HubProperties) {
-        if (!it.second.EqualsAbstractly(hub))
+    auto fingerprint = hub.GetFingerprint();
+
+    auto range = this->HubIndex.equal_range(fingerprint);
+    for (auto it = range.first; it != range.second; ++it) {
+        auto & prop = this->HubProperties[it->second];
+        if (!prop.EqualsAbstractly(hub))
             continue;
         
         if (hub.HubDependency != Monitor::InternalIDNone) {
-            it.second.HubDependency = hub.HubDependency;
+            this->SetHubHubDependency(it->second, hub.HubDependency);
             
                 // If we were orphaned, check if we are on the orphaned dirty list and
                 // if so, put us on the proper dirty hub list
-            auto found = std::find(this->OrphanedDirtyHubs.begin(), this->OrphanedDirtyHubs.end(), it.first);
-            if (found != this->OrphanedDirtyHubs.end()) {
-                this->OrphanedDirtyHubs.erase(found);
-                this->DirtyHubs.push_back(it.first);
+            if (this->OrphanedDirtyHubs.Remove(it->second)) {
+                this->DirtyHubs.Push(it->second);
             }
         }
 
-        return it.first;
+        return it->second;
     }
     
+    auto pathId     = this->FindOrAddMonitoredPath(hub.Path, nullptr);
+    auto dependency = hub.HubDependency;
+
+        // Dependencies are added after the fact so they end up in the reverse index
     hub.PathDependencies.resize(0);
-    hub.PathDependencies.push_back(this->FindOrAddMonitoredPath(hub.Path, nullptr));
+    hub.HubDependency = Monitor::InternalIDNone;
+
+    hub.PersistentKey = hub.BuildPersistentKey();
 
     auto id = this->GetNewID();
     this->HubProperties[id] = hub;
+    this->HubIndex.emplace(fingerprint, id);
+
+    this->AddHubPathDependency(id, pathId);
+    this->SetHubHubDependency(id, dependency);
 
-    this->FutureDirtyHubs.push_back(id);
+    this->FutureDirtyHubs.Push(id);
 
     return id;
 }
 
 FileChangeMonitor::InternalID FileChangeMonitor::FindOrAddPipe(PipeProp pipe)
 {
-    for (auto & it : this->PipeProperties) {
-        if (!it.second.EqualsAbstractly(pipe))
+    auto fingerprint = pipe.GetFingerprint();
+
+    auto range = this->PipeIndex.equal_range(fingerprint);
+    for (auto it = range.first; it != range.second; ++it) {
+        auto & prop = this->PipeProperties[it->second];
+        if (!prop.EqualsAbstractly(pipe))
             continue;
         
         if (pipe.HubDependency != Monitor::InternalIDNone) {
-            it.second.HubDependency = pipe.HubDependency;
+            this->SetPipeHubDependency(it->second, pipe.HubDependency);
+            prop.HubKey = pipe.HubKey;
 
                 // If we were orphaned, check if we are on the orphaned dirty list and
                 // if so, put us on the proper dirty pipe list
-            auto found = std::find(this->OrphanedDirtyPipes.begin(), this->OrphanedDirtyPipes.end(), it.first);
-            if (found != this->OrphanedDirtyPipes.end()) {
-                this->OrphanedDirtyPipes.erase(std::remove(this->OrphanedDirtyPipes.begin(), this->OrphanedDirtyPipes.end(), it.first), this->OrphanedDirtyPipes.end());
-                this->DirtyPipes.push_back(it.first);
+            if (this->OrphanedDirtyPipes.Remove(it->second)) {
+                this->DirtyPipes.Push(it->second);
+                this->MarkPipeForPersist(it->second);
             }
         }
 
-        return it.first;
+        return it->second;
     }
 
+    InternalIDList dependencies;
+    dependencies.swap(pipe.PathDependencies);
+
+    auto dependency = pipe.HubDependency;
+    pipe.HubDependency = Monitor::InternalIDNone;
+
     auto id = this->GetNewID();
     this->PipeProperties[id] = pipe;
+    this->PipeIndex.emplace(fingerprint, id);
+
+    this->SetPipeHubDependency(id, dependency);
     
         // If we are created as an orphan we should just quietly exist; but
         // if we have a parent hub we should consider ourselves dirty.
-    if (pipe.HubDependency != Monitor::InternalIDNone) {
-        pipe.PathDependencies.resize(0);
-        this->FutureDirtyPipes.push_back(id);
+    if (dependency != Monitor::InternalIDNone) {
+        this->FutureDirtyPipes.Push(id);
+        return id;
+    }
+
+    for (auto pathId : dependencies) {
+        this->AddPipePathDependency(id, pathId);
     }
 
     return id;
@@ -1077,62 +2068,203 @@ FileChangeMonitor::InternalID FileChangeMonitor::FindOrAddPipe(PipeProp pipe)
 
 FileChangeMonitor::InternalID FileChangeMonitor::FindOrAddPipeWildcards(PipeWild wild)
 {
-    for (auto & it : this->PipeWildcards) {
-        if (!it.second.EqualsAbstractly(wild))
+    auto fingerprint = wild.GetFingerprint();
+
+    auto range = this->PipeWildcardIndex.equal_range(fingerprint);
+    for (auto it = range.first; it != range.second; ++it) {
+        auto & prop = this->PipeWildcards[it->second];
+        if (!prop.EqualsAbstractly(wild))
             continue;
-        return it.first;
+
+            // A wildcard left behind by its hub is taken back; it has to
+            // find all of its pipes again to hand them to the hub
+        if (prop.HubDependency == Monitor::InternalIDNone &&
+            wild.HubDependency != Monitor::InternalIDNone) {
+            this->SetPipeWildcardsHubDependency(it->second, wild.HubDependency);
+            prop.HubKey = wild.HubKey;
+            prop.Snapshot.clear();
+            this->FutureDirtyPipeWildcards.Push(it->second);
+        }
+
+        return it->second;
     }
 
     auto id = this->GetNewID();
     this->PipeWildcards[id] = wild;
+    this->PipeWildcardIndex.emplace(fingerprint, id);
+
+    LinkReverse(this->WildcardPipeWildcards, wild.WildcardDependency, id);
+    LinkReverse(this->HubChildPipeWildcards, wild.HubDependency, id);
+
+        // The monitored wildcard may have found its files long ago, and
+        // will not tell us about them again
+    this->FutureDirtyPipeWildcards.Push(id);
 
     return id;
 }
 
+void FileChangeMonitor::RemoveMonitoredPath(InternalID id)
+{
+    auto it = this->MonitoredPaths.find(id);
+    if (it == this->MonitoredPaths.end())
+        return;
+
+    this->Notifier->Unwatch(id);
+    this->MonitoredPathIndex.erase(it->second.Path.string());
+    this->MonitoredPaths.erase(it);
+    this->MarkPathForPersist(id);
+
+    this->PathHubUsers.erase(id);
+    this->PathPipeUsers.erase(id);
+}
+
+void FileChangeMonitor::RemoveHub(InternalID id)
+{
+    auto it = this->HubProperties.find(id);
+    if (it == this->HubProperties.end())
+        return;
+
+    this->ClearHubPathDependencies(id);
+    this->SetHubHubDependency(id, Monitor::InternalIDNone);
+
+    EraseFromIndex(this->HubIndex, it->second.GetFingerprint(), id);
+    this->HubProperties.erase(it);
+
+    this->HubChildHubs.erase(id);
+    this->HubChildPipes.erase(id);
+    this->HubChildPipeWildcards.erase(id);
+}
+
+void FileChangeMonitor::AddHubPathDependency(InternalID id, InternalID path)
+{
+    auto & prop = this->HubProperties[id];
+    prop.PathDependencies.push_back(path);
+    LinkReverse(this->PathHubUsers, path, id);
+}
+
+void FileChangeMonitor::AddPipePathDependency(InternalID id, InternalID path)
+{
+    auto & prop = this->PipeProperties[id];
+    prop.PathDependencies.push_back(path);
+    LinkReverse(this->PathPipeUsers, path, id);
+}
+
+void FileChangeMonitor::ClearHubPathDependencies(InternalID id)
+{
+    auto & prop = this->HubProperties[id];
+    for (auto path : prop.PathDependencies) {
+        UnlinkReverse(this->PathHubUsers, path, id);
+    }
+    prop.PathDependencies.resize(0);
+}
+
+void FileChangeMonitor::ClearPipePathDependencies(InternalID id)
+{
+    auto & prop = this->PipeProperties[id];
+    for (auto path : prop.PathDependencies) {
+        UnlinkReverse(this->PathPipeUsers, path, id);
+    }
+    prop.PathDependencies.resize(0);
+}
+
+void FileChangeMonitor::SetHubHubDependency(InternalID id, InternalID hub)
+{
+    auto & prop = this->HubProperties[id];
+    UnlinkReverse(this->HubChildHubs, prop.HubDependency, id);
+    prop.HubDependency = hub;
+    LinkReverse(this->HubChildHubs, hub, id);
+}
+
+void FileChangeMonitor::SetPipeHubDependency(InternalID id, InternalID hub)
+{
+    auto & prop = this->PipeProperties[id];
+    UnlinkReverse(this->HubChildPipes, prop.HubDependency, id);
+    prop.HubDependency = hub;
+    LinkReverse(this->HubChildPipes, hub, id);
+
+    this->MarkPipeForPersist(id);
+
+    if (hub != Monitor::InternalIDNone)
+        return;
+
+        // Without a hub nobody wants our outputs any more; whatever we had
+        // sent off is cancelled, and its result ignored, and we are only
+        // built again if a hub adopts us
+    bool wasSent = this->OutboxPipes.Remove(id);
+    if (prop.Cancel) {
+        prop.Cancel->store(true);
+        prop.Cancel.reset();
+        prop.Generation += 1;
+        wasSent = this->PendingPipes.Remove(id) || wasSent;
+    }
+    if (wasSent) {
+        this->OrphanedDirtyPipes.Push(id);
+    }
+}
+
+void FileChangeMonitor::SetPipeWildcardsHubDependency(InternalID id, InternalID hub)
+{
+    auto & prop = this->PipeWildcards[id];
+    UnlinkReverse(this->HubChildPipeWildcards, prop.HubDependency, id);
+    prop.HubDependency = hub;
+    LinkReverse(this->HubChildPipeWildcards, hub, id);
+}
+
 void FileChangeMonitor::MakeUsersOfPathDirty(InternalID id)
 {
         // Check hubs
-    for (auto it : this->HubProperties) {
-        auto & dep = it.second.PathDependencies;
-        if (std::find(dep.begin(), dep.end(), id) == dep.end())
-            continue;
-        this->FutureDirtyHubs.push_back(it.first);
+    auto hubs = this->PathHubUsers.find(id);
+    if (hubs != this->PathHubUsers.end()) {
+        this->FutureDirtyHubs.Push(hubs->second.begin(), hubs->second.end());
     }
 
         // Check pipes
-    for (auto it : this->PipeProperties) {
-        auto & dep = it.second.PathDependencies;
-        if (std::find(dep.begin(), dep.end(), id) == dep.end())
-            continue;
-        this->FutureDirtyPipes.push_back(it.first);
+    auto pipes = this->PathPipeUsers.find(id);
+    if (pipes != this->PathPipeUsers.end()) {
+        this->FutureDirtyPipes.Push(pipes->second.begin(), pipes->second.end());
+        for (auto pipe : pipes->second) {
+            this->MarkPipeForPersist(pipe);
+        }
     }
 }
 
 void FileChangeMonitor::MakeUsersOfWildcardDirty(InternalID id)
 {
         // Check pipe wildcards
-    for (auto it : this->PipeWildcards) {
-        if (id != it.second.WildcardDependency)
-            continue;
-        this->FutureDirtyPipeWildcards.push_back(it.first);
+    auto wild = this->WildcardPipeWildcards.find(id);
+    if (wild != this->WildcardPipeWildcards.end()) {
+        this->FutureDirtyPipeWildcards.Push(wild->second.begin(), wild->second.end());
     }
 }
 
 void FileChangeMonitor::MakeDependantsOnHubOrphan(InternalID id)
 {
-        // Check hubs
-    for (auto & it : this->HubProperties) {
-        if (id != it.second.HubDependency)
-            continue;
-        it.second.HubDependency = Monitor::InternalIDNone;
-        this->PotentiallyOrphanedHubs.push_back(it.first);
+        // Check hubs; the set is copied as orphaning changes it
+    auto hubs = this->HubChildHubs.find(id);
+    if (hubs != this->HubChildHubs.end()) {
+        InternalIDList children(hubs->second.begin(), hubs->second.end());
+        for (auto child : children) {
+            this->SetHubHubDependency(child, Monitor::InternalIDNone);
+            this->PotentiallyOrphanedHubs.Push(child);
+        }
     }
     
         // Check pipes
-    for (auto & it : this->PipeProperties) {
-        if (id != it.second.HubDependency)
-            continue;
-        it.second.HubDependency = Monitor::InternalIDNone;
+    auto pipes = this->HubChildPipes.find(id);
+    if (pipes != this->HubChildPipes.end()) {
+        InternalIDList children(pipes->second.begin(), pipes->second.end());
+        for (auto child : children) {
+            this->SetPipeHubDependency(child, Monitor::InternalIDNone);
+        }
+    }
+
+        // Check pipe wildcards; they make no pipes until they are adopted
+    auto wilds = this->HubChildPipeWildcards.find(id);
+    if (wilds != this->HubChildPipeWildcards.end()) {
+        InternalIDList children(wilds->second.begin(), wilds->second.end());
+        for (auto child : children) {
+            this->SetPipeWildcardsHubDependency(child, Monitor::InternalIDNone);
+        }
     }
 }
 
@@ -1141,12 +2273,102 @@ void FileChangeMonitor::MakeDependantsOnHubOrphan(InternalID id)
 
 FileChangeMonitor::Count FileChangeMonitor::GetActiveDirtyHubCount()
 {
-    return (Count)(this->DirtyHubs.size() + this->FutureDirtyHubs.size());
+    return (Count)(this->DirtyHubs.Size() + this->FutureDirtyHubs.Size());
 }
 
 FileChangeMonitor::Count FileChangeMonitor::GetActiveDirtyPipeCount()
 {
-    return (Count)(this->DirtyPipes.size() + this->FutureDirtyPipes.size());
+    return (Count)(this->DirtyPipes.Size() + this->FutureDirtyPipes.Size());
+}
+
+JSON FileChangeMonitor::GetQueueDepths()
+{
+    return {
+        { "suspect-paths",        this->SuspectPaths.Size() + this->FutureSuspectPaths.Size() },
+        { "suspect-wildcards",    this->SuspectWildcards.Size() + this->FutureSuspectWildcards.Size() },
+        { "dirty-hubs",           this->GetActiveDirtyHubCount() },
+        { "orphaned-dirty-hubs",  this->OrphanedDirtyHubs.Size() },
+        { "dirty-pipe-wildcards", this->DirtyPipeWildcards.Size() + this->FutureDirtyPipeWildcards.Size() },
+        { "dirty-pipes",          this->GetActiveDirtyPipeCount() },
+        { "orphaned-dirty-pipes", this->OrphanedDirtyPipes.Size() },
+        { "outbox-pipes",         this->OutboxPipes.Size() },
+        { "pending-pipes",        this->PendingPipes.Size() }
+    };
+}
+
+bool FileChangeMonitor::UpdateContentHash(MonPath & prop, const PathScan & scan)
+{
+        // Returns whether the contents changed. If we cannot stat or read
+        // the file we have to assume they did, and forget our old hash.
+    if (!scan.Hashed) {
+        prop.HasContentHash = false;
+        return true;
+    }
+
+    auto & stamp = scan.Stamp;
+    auto   hash  = scan.Hash;
+
+        // Only the contents matter; the same bytes under a new inode (an
+        // editor saving by rename, say) are still the same file to us
+    bool changed = !prop.HasContentHash || prop.Size != stamp.Size || prop.ContentHash != hash;
+
+    prop.Size           = stamp.Size;
+    prop.ContentHash    = hash;
+    prop.HasContentHash = true;
+
+    return changed;
+}
+
+std::chrono::milliseconds FileChangeMonitor::EstimateDownstreamDuration(InternalID id, DurationMemo & memo, int depth, bool & cutOff)
+{
+        // The longest chain of pipes that read what this pipe writes, going
+        // by how long each took last time; this is what the wrangler should
+        // start early if it wants the whole build to finish early
+    auto found = memo.find(id);
+    if (found != memo.end()) {
+            // Still being worked out further up, so we went round in a cycle
+        if (found->second < std::chrono::milliseconds(0)) {
+            cutOff = true;
+            return std::chrono::milliseconds(0);
+        }
+        return found->second;
+    }
+
+        // Hubs can make pipes feed themselves, so do not go on forever
+    if (depth >= 16) {
+        cutOff = true;
+        return std::chrono::milliseconds(0);
+    }
+
+    memo[id] = std::chrono::milliseconds(-1);
+    bool chainCutOff = false;
+
+    auto & prop = this->PipeProperties[id];
+    auto longest = std::chrono::milliseconds(0);
+
+    auto path = this->MonitoredPathIndex.find(prop.BasePathOut.string());
+    if (path != this->MonitoredPathIndex.end()) {
+        auto users = this->PathPipeUsers.find(path->second);
+        if (users != this->PathPipeUsers.end()) {
+            for (auto user : users->second) {
+                if (user == id)
+                    continue;
+                auto chain = this->PipeProperties[user].LastDuration + this->EstimateDownstreamDuration(user, memo, depth + 1, chainCutOff);
+                longest = std::max(longest, chain);
+            }
+        }
+    }
+
+        // A chain that was cut short depends on where we came in from, so
+        // only complete ones are remembered for the next pipe to look up
+    if (chainCutOff) {
+        memo.erase(id);
+        cutOff = true;
+        return longest;
+    }
+
+    memo[id] = longest;
+    return longest;
 }
 
 bool FileChangeMonitor::FileTimeEqualsWithEpsilon(TimePoint lh, TimePoint rh)
@@ -1222,13 +2444,28 @@ bool FileChangeMonitor::PathContainsWildcards(const std::string path)
     return path.find("*") != std::string::npos;
 }
 
-std::string FileChangeMonitor::SimpleFormatHub(HubProp prop)
+Path FileChangeMonitor::GetWildcardBaseDirectory(const std::string path)
+{
+        // Everything up to the directory holding the first wildcard or
+        // delimiter is fixed, so that is the directory we need to watch
+    size_t first = path.find_first_of("*~");
+    if (first == std::string::npos)
+        return Path(path).parent_path();
+
+    size_t sep = path.find_last_of("/\\", first);
+    if (sep == std::string::npos)
+        return Path(".");
+
+    return Path(path.substr(0, sep));
+}
+
+std::string FileChangeMonitor::SimpleFormatHub(const HubProp & prop)
 {
     std::stringstream ss;
 
     ss << this->SimpleFormatPath(prop.Path);
 
-    for (auto & elem : prop.InputProcessProp.StringVariables) {
+    for (auto & elem : prop.InputProcessProp.StringVariables.Flatten()) {
         if (elem.first.find("-dir") != elem.first.npos) {
             ss << std::endl << " " << elem.first << " : " << this->SimpleFormatPath(elem.second);
         }
@@ -1264,27 +2501,14 @@ void FileChangeMonitor::HandleMonitoredPathMissing(InternalID id)
     
         // We need to check if anything actually uses us
     auto check_used = [&] {
-        for (auto & it : this->HubProperties) {
-            for (auto & sub : it.second.PathDependencies) {
-                if (id != sub)
-                    continue;
-                return true;
-            }
-        }
-        for (auto & it : this->PipeProperties) {
-            for (auto & sub : it.second.PathDependencies) {
-                if (id != sub)
-                    continue;
-                return true;
-            }
-        }
-        return false;
+        return this->PathHubUsers.find(id) != this->PathHubUsers.end() ||
+               this->PathPipeUsers.find(id) != this->PathPipeUsers.end();
     };
 
         // If we were removed, just silently remove
         // the monitored file
     if (!check_used()) {
-        this->MonitoredPaths.erase(id);
+        this->RemoveMonitoredPath(id);
         return;
     }
 
@@ -1294,13 +2518,14 @@ void FileChangeMonitor::HandleMonitoredPathMissing(InternalID id)
         // might change the contents of the file without changing the time
         // To counter this we just reset to the beginning of time
     prop.LastUpdate = std::chrono::time_point<std::chrono::system_clock>{};
+    this->MarkPathForPersist(id);
 
         // Set the timeout to a few second from now to prevent a file
         // being constantly updated
     Monitor::TimePoint currentTime = std::chrono::system_clock::now();
     prop.Timeout = currentTime + std::chrono::seconds(1);
 
-    this->FutureSuspectPaths.push_back(id);
+    this->FutureSuspectPaths.Push(id);
 }
 
 void FileChangeMonitor::HandleMonitoredPathError(InternalID id, BlackRoot::Debug::Exception *e)
@@ -1321,7 +2546,7 @@ void FileChangeMonitor::HandleMonitoredPathError(InternalID id, BlackRoot::Debug
     Monitor::TimePoint currentTime = std::chrono::system_clock::now();
     prop.Timeout = currentTime + std::chrono::seconds(1);
 
-    this->FutureSuspectPaths.push_back(id);
+    this->FutureSuspectPaths.Push(id);
 
     delete e;
 }
@@ -1351,11 +2576,11 @@ void FileChangeMonitor::HandleHubFileError(InternalID id, BlackRoot::Debug::Exce
 
         // As a precaution make all paths used by this hub suspicious
     for (auto & pid : prop.PathDependencies) {
-        this->SuspectPaths.push_back(pid);
+        this->SuspectPaths.Push(pid);
     }
 
         // Push the hub back on the dirty hub stack
-    this->DirtyHubs.push_back(id);
+    this->DirtyHubs.Push(id);
 
     delete e;
 }
@@ -1385,11 +2610,12 @@ void FileChangeMonitor::HandleWrangledPipeError(InternalID id, BlackRoot::Debug:
 
         // As a precaution make all paths used by this pipe suspicious
     for (auto & pid : prop.PathDependencies) {
-        this->SuspectPaths.push_back(pid);
+        this->SuspectPaths.Push(pid);
     }
 
         // Push the pipe back on the dirty hub stack
-    this->DirtyPipes.push_back(id);
+    this->DirtyPipes.Push(id);
+    this->MarkPipeForPersist(id);
 
     delete e;
 }
@@ -1421,16 +2647,19 @@ void FileChangeMonitor::Begin()
     this->UpdateThread = std::thread([&] {
         BlackRoot::System::SetCurrentThreadPriority(BlackRoot::System::ThreadPriority::Lowest);
 
-        cout{} << "Starting FileChangeMontor thread." << std::endl << std::endl;
+        cout{} << "Starting FileChangeMontor thread (" << this->Notifier->GetName() << ")." << std::endl << std::endl;
         
         try {
-            std::unique_lock<std::mutex> lock(this->MutexAccessFiles);
             this->LoadFromPersistent();
         }
         catch (BlackRoot::Debug::Exception * e) {
             this->HandleThreadException(e);
         }
 
+        this->BeginPersistThread();
+
+        this->Scanner.Begin(this->ScanThreads);
+
         this->CurrentState = State::Running;
         try {
             this->UpdateCycle();
@@ -1442,13 +2671,16 @@ void FileChangeMonitor::Begin()
         cout{} << "Ending FileChangeMontor thread." << std::endl << std::endl;
         
         try {
-            std::unique_lock<std::mutex> lock(this->MutexAccessFiles);
             this->SaveToPersistent();
         }
         catch (BlackRoot::Debug::Exception * e) {
             this->HandleThreadException(e);
         }
 
+        this->EndPersistThread();
+
+        this->Scanner.EndAndWait();
+
         this->CurrentState = State::Stopped;
     });
 }
@@ -1456,6 +2688,7 @@ void FileChangeMonitor::Begin()
 void FileChangeMonitor::EndAndWait()
 {
     this->TargetState = State::Stopped;
+    this->Notifier->Wake();
     this->UpdateThread.join();
 }
 
@@ -1464,6 +2697,28 @@ void FileChangeMonitor::SetPersistentDirectory(const BlackRoot::IO::FilePath pat
     this->PersistentDirectory = fs::canonical(path);
 }
 
+void FileChangeMonitor::SetPersistentJSONExport(bool exportJSON)
+{
+    this->ExportPersistentJSON = exportJSON;
+}
+
+void FileChangeMonitor::SetContentHashing(bool useHashes)
+{
+    this->UseContentHashes = useHashes;
+}
+
+void FileChangeMonitor::SetScanThreads(std::size_t threads)
+{
+    DbAssert(this->IsStopped());
+    this->ScanThreads = threads;
+}
+
+void FileChangeMonitor::SetDirectorySkipping(bool skip)
+{
+    DbAssert(this->IsStopped());
+    this->SkipUnchangedDirectories = skip;
+}
+
 void FileChangeMonitor::SetReferenceDirectory(const BlackRoot::IO::FilePath path)
 {
     this->InfoReferenceDirectory = fs::canonical(path);
@@ -1471,18 +2726,12 @@ void FileChangeMonitor::SetReferenceDirectory(const BlackRoot::IO::FilePath path
 
 void FileChangeMonitor::AddBaseHubFile(const BlackRoot::IO::FilePath path)
 {
-    std::unique_lock<std::mutex> lock(this->MutexAccessFiles);
-
-    HubProp hub;
-    hub.SetDefault();
-    hub.HubDependency = this->OriginalHubDependancy;
-    hub.Path = path;
-
-        // We always set a variable "cur-dir" to be the parent directory of
-        // the file. Hubs themselves then use this variable as a relative path.
-    hub.InputProcessProp.StringVariables["cur-dir"] = hub.Path.parent_path().string();
+        // The update thread picks this up at the start of its next cycle
+    std::unique_lock<std::mutex> lock(this->MxBaseHubFiles);
+    this->PendingBaseHubFiles.push_back(path);
+    lock.unlock();
 
-    this->FindOrAddHub(hub);
+    this->Notifier->Wake();
 }
 
 void FileChangeMonitor::SetWrangler(IWrangler * wrangler)
@@ -1497,7 +2746,7 @@ void FileChangeMonitor::SetWrangler(IWrangler * wrangler)
 
 void ProcessProperties::SetDefault()
 {
-    this->StringVariables.clear();
+    this->StringVariables.Clear();
 }
 
 void ProcessProperties::AdaptVariables(const JSON json)
@@ -1506,12 +2755,27 @@ void ProcessProperties::AdaptVariables(const JSON json)
 
     for (auto & elem : json) {
         for (auto & kv : elem.items()) {
-            this->StringVariables[this->ProcessString(kv.key())] = this->ProcessString(kv.value());
+            this->StringVariables.Set(this->ProcessString(kv.key()), this->ProcessString(kv.value()));
         }
     }
 }
 
 std::string ProcessProperties::ProcessString(std::string str)
+{
+        // Most strings have nothing to replace at all
+    if (str.find('{') == std::string::npos)
+        return str;
+
+        // Compiled once per string, and rendered again only if one of the
+        // variables it uses changed since last time
+    std::string out;
+    if (StringTemplate::FindCompiled(str).Render(this->StringVariables, out))
+        return out;
+
+    return this->InterpretString(std::move(str));
+}
+
+std::string ProcessProperties::InterpretString(std::string str)
 {
     size_t start;
 
@@ -1527,10 +2791,10 @@ std::string ProcessProperties::ProcessString(std::string str)
         DbAssertMsgFatal(end != std::string::npos, "Malformed string");
 
         auto key = str.substr(start+1, end-start-1);
-        auto & it = this->StringVariables.find(key);
-        DbAssertMsgFatal(it != this->StringVariables.end(), (std::stringstream{} << "Unknown key '" << key << "'").str());
+        auto * value = this->StringVariables.Find(key);
+        DbAssertMsgFatal(value, (std::stringstream{} << "Unknown key '" << key << "'").str());
 
-        str.replace(str.begin() + start, str.begin() + end + 1, it->second);
+        str.replace(str.begin() + start, str.begin() + end + 1, *value);
 
         DbAssertMsgFatal(--maxItt >= 0, "Maximum of iterations exceeded.");
     }
@@ -1542,7 +2806,10 @@ void ProcessProperties::ProcessJSONRecursively(JSON * json)
 {
     for (auto & elem : (*json)) {
         if (elem.is_string()) {
-            elem = this->ProcessString(elem.get<std::string>());
+            auto & str = elem.get_ref<std::string&>();
+            if (str.find('{') != std::string::npos) {
+                str = this->ProcessString(str);
+            }
             continue;
         }
         if (elem.is_array() || elem.is_object()) {
@@ -1551,13 +2818,35 @@ void ProcessProperties::ProcessJSONRecursively(JSON * json)
     }
 }
 
-bool ProcessProperties::Equals(const ProcessProperties rh)
+bool ProcessProperties::Equals(const ProcessProperties & rh) const
 {
+        // Copies of the same scope compare by identity
     if (this->StringVariables != rh.StringVariables)
         return false;
     return true;
 }
 
+std::string ProcessProperties::BuildKey() const
+{
+    auto flat = this->StringVariables.Flatten();
+    std::map<std::string, std::string> sorted(flat.begin(), flat.end());
+
+    std::string key = std::to_string(sorted.size()) + ";";
+    for (auto & kv : sorted) {
+        key.append(std::to_string(kv.first.size())).push_back(':');
+        key.append(kv.first);
+        key.append(std::to_string(kv.second.size())).push_back(':');
+        key.append(kv.second);
+    }
+    return key;
+}
+
+Fingerprint ProcessProperties::GetFingerprint() const
+{
+        // Kept with the scope, so only new frames are ever hashed
+    return this->StringVariables.GetFingerprint();
+}
+
     //  Items
     // --------------------
 
@@ -1567,6 +2856,30 @@ void MonitoredPath::SetDefault()
 
     this->LastUpdate = std::chrono::time_point<std::chrono::system_clock>{};
     this->Timeout    = std::chrono::system_clock::now();
+
+    this->Size           = 0;
+    this->ContentHash    = 0;
+    this->HasContentHash = false;
+}
+
+void MonitoredPath::GetPersistentState(JournalPathState & state) const
+{
+    auto clock = std::chrono::system_clock::time_point{};
+
+    state.Changed        = std::chrono::duration_cast<std::chrono::milliseconds>(this->LastUpdate - clock).count();
+    state.Size           = this->Size;
+    state.ContentHash    = this->ContentHash;
+    state.HasContentHash = this->HasContentHash;
+}
+
+void MonitoredPath::SetPersistentState(const JournalPathState & state)
+{
+    auto clock = std::chrono::system_clock::time_point{};
+
+    this->LastUpdate     = clock + std::chrono::milliseconds(state.Changed);
+    this->Size           = state.Size;
+    this->ContentHash    = state.ContentHash;
+    this->HasContentHash = state.HasContentHash;
 }
 
 void MonitoredWildcard::SetDefault()
@@ -1587,9 +2900,10 @@ void HubProperties::SetDefault()
     this->Timeout    = std::chrono::system_clock::now();
 
     this->InputProcessProp.SetDefault();
+    this->PersistentKey = "";
 }
 
-bool HubProperties::EqualsAbstractly(const HubProperties rh)
+bool HubProperties::EqualsAbstractly(const HubProperties & rh) const
 {
     if (this->Path != rh.Path)
         return false;
@@ -1601,6 +2915,30 @@ bool HubProperties::EqualsAbstractly(const HubProperties rh)
     return true;
 }
 
+Fingerprint HubProperties::GetFingerprint() const
+{
+        // Only what is always compared by 'EqualsAbstractly'
+    Fingerprint fingerprint = std::hash<std::string>{}(this->Path.string());
+    HashCombine(fingerprint, this->InputProcessProp.GetFingerprint());
+    return fingerprint;
+}
+
+std::string HubProperties::BuildPersistentKey() const
+{
+        // Variables are sorted, so the key does not depend on the order
+        // they happened to be set in
+    auto flat = this->InputProcessProp.StringVariables.Flatten();
+    std::map<std::string, std::string> sorted(flat.begin(), flat.end());
+
+    std::string key = this->Path.string();
+    for (auto & kv : sorted) {
+        key.push_back('\0');
+        key.append(kv.first).push_back('=');
+        key.append(kv.second);
+    }
+    return key;
+}
+
 void PipeProperties::SetDefault()
 {
     this->PathDependencies.resize(0);
@@ -1610,12 +2948,17 @@ void PipeProperties::SetDefault()
     this->BasePathOut   = "";
 
     this->HubDependency = Monitor::InternalIDNone;
+    this->HubKey        = "";
     this->Timeout       = std::chrono::system_clock::now();
+    this->LastDuration  = std::chrono::milliseconds(0);
+    this->Generation    = 0;
+    this->Cancel.reset();
 
     this->Settings      = {};
+    this->Encoded.reset();
 }
 
-bool PipeProperties::EqualsAbstractly(const PipeProperties rh)
+bool PipeProperties::EqualsAbstractly(const PipeProperties & rh) const
 {
     if (0 != this->Tool.compare(rh.Tool))
         return false;
@@ -1626,11 +2969,24 @@ bool PipeProperties::EqualsAbstractly(const PipeProperties rh)
     if (this->HubDependency != Monitor::InternalIDNone &&
         this->HubDependency != rh.HubDependency)
         return false;
+    if (this->HubKey.length() > 0 && rh.HubKey.length() > 0 &&
+        this->HubKey != rh.HubKey)
+        return false;
     if (!(this->Settings == rh.Settings))
         return false;
     return true;
 }
 
+Fingerprint PipeProperties::GetFingerprint() const
+{
+        // Only what is always compared by 'EqualsAbstractly'
+    Fingerprint fingerprint = std::hash<std::string>{}(this->Tool);
+    HashCombine(fingerprint, std::hash<std::string>{}(this->BasePathIn.string()));
+    HashCombine(fingerprint, std::hash<std::string>{}(this->BasePathOut.string()));
+    HashCombine(fingerprint, std::hash<JSON>{}(this->Settings));
+    return fingerprint;
+}
+
 void PipeWildcards::SetDefault()
 {
     this->Tool          = "";
@@ -1640,12 +2996,16 @@ void PipeWildcards::SetDefault()
     this->InputProcessProp.SetDefault();
 
     this->HubDependency       = Monitor::InternalIDNone;
+    this->HubKey              = "";
     this->WildcardDependency  = Monitor::InternalIDNone;
 
     this->Settings      = {};
+
+    this->Snapshot.clear();
+    this->SnapshotPass  = 0;
 }
 
-bool PipeWildcards::EqualsAbstractly(const PipeWildcards rh)
+bool PipeWildcards::EqualsAbstractly(const PipeWildcards & rh) const
 {
     if (0 != this->Tool.compare(rh.Tool))
         return false;
@@ -1659,7 +3019,23 @@ bool PipeWildcards::EqualsAbstractly(const PipeWildcards rh)
     if (this->WildcardDependency != Monitor::InternalIDNone &&
         this->WildcardDependency != rh.WildcardDependency)
         return false;
+    if (this->HubKey != rh.HubKey)
+        return false;
+    if (!this->InputProcessProp.Equals(rh.InputProcessProp))
+        return false;
     if (!(this->Settings == rh.Settings))
         return false;
     return true;
+}
+
+Fingerprint PipeWildcards::GetFingerprint() const
+{
+        // Only what is always compared by 'EqualsAbstractly'
+    Fingerprint fingerprint = std::hash<std::string>{}(this->Tool);
+    HashCombine(fingerprint, std::hash<std::string>{}(this->BasePathIn.string()));
+    HashCombine(fingerprint, std::hash<std::string>{}(this->BasePathOut.string()));
+    HashCombine(fingerprint, std::hash<JSON>{}(this->Settings));
+    HashCombine(fingerprint, std::hash<std::string>{}(this->HubKey));
+    HashCombine(fingerprint, this->InputProcessProp.GetFingerprint());
+    return fingerprint;
 }
\ No newline at end of file
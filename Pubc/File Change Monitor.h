@@ -9,15 +9,30 @@
 
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <deque>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "BlackRoot/Pubc/Number Types.h"
 #include "BlackRoot/Pubc/Files Types.h"
 #include "BlackRoot/Pubc/JSON.h"
-#include "BlackRoot/Pubc/File Wildcard.h"
 
 #include "HephaestusBase/Pubc/Pipeline Meta.h"
+#include "HephaestusBase/Pubc/File Change Notifier.h"
+#include "HephaestusBase/Pubc/ID Queue.h"
+#include "HephaestusBase/Pubc/MPSC Queue.h"
+#include "HephaestusBase/Pubc/Monitor Journal.h"
+#include "HephaestusBase/Pubc/Monitor Snapshot.h"
+#include "HephaestusBase/Pubc/Scan Pool.h"
+#include "HephaestusBase/Pubc/Wildcard Matcher.h"
+#include "HephaestusBase/Pubc/Content Hash.h"
+#include "HephaestusBase/Pubc/Directory Stat.h"
+#include "HephaestusBase/Pubc/String Template.h"
 
 namespace Hephaestus {
 namespace Pipeline {
@@ -30,16 +45,25 @@ namespace Monitor {
     using JSON            = BlackRoot::Format::JSON;
     using Path            = BlackRoot::IO::FilePath;
     using InternalIDList  = std::vector<InternalID>;
-    using WildcardCheck   = BlackRoot::Util::SmartFileWildcard;
+    using WildcardCheck   = WildcardMatcher;
+    using Fingerprint     = std::size_t;
 
     struct ProcessProperties {
-        std::unordered_map<std::string, std::string>    StringVariables;
+            // Shared with whatever scope this was copied from; only what
+            // is set after the copy takes memory of its own
+        VariableScope       StringVariables;
 
         void    SetDefault();
-        bool    Equals(const ProcessProperties);
+        bool    Equals(const ProcessProperties &) const;
+        Fingerprint GetFingerprint() const;
+
+            // Every variable, sorted and length-prefixed; equal only for
+            // equal variables, unlike the fingerprint
+        std::string BuildKey() const;
 
         void         AdaptVariables(const JSON);
         std::string  ProcessString(std::string);
+        std::string  InterpretString(std::string);
         void         ProcessJSONRecursively(JSON *);
     };
 
@@ -47,7 +71,13 @@ namespace Monitor {
         Path                Path;
         TimePoint           LastUpdate, Timeout;
 
+            // Only kept up to date if the monitor hashes contents
+        uint64              Size, ContentHash;
+        bool                HasContentHash;
+
         void    SetDefault();
+        void    GetPersistentState(JournalPathState &) const;
+        void    SetPersistentState(const JournalPathState &);
     };
 
     struct MonitoredWildcard {
@@ -59,6 +89,10 @@ namespace Monitor {
     struct PipeWildcards {
         InternalID          WildcardDependency;
         InternalID          HubDependency;
+
+            // As with pipes, only the hub with this key adopts us, and only
+            // with the same variables; without a hub we make no pipes
+        std::string         HubKey;
         
         ProcessProperties   InputProcessProp;
 
@@ -66,8 +100,18 @@ namespace Monitor {
         Path                BasePathIn, BasePathOut;
         JSON                Settings;
 
+            // What the wildcard matched last time, with the pipe made for
+            // each; an update only touches matches that came or went
+        struct SnapshotEntry {
+            InternalID      Pipe;
+            uint64          Pass;
+        };
+        std::unordered_map<std::string, SnapshotEntry>  Snapshot;
+        uint64              SnapshotPass;
+
         void    SetDefault();
-        bool    EqualsAbstractly(const PipeWildcards);
+        bool    EqualsAbstractly(const PipeWildcards &) const;
+        Fingerprint GetFingerprint() const;
     };
 
     struct HubProperties {
@@ -79,8 +123,22 @@ namespace Monitor {
 
         ProcessProperties   InputProcessProp;
 
+            // Who we are across runs; the path and every variable we see
+        std::string         PersistentKey;
+
+            // What every entry of the hub file made last time it was read,
+            // keyed by the entry and the variables it saw; entries that did
+            // not change are not processed again
+        struct EntryRecord {
+            InternalIDList  Hubs, Pipes, PipeWildcards;
+        };
+        using EntryMap = std::unordered_map<std::string, EntryRecord>;
+        EntryMap            Entries;
+
         void    SetDefault();
-        bool    EqualsAbstractly(const HubProperties);
+        bool    EqualsAbstractly(const HubProperties &) const;
+        Fingerprint GetFingerprint() const;
+        std::string BuildPersistentKey() const;
     };
 
     struct PipeProperties {
@@ -89,14 +147,29 @@ namespace Monitor {
         InternalID          HubDependency;
         InternalID          WildcardDependency;
         std::string         Tool;
+
+            // The persistent key of the hub that made us; kept when we are
+            // orphaned, so that we are only ever adopted by that same hub
+        std::string         HubKey;
         Path                BasePathIn, BasePathOut;
             
         TimePoint           Timeout;
+        std::chrono::milliseconds   LastDuration;
+
+            // Every dispatch gets a new generation; only results of the
+            // latest one count, and the one before is cancelled
+        uint64              Generation;
+        CancelToken         Cancel;
 
         JSON                Settings;
 
+            // Encoded on first dispatch; settings are part of what makes a
+            // pipe, so this never goes stale
+        std::shared_ptr<const EncodedSettings>  Encoded;
+
         void    SetDefault();
-        bool    EqualsAbstractly(const PipeProperties);
+        bool    EqualsAbstractly(const PipeProperties &) const;
+        Fingerprint GetFingerprint() const;
     };
 
     class FileChangeMonitor {
@@ -118,46 +191,140 @@ namespace Monitor {
             };
         };
 
-        BlackRoot::IO::IFileSource            *FileSource;
+        BlackRoot::IO::IFileSource            *FileSource, *PersistFileSource;
+        Monitor::IChangeNotifier              *Notifier;
         
         std::atomic<InternalID>               NextID;
 
         std::atomic<State::Type>              CurrentState, TargetState;
         std::thread                           UpdateThread;
 
+            // Stats and directory walks are spread over these
+        Monitor::ScanPool                     Scanner;
+        std::size_t                           ScanThreads;
+
+            // What a suspect path looks like on disk, found in parallel and
+            // applied afterwards
+        struct PathScan {
+            InternalID          ID;
+            Monitor::Path       Path;
+            TimePoint           LastUpdate;
+
+            bool                MaySkip;
+            bool                Exists, Changed, Hashed, Skipped, Failed;
+            BlackRoot::IO::FileTime     WriteTime;
+            Monitor::FileStamp  Stamp;
+            uint64              Hash;
+        };
+
+            // Suspect paths are looked up a directory at a time
+        struct DirectoryScan {
+            Monitor::Path               Directory;
+            std::vector<std::size_t>    Scans;
+
+            bool                        HasPreviousTime, HasWriteTime;
+            BlackRoot::IO::FileTime     PreviousTime, WriteTime;
+        };
+
+            // Opt-in: directories that have not had entries added, removed or
+            // renamed since last time are not looked at; only safe where
+            // files are replaced rather than written in place. Only paths
+            // that are suspect because the notifier could not say what
+            // changed are skipped; whatever it named is always looked at
+        bool                                  SkipUnchangedDirectories;
+        std::unordered_map<std::string, BlackRoot::IO::FileTime> DirectoryWriteTimes;
+        std::unordered_set<InternalID>        PolledPaths;
+
         std::map<InternalID, MonPath>         MonitoredPaths;
         std::map<InternalID, MonWild>         MonitoredWildcards;
         std::map<InternalID, HubProp>         HubProperties;
         std::map<InternalID, PipeWild>        PipeWildcards;
         std::map<InternalID, PipeProp>        PipeProperties;
 
-        std::vector<InternalID>               SuspectPaths, FutureSuspectPaths;
-        std::vector<InternalID>               SuspectWildcards, FutureSuspectWildcards;
-        std::vector<InternalID>               DirtyHubs, FutureDirtyHubs, PotentiallyOrphanedHubs, OrphanedDirtyHubs;
-        std::vector<InternalID>               DirtyPipes, FutureDirtyPipes, OrphanedDirtyPipes;
-        std::vector<InternalID>               DirtyPipeWildcards, FutureDirtyPipeWildcards;
-        std::vector<InternalID>               OutboxPipes, PendingPipes, InboxPipes;
+            // Lookups for the maps above; paths are interned by their string,
+            // everything else by a fingerprint of what 'EqualsAbstractly' compares
+        using PathIndex         = std::unordered_map<std::string, InternalID>;
+        using FingerprintIndex  = std::unordered_multimap<Fingerprint, InternalID>;
+
+        PathIndex                             MonitoredPathIndex;
+        PathIndex                             MonitoredWildcardIndex;
+        FingerprintIndex                      HubIndex;
+        FingerprintIndex                      PipeWildcardIndex;
+        FingerprintIndex                      PipeIndex;
+
+            // Reverse edges of 'PathDependencies', 'HubDependency' and 'WildcardDependency';
+            // only change those through the functions below so these stay in sync
+        using ReverseIndex      = std::unordered_map<InternalID, std::unordered_set<InternalID>>;
+
+        ReverseIndex                          PathHubUsers, PathPipeUsers;
+        ReverseIndex                          HubChildHubs, HubChildPipes, HubChildPipeWildcards;
+        ReverseIndex                          WildcardPipeWildcards;
+
+        Monitor::IDQueue                      SuspectPaths, FutureSuspectPaths;
+        Monitor::IDQueue                      SuspectWildcards, FutureSuspectWildcards;
+        Monitor::IDQueue                      DirtyHubs, FutureDirtyHubs, PotentiallyOrphanedHubs, OrphanedDirtyHubs;
+        Monitor::IDQueue                      DirtyPipes, FutureDirtyPipes, OrphanedDirtyPipes;
+        Monitor::IDQueue                      DirtyPipeWildcards, FutureDirtyPipeWildcards;
+        Monitor::IDQueue                      OutboxPipes, PendingPipes;
+
+            // Paths and pipes that may have changed since we last journaled them,
+            // and what the journal currently holds; removed paths only leave
+            // their string behind, so that we can still journal the removal
+        Monitor::IDQueue                      PersistPaths, PersistPipes;
+        std::unordered_map<InternalID, std::string> PersistedPaths;
+        std::unordered_set<InternalID>        PersistedPipes;
+        uint64                                PersistGeneration;
+        std::size_t                           JournalRecordCount, JournalValidLength;
+
+            // All of the above is owned by the update thread; other threads only
+            // get to touch the hand-over points below, each with its own mutex
+
+        std::mutex                            MxBaseHubFiles;
+        std::vector<Monitor::Path>            PendingBaseHubFiles;
+
+        std::mutex                            MxTrackedInformation;
+        std::shared_ptr<const JSON>           TrackedInformation;
+        std::atomic<bool>                     TrackedInformationRequested;
+        bool                                  PendingTrackedChanges;
+        std::chrono::steady_clock::time_point LastTrackedPublish;
+
+            // Work for the persistence thread, done strictly in order; a job
+            // that fails is kept, with everything after it, and retried
+        struct PersistJob {
+            bool            Compact, ExportJSON;
+            uint64          Generation;
+            std::string     Records, Snapshot;
+            JSON            Export;
+        };
 
-        std::mutex                            MutexAccessFiles;
+        std::thread                           PersistThread;
+        std::mutex                            MxPersist;
+        std::condition_variable               CvPersist;
+        std::deque<PersistJob>                PersistJobs;
+        bool                                  PersistStop;
+        Monitor::JournalWriter                Journal;
 
         InternalID                            OriginalHubDependancy;
         
-        std::atomic<uint32>                   WranglerResultCount;
-        std::mutex                            MxWranglerResults;
-        std::vector<WranglerTaskResult>       WranglerResults;
+        Monitor::MPSCQueue<WranglerTaskResult> WranglerResults;
 
         Pipeline::IWrangler                   *Wrangler;
 
         bool                                  PendingSaveChanges;
         
         Monitor::Path                         PersistentDirectory;
+        bool                                  ExportPersistentJSON;
+        bool                                  UseContentHashes;
         Monitor::Path                         InfoReferenceDirectory;
         
         void    UpdateCycle();
+        void    WaitForChanges();
+        void    UpdateBaseHubFiles();
         void    UpdateSuspectWildcards();
         void    UpdateSuspectWildcard(InternalID);
         void    UpdateSuspectPaths();
-        void    UpdateSuspectPath(InternalID);
+        void    ScanSuspectDirectory(DirectoryScan &, std::vector<PathScan> &);
+        void    ApplySuspectPath(PathScan &);
         void    UpdateDirtyHubs();
         void    UpdateDirtyHub(InternalID);
         void    UpdateDirtyPipeWildcards();
@@ -170,13 +337,22 @@ namespace Monitor {
         void    CleanupOrphanedHubs();
         void    CleanupOrphanedPipes();
 
-        void    ProcessHubGroup(InternalID, const Monitor::ProcessProperties prop, Monitor::JSON group);
+            // One reading of a hub file, compared entry by entry to the last
+        struct HubEvaluation {
+            HubProp::EntryMap                   Previous, Current;
+            std::unordered_set<InternalID>      Hubs, Pipes, PipeWildcards;
+        };
+
+        void    ProcessHubGroup(InternalID, const Monitor::ProcessProperties prop, Monitor::JSON group, HubEvaluation &);
+        bool    KeepHubEntry(InternalID, const std::string & key, HubEvaluation &);
+        void    OrphanUnusedHubDependants(InternalID, HubEvaluation &);
 
         void    HandleThreadException(BlackRoot::Debug::Exception *);
 
         bool    ShouldInterrupt();
         Count   GetActiveDirtyHubCount();
         Count   GetActiveDirtyPipeCount();
+        JSON    GetQueueDepths();
 
         InternalID    GetNewID();
         
@@ -186,6 +362,17 @@ namespace Monitor {
         InternalID    FindOrAddPipe(PipeProp);
         InternalID    FindOrAddPipeWildcards(PipeWild);
 
+        void          RemoveMonitoredPath(InternalID);
+        void          RemoveHub(InternalID);
+
+        void     AddHubPathDependency(InternalID, InternalID path);
+        void     AddPipePathDependency(InternalID, InternalID path);
+        void     ClearHubPathDependencies(InternalID);
+        void     ClearPipePathDependencies(InternalID);
+        void     SetHubHubDependency(InternalID, InternalID hub);
+        void     SetPipeHubDependency(InternalID, InternalID hub);
+        void     SetPipeWildcardsHubDependency(InternalID, InternalID hub);
+
         void     MakeUsersOfPathDirty(InternalID);
         void     MakeUsersOfWildcardDirty(InternalID);
         void     MakeDependantsOnHubOrphan(InternalID);
@@ -196,16 +383,36 @@ namespace Monitor {
         void     HandleHubFileError(InternalID, BlackRoot::Debug::Exception*);
         void     HandleWrangledPipeError(InternalID, BlackRoot::Debug::Exception*);
 
-        std::string   SimpleFormatHub(HubProp);
+        std::string   SimpleFormatHub(const HubProp &);
         std::string   SimpleFormatPipe(PipeProp);
         Monitor::Path SimpleFormatPath(Monitor::Path);
+        Monitor::Path GetWildcardBaseDirectory(const std::string);
         
         void    LoadFromPersistent();
         void    SaveToPersistent();
+        void    CompactPersistent();
+        void    QueuePersistJob(PersistJob &&);
+        void    BeginPersistThread();
+        void    EndPersistThread();
+        void    PersistThreadLoop();
+        bool    WritePersistJob(PersistJob &);
+        bool    WritePersistentFile(const std::string name, const std::string & contents);
+
+        bool    IsPipePersistable(InternalID);
+        void    FillJournalPipe(InternalID, Monitor::JournalPipe &, bool withPaths);
+        void    MarkPathForPersist(InternalID);
+        void    MarkPipeForPersist(InternalID);
+
+        JSON    BuildTrackedInformation();
+        void    PublishTrackedInformation();
 
         bool    FileTimeEqualsWithEpsilon(TimePoint, TimePoint);
+        bool    UpdateContentHash(MonPath &, const PathScan &);
+
+        using DurationMemo = std::unordered_map<InternalID, std::chrono::milliseconds>;
+        std::chrono::milliseconds EstimateDownstreamDuration(InternalID, DurationMemo &, int depth, bool & cutOff);
         
-        void    AsynchReceiveTaskResult(const WranglerTaskResult&);
+        void    AsynchReceiveTaskResult(WranglerTaskResult&&);
 
     public:
         FileChangeMonitor();
@@ -215,6 +422,10 @@ namespace Monitor {
         bool    PathContainsWildcards(const std::string);
         
         void    SetPersistentDirectory(const BlackRoot::IO::FilePath);
+        void    SetPersistentJSONExport(bool);
+        void    SetContentHashing(bool);
+        void    SetScanThreads(std::size_t);
+        void    SetDirectorySkipping(bool);
         void    SetReferenceDirectory(const BlackRoot::IO::FilePath);
 
         void    AddBaseHubFile(const BlackRoot::IO::FilePath);
@@ -0,0 +1,432 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include <algorithm>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include "BlackRoot/Pubc/Assert.h"
+#include "BlackRoot/Pubc/Threaded IO Stream.h"
+
+#include "HephaestusBase/Pubc/File Change Notifier.h"
+
+using namespace Hephaestus::Pipeline::Monitor;
+
+namespace fs = std::experimental::filesystem;
+
+    //  Notification
+    // --------------------
+
+void ChangeNotification::SetDefault()
+{
+    this->Paths.resize(0);
+    this->Wildcards.resize(0);
+    this->AllSuspect = false;
+}
+
+    //  Polling
+    // --------------------
+
+PollingChangeNotifier::PollingChangeNotifier(Duration interval)
+{
+    this->Interval      = interval;
+    this->LastFullPoll  = TimePoint{};
+    this->WakeRequested = false;
+}
+
+void PollingChangeNotifier::WatchPath(InternalID, const Path)
+{
+}
+
+void PollingChangeNotifier::WatchWildcard(InternalID, const Path)
+{
+}
+
+void PollingChangeNotifier::Unwatch(InternalID)
+{
+}
+
+void PollingChangeNotifier::WaitForChanges(ChangeNotification & notification, Duration maxWait)
+{
+    std::unique_lock<std::mutex> lk(this->MxWake);
+    this->CvWake.wait_for(lk, std::min(maxWait, this->Interval), [&]{ return this->WakeRequested; });
+    this->WakeRequested = false;
+    lk.unlock();
+
+        // We may have been woken early; only claim everything is suspect
+        // once a full interval has passed, or we would stat far too often
+    auto now = std::chrono::steady_clock::now();
+    if (now - this->LastFullPoll >= this->Interval) {
+        notification.AllSuspect = true;
+        this->LastFullPoll = now;
+    }
+}
+
+void PollingChangeNotifier::Wake()
+{
+    std::unique_lock<std::mutex> lk(this->MxWake);
+    this->WakeRequested = true;
+    lk.unlock();
+
+    this->CvWake.notify_one();
+}
+
+    //  Inotify
+    // --------------------
+
+#ifdef __linux__
+
+namespace {
+    const uint32_t InotifyMask = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                                 IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+}
+
+InotifyChangeNotifier::InotifyChangeNotifier(Duration pollInterval, Duration maxPollBackoff)
+{
+    this->NotifyFD          = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    this->WakeFD            = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    this->PollInterval      = pollInterval;
+    this->MaxPollBackoff    = std::max(maxPollBackoff, pollInterval);
+    this->LastPoll          = TimePoint{};
+}
+
+InotifyChangeNotifier::~InotifyChangeNotifier()
+{
+    if (this->NotifyFD >= 0) close(this->NotifyFD);
+    if (this->WakeFD >= 0)   close(this->WakeFD);
+}
+
+bool InotifyChangeNotifier::IsValid() const
+{
+    return this->NotifyFD >= 0 && this->WakeFD >= 0;
+}
+
+int InotifyChangeNotifier::AddDirectoryWatch(const std::string dir)
+{
+    auto found = this->WatchByDirectory.find(dir);
+    if (found != this->WatchByDirectory.end())
+        return found->second;
+
+        // This fails for missing directories, and when we run out of
+        // watches (ENOSPC); either way the caller falls back to polling
+    int wd = inotify_add_watch(this->NotifyFD, dir.c_str(), InotifyMask | IN_ONLYDIR);
+    if (wd < 0)
+        return -1;
+
+    auto & watch = this->Watches[wd];
+    watch.Directory = dir;
+    this->WatchByDirectory[dir] = wd;
+
+    return wd;
+}
+
+void InotifyChangeNotifier::RemoveDirectoryWatchIfUnused(int wd)
+{
+    auto it = this->Watches.find(wd);
+    if (it == this->Watches.end())
+        return;
+    if (it->second.PathsByName.size() > 0 || it->second.Wildcards.size() > 0)
+        return;
+
+    inotify_rm_watch(this->NotifyFD, wd);
+    this->WatchByDirectory.erase(it->second.Directory);
+    this->Watches.erase(it);
+}
+
+bool InotifyChangeNotifier::TryWatchPath(InternalID id, const Path path)
+{
+    int wd = this->AddDirectoryWatch(path.parent_path().string());
+    if (wd < 0)
+        return false;
+
+    std::string name = path.filename().string();
+    this->Watches[wd].PathsByName[name].push_back(id);
+    this->PathWatches[id] = { wd, name };
+
+    return true;
+}
+
+bool InotifyChangeNotifier::TryWatchWildcardTree(InternalID id, const Path dir)
+{
+    auto & list = this->WildcardWatches[id];
+
+    int wd = this->AddDirectoryWatch(dir.string());
+    if (wd < 0)
+        return false;
+    if (this->Watches[wd].Wildcards.insert(id).second) {
+        list.push_back(wd);
+    }
+
+        // A wildcard can match anywhere below its base directory, so
+        // every subdirectory needs its own watch
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(dir, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        if (!fs::is_directory(it->status()))
+            continue;
+
+        int subWd = this->AddDirectoryWatch(it->path().string());
+        if (subWd < 0)
+            return false;
+        if (this->Watches[subWd].Wildcards.insert(id).second) {
+            list.push_back(subWd);
+        }
+    }
+
+    return true;
+}
+
+void InotifyChangeNotifier::AddUnwatchedPath(InternalID id, const Path path)
+{
+    this->UnwatchedPaths[id] = { path, TimePoint{}, this->PollInterval };
+}
+
+void InotifyChangeNotifier::AddUnwatchedWildcard(InternalID id, const Path dir)
+{
+        // A single wildcard can lose several directories below its base,
+        // so each is kept as its own entry
+    auto range = this->UnwatchedWildcards.equal_range(id);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second.Location == dir)
+            return;
+    }
+    this->UnwatchedWildcards.emplace(id, UnwatchedEntry{ dir, TimePoint{}, this->PollInterval });
+}
+
+void InotifyChangeNotifier::WatchPath(InternalID id, const Path path)
+{
+    if (this->TryWatchPath(id, path))
+        return;
+    this->AddUnwatchedPath(id, path);
+}
+
+void InotifyChangeNotifier::WatchWildcard(InternalID id, const Path dir)
+{
+    this->WildcardDirectories[id] = dir.string();
+
+    if (this->TryWatchWildcardTree(id, dir))
+        return;
+    this->AddUnwatchedWildcard(id, dir);
+}
+
+void InotifyChangeNotifier::Unwatch(InternalID id)
+{
+    this->UnwatchedPaths.erase(id);
+    this->UnwatchedWildcards.erase(id);
+    this->WildcardDirectories.erase(id);
+
+    auto pathIt = this->PathWatches.find(id);
+    if (pathIt != this->PathWatches.end()) {
+        auto wd = pathIt->second.Descriptor;
+        auto watchIt = this->Watches.find(wd);
+        if (watchIt != this->Watches.end()) {
+            auto & names = watchIt->second.PathsByName;
+            auto nameIt = names.find(pathIt->second.Name);
+            if (nameIt != names.end()) {
+                auto & ids = nameIt->second;
+                ids.erase(std::remove(ids.begin(), ids.end(), id), ids.end());
+                if (ids.size() == 0) {
+                    names.erase(nameIt);
+                }
+            }
+        }
+        this->PathWatches.erase(pathIt);
+        this->RemoveDirectoryWatchIfUnused(wd);
+    }
+
+    auto wildIt = this->WildcardWatches.find(id);
+    if (wildIt != this->WildcardWatches.end()) {
+        for (auto wd : wildIt->second) {
+            auto watchIt = this->Watches.find(wd);
+            if (watchIt == this->Watches.end())
+                continue;
+            watchIt->second.Wildcards.erase(id);
+            this->RemoveDirectoryWatchIfUnused(wd);
+        }
+        this->WildcardWatches.erase(wildIt);
+    }
+}
+
+void InotifyChangeNotifier::HandleLostWatch(int wd, bool removed, ChangeNotification & notification)
+{
+    auto it = this->Watches.find(wd);
+    if (it == this->Watches.end())
+        return;
+    auto & watch = it->second;
+
+        // A moved directory is still watched where it went; unless the
+        // kernel already dropped the watch, we have to, or it leaks
+    if (!removed) {
+        inotify_rm_watch(this->NotifyFD, wd);
+    }
+
+        // The directory itself went away; everything in it is now suspect
+        // and can only be polled until the directory comes back
+    for (auto & name : watch.PathsByName) {
+        for (auto id : name.second) {
+            notification.Paths.push_back(id);
+            this->AddUnwatchedPath(id, Path(watch.Directory) / name.first);
+            this->PathWatches.erase(id);
+        }
+    }
+    for (auto id : watch.Wildcards) {
+        notification.Wildcards.push_back(id);
+
+            // If this was the base directory we need to poll until it returns
+        auto baseIt = this->WildcardDirectories.find(id);
+        if (baseIt != this->WildcardDirectories.end() && baseIt->second == watch.Directory) {
+            this->AddUnwatchedWildcard(id, baseIt->second);
+        }
+    }
+
+    this->WatchByDirectory.erase(watch.Directory);
+    this->Watches.erase(it);
+}
+
+void InotifyChangeNotifier::PollUnwatched(ChangeNotification & notification)
+{
+    auto now = std::chrono::steady_clock::now();
+    if (now - this->LastPoll < this->PollInterval)
+        return;
+    this->LastPoll = now;
+
+        // Anything we could not watch is polled once its backoff expires; we
+        // also try to watch it again, as its directory may have appeared in
+        // the meantime. Every failed attempt doubles the wait for that entry
+    auto backOff = [&](UnwatchedEntry & entry) {
+        entry.Backoff  = std::min(entry.Backoff * 2, this->MaxPollBackoff);
+        entry.NextPoll = now + entry.Backoff;
+    };
+
+    for (auto it = this->UnwatchedPaths.begin(); it != this->UnwatchedPaths.end(); ) {
+        if (now < it->second.NextPoll) {
+            ++it;
+            continue;
+        }
+        notification.Paths.push_back(it->first);
+        if (this->TryWatchPath(it->first, it->second.Location)) {
+            it = this->UnwatchedPaths.erase(it);
+            continue;
+        }
+        backOff(it->second);
+        ++it;
+    }
+    for (auto it = this->UnwatchedWildcards.begin(); it != this->UnwatchedWildcards.end(); ) {
+        if (now < it->second.NextPoll) {
+            ++it;
+            continue;
+        }
+        notification.Wildcards.push_back(it->first);
+        if (this->TryWatchWildcardTree(it->first, it->second.Location)) {
+            it = this->UnwatchedWildcards.erase(it);
+            continue;
+        }
+        backOff(it->second);
+        ++it;
+    }
+}
+
+void InotifyChangeNotifier::ReadEvents(ChangeNotification & notification)
+{
+    alignas(inotify_event) char buffer[16 * 1024];
+
+    while (true) {
+        auto length = read(this->NotifyFD, buffer, sizeof(buffer));
+        if (length <= 0)
+            break;
+
+        for (char * ptr = buffer; ptr < buffer + length; ) {
+            auto * event = reinterpret_cast<inotify_event*>(ptr);
+            ptr += sizeof(inotify_event) + event->len;
+
+                // The kernel dropped events; we no longer know what changed
+            if (event->mask & IN_Q_OVERFLOW) {
+                notification.AllSuspect = true;
+                continue;
+            }
+            if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+                this->HandleLostWatch(event->wd, (event->mask & IN_IGNORED) != 0, notification);
+                continue;
+            }
+
+            auto watchIt = this->Watches.find(event->wd);
+            if (watchIt == this->Watches.end())
+                continue;
+            auto & watch = watchIt->second;
+
+            if (event->len > 0) {
+                auto nameIt = watch.PathsByName.find(event->name);
+                if (nameIt != watch.PathsByName.end()) {
+                    notification.Paths.insert(notification.Paths.end(), nameIt->second.begin(), nameIt->second.end());
+                }
+            }
+
+            if (watch.Wildcards.size() == 0)
+                continue;
+
+            notification.Wildcards.insert(notification.Wildcards.end(), watch.Wildcards.begin(), watch.Wildcards.end());
+
+                // New subdirectories below a wildcard need watching as well
+            if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO)) && event->len > 0) {
+                auto subDir = Path(watch.Directory) / event->name;
+                std::vector<InternalID> wildcards(watch.Wildcards.begin(), watch.Wildcards.end());
+                for (auto id : wildcards) {
+                    if (!this->TryWatchWildcardTree(id, subDir)) {
+                        this->AddUnwatchedWildcard(id, subDir);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void InotifyChangeNotifier::WaitForChanges(ChangeNotification & notification, Duration maxWait)
+{
+    pollfd fds[2];
+    fds[0].fd     = this->NotifyFD;
+    fds[0].events = POLLIN;
+    fds[1].fd     = this->WakeFD;
+    fds[1].events = POLLIN;
+
+    int timeout = (int)std::min(maxWait, this->PollInterval).count();
+
+    if (poll(fds, 2, timeout) > 0) {
+        if (fds[1].revents & POLLIN) {
+            uint64_t value;
+            (void)read(this->WakeFD, &value, sizeof(value));
+        }
+        if (fds[0].revents & POLLIN) {
+            this->ReadEvents(notification);
+        }
+    }
+
+    this->PollUnwatched(notification);
+}
+
+void InotifyChangeNotifier::Wake()
+{
+    uint64_t value = 1;
+    (void)write(this->WakeFD, &value, sizeof(value));
+}
+
+#endif
+
+    //  Creation
+    // --------------------
+
+IChangeNotifier * Hephaestus::Pipeline::Monitor::CreateChangeNotifier()
+{
+#ifdef __linux__
+    auto * inotify = new InotifyChangeNotifier();
+    if (inotify->IsValid())
+        return inotify;
+    delete inotify;
+#endif
+
+    return new PollingChangeNotifier();
+}
\ No newline at end of file
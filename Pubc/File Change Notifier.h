@@ -0,0 +1,154 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+/* {quality} This is very much a sketch
+ */
+
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "BlackRoot/Pubc/Number Types.h"
+#include "BlackRoot/Pubc/Files Types.h"
+
+namespace Hephaestus {
+namespace Pipeline {
+namespace Monitor {
+
+    using InternalID = uint32;
+
+        // What the notifier found out since we last asked; if the backend
+        // cannot tell us what changed (polling, or an event overflow) it
+        // simply claims everything may have changed
+    struct ChangeNotification {
+        std::vector<InternalID>     Paths, Wildcards;
+        bool                        AllSuspect;
+
+        void    SetDefault();
+    };
+
+        // A notifier is told which paths and wildcard directories the monitor
+        // cares about, and blocks until any of them might have changed. All
+        // functions but 'Wake' are only called from the monitor's update thread.
+    class IChangeNotifier {
+    public:
+        using Path      = BlackRoot::IO::FilePath;
+        using Duration  = std::chrono::milliseconds;
+
+        virtual ~IChangeNotifier() { ; }
+
+        virtual void    WatchPath(InternalID, const Path) = 0;
+        virtual void    WatchWildcard(InternalID, const Path directory) = 0;
+        virtual void    Unwatch(InternalID) = 0;
+
+        virtual void    WaitForChanges(ChangeNotification &, Duration maxWait) = 0;
+        virtual void    Wake() = 0;
+
+        virtual const char * GetName() const = 0;
+    };
+
+        // The fallback; it knows nothing, and after every interval claims
+        // all paths and wildcards are suspect
+    class PollingChangeNotifier : public IChangeNotifier {
+    protected:
+        using TimePoint = std::chrono::steady_clock::time_point;
+
+        Duration                    Interval;
+        TimePoint                   LastFullPoll;
+
+        std::mutex                  MxWake;
+        std::condition_variable     CvWake;
+        bool                        WakeRequested;
+
+    public:
+        PollingChangeNotifier(Duration interval = std::chrono::milliseconds(250));
+
+        void    WatchPath(InternalID, const Path) override;
+        void    WatchWildcard(InternalID, const Path directory) override;
+        void    Unwatch(InternalID) override;
+
+        void    WaitForChanges(ChangeNotification &, Duration maxWait) override;
+        void    Wake() override;
+
+        const char * GetName() const override { return "polling"; }
+    };
+
+#ifdef __linux__
+        // Uses inotify to only report paths and wildcards the kernel tells us
+        // have changed. Paths we cannot watch (missing directories, running out
+        // of watches) are quietly polled instead; each of those backs off on
+        // its own from the poll interval up to the maximum backoff, so a
+        // missing tree is not walked again every interval.
+    class InotifyChangeNotifier : public IChangeNotifier {
+    protected:
+        using TimePoint = std::chrono::steady_clock::time_point;
+
+        struct DirectoryWatch {
+            std::string                                         Directory;
+            std::unordered_map<std::string, std::vector<InternalID>> PathsByName;
+            std::unordered_set<InternalID>                      Wildcards;
+        };
+        struct PathWatch {
+            int             Descriptor;
+            std::string     Name;
+        };
+        struct UnwatchedEntry {
+            Path            Location;
+            TimePoint       NextPoll;
+            Duration        Backoff;
+        };
+
+        int     NotifyFD, WakeFD;
+
+        std::unordered_map<int, DirectoryWatch>     Watches;
+        std::unordered_map<std::string, int>        WatchByDirectory;
+        std::unordered_map<InternalID, PathWatch>   PathWatches;
+        std::unordered_map<InternalID, std::vector<int>>    WildcardWatches;
+        std::unordered_map<InternalID, UnwatchedEntry>      UnwatchedPaths;
+        std::unordered_multimap<InternalID, UnwatchedEntry> UnwatchedWildcards;
+        std::unordered_map<InternalID, std::string> WildcardDirectories;
+
+        Duration    PollInterval, MaxPollBackoff;
+        TimePoint   LastPoll;
+
+        int     AddDirectoryWatch(const std::string);
+        void    RemoveDirectoryWatchIfUnused(int);
+        bool    TryWatchPath(InternalID, const Path);
+        bool    TryWatchWildcardTree(InternalID, const Path);
+        void    AddUnwatchedPath(InternalID, const Path);
+        void    AddUnwatchedWildcard(InternalID, const Path);
+        void    HandleLostWatch(int, bool removed, ChangeNotification &);
+        void    PollUnwatched(ChangeNotification &);
+        void    ReadEvents(ChangeNotification &);
+
+    public:
+        InotifyChangeNotifier(Duration pollInterval = std::chrono::milliseconds(250),
+                              Duration maxPollBackoff = std::chrono::milliseconds(4000));
+        ~InotifyChangeNotifier();
+
+        bool    IsValid() const;
+
+        void    WatchPath(InternalID, const Path) override;
+        void    WatchWildcard(InternalID, const Path directory) override;
+        void    Unwatch(InternalID) override;
+
+        void    WaitForChanges(ChangeNotification &, Duration maxWait) override;
+        void    Wake() override;
+
+        const char * GetName() const override { return "inotify"; }
+    };
+#endif
+
+        // Creates the best notifier for this platform, falling back to polling
+    IChangeNotifier * CreateChangeNotifier();
+
+}
+}
+}
\ No newline at end of file
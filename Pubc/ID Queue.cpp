@@ -0,0 +1,107 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include <algorithm>
+
+#include "HephaestusBase/Pubc/ID Queue.h"
+
+using namespace Hephaestus::Pipeline::Monitor;
+
+    //  Setup
+    // --------------------
+
+IDQueue::IDQueue()
+{
+    this->Count = 0;
+}
+
+    //  Access
+    // --------------------
+
+bool IDQueue::Push(InternalID id)
+{
+    if (id >= this->Members.size()) {
+        this->Members.resize(std::max<std::size_t>(id + 1, this->Members.size() * 2), false);
+    }
+    if (this->Members[id])
+        return false;
+
+    this->Members[id] = true;
+    this->Queue.push_back(id);
+    this->Count += 1;
+
+        // Lazily removed IDs pile up if we are never drained
+    if (this->Queue.size() > 64 + 2 * this->Count) {
+        this->Compact();
+    }
+
+    return true;
+}
+
+bool IDQueue::Pop(InternalID & outID)
+{
+    while (this->Queue.size() > 0) {
+        auto id = this->Queue.front();
+        this->Queue.pop_front();
+
+            // Removed (or already popped) IDs are skipped
+        if (!this->Members[id])
+            continue;
+
+        this->Members[id] = false;
+        this->Count -= 1;
+
+        outID = id;
+        return true;
+    }
+    return false;
+}
+
+bool IDQueue::Remove(InternalID id)
+{
+    if (!this->Contains(id))
+        return false;
+
+    this->Members[id] = false;
+    this->Count -= 1;
+
+    return true;
+}
+
+bool IDQueue::Contains(InternalID id) const
+{
+    return id < this->Members.size() && this->Members[id];
+}
+
+void IDQueue::MoveFrom(IDQueue & other)
+{
+    InternalID id;
+    while (other.Pop(id)) {
+        this->Push(id);
+    }
+}
+
+void IDQueue::Clear()
+{
+    this->Queue.clear();
+    this->Members.assign(this->Members.size(), false);
+    this->Count = 0;
+}
+
+void IDQueue::Compact()
+{
+        // A removed ID may have been pushed again, so the deque can hold
+        // it twice; only the first occurrence of a member is kept
+    std::vector<bool> kept(this->Members.size(), false);
+    std::deque<InternalID> queue;
+
+    for (auto id : this->Queue) {
+        if (!this->Members[id] || kept[id])
+            continue;
+        kept[id] = true;
+        queue.push_back(id);
+    }
+
+    this->Queue.swap(queue);
+}
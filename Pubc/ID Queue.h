@@ -0,0 +1,54 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <deque>
+#include <vector>
+
+#include "BlackRoot/Pubc/Number Types.h"
+
+namespace Hephaestus {
+namespace Pipeline {
+namespace Monitor {
+
+    using InternalID = uint32;
+
+        // First-in first-out queue of IDs in which every ID is present at
+        // most once; membership is a bitset indexed by ID, so pushing, popping,
+        // removing and checking are all O(1). Removal is lazy: the ID stays
+        // in the deque and is skipped when it comes up.
+    class IDQueue {
+    protected:
+        std::deque<InternalID>  Queue;
+        std::vector<bool>       Members;
+        std::size_t             Count;
+
+        void    Compact();
+
+    public:
+        IDQueue();
+
+        bool    Push(InternalID);
+        bool    Pop(InternalID &);
+        bool    Remove(InternalID);
+        bool    Contains(InternalID) const;
+
+        void    MoveFrom(IDQueue &);
+        void    Clear();
+
+        std::size_t Size() const  { return this->Count; }
+        bool        Empty() const { return this->Count == 0; }
+
+        template<typename It>
+        void    Push(It begin, It end) {
+            for (; begin != end; ++begin) {
+                this->Push(*begin);
+            }
+        }
+    };
+
+}
+}
+}
@@ -0,0 +1,88 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+namespace Hephaestus {
+namespace Pipeline {
+namespace Monitor {
+
+        // Lock-free queue for any number of producers and a single consumer.
+        // Producers push onto an intrusive stack with a compare-exchange; the
+        // consumer takes the entire stack in one exchange and reverses it, so
+        // items come out in the order they were pushed. As the consumer never
+        // looks at a node that is still reachable by producers, there is no
+        // ABA problem to worry about.
+    template<typename T>
+    class MPSCQueue {
+    protected:
+        struct Node {
+            T       Value;
+            Node    *Next;
+        };
+
+        std::atomic<Node*>  Head;
+
+    public:
+        MPSCQueue() : Head(nullptr) { ; }
+        MPSCQueue(const MPSCQueue &) = delete;
+        MPSCQueue & operator=(const MPSCQueue &) = delete;
+
+        ~MPSCQueue() {
+            Node * node = this->Head.exchange(nullptr);
+            while (node) {
+                Node * next = node->Next;
+                delete node;
+                node = next;
+            }
+        }
+
+            // Safe to call from any thread
+        void Push(T && value) {
+            Node * node = new Node{ std::move(value), nullptr };
+            node->Next = this->Head.load(std::memory_order_relaxed);
+            while (!this->Head.compare_exchange_weak(node->Next, node, std::memory_order_release, std::memory_order_relaxed)) {
+                ;
+            }
+        }
+
+        bool Empty() const {
+            return this->Head.load(std::memory_order_relaxed) == nullptr;
+        }
+
+            // Only call from the consumer; moves everything pushed so far into
+            // the list in push order, and returns how many items were added
+        std::size_t DrainInto(std::vector<T> & out) {
+            Node * node = this->Head.exchange(nullptr, std::memory_order_acquire);
+            if (!node)
+                return 0;
+
+            Node * reversed = nullptr;
+            std::size_t count = 0;
+            while (node) {
+                Node * next = node->Next;
+                node->Next = reversed;
+                reversed   = node;
+                node       = next;
+                count     += 1;
+            }
+
+            out.reserve(out.size() + count);
+            while (reversed) {
+                Node * next = reversed->Next;
+                out.push_back(std::move(reversed->Value));
+                delete reversed;
+                reversed = next;
+            }
+
+            return count;
+        }
+    };
+
+}
+}
+}
\ No newline at end of file
@@ -0,0 +1,342 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include <iterator>
+#include <cstring>
+
+#include "BlackRoot/Pubc/Assert.h"
+#include "BlackRoot/Pubc/Exception.h"
+
+#include "HephaestusBase/Pubc/Monitor Journal.h"
+
+using namespace Hephaestus::Pipeline::Monitor;
+
+namespace fs = std::experimental::filesystem;
+
+namespace {
+    const char          JournalMagic[4]  = { 'H', 'P', 'J', 'L' };
+    const uint32        JournalVersion   = 4;
+    const std::size_t   JournalHeaderSize = 16;
+
+        // Everything is written little-endian, regardless of the machine
+    void PutU32(std::string & out, uint32 v) {
+        for (int i = 0; i < 4; i++) out.push_back(char((v >> (i * 8)) & 0xFF));
+    }
+    void PutU64(std::string & out, uint64 v) {
+        for (int i = 0; i < 8; i++) out.push_back(char((v >> (i * 8)) & 0xFF));
+    }
+    void PutString(std::string & out, const std::string & s) {
+        PutU32(out, uint32(s.length()));
+        out.append(s);
+    }
+
+    uint32 Checksum(const char * data, std::size_t length) {
+        uint32 hash = 2166136261u;
+        for (std::size_t i = 0; i < length; i++) {
+            hash ^= uint8(data[i]);
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    struct Reader {
+        const char  *Data;
+        std::size_t Length, Cursor;
+
+        bool GetU32(uint32 & v) {
+            if (this->Length - this->Cursor < 4) return false;
+            v = 0;
+            for (int i = 0; i < 4; i++) v |= uint32(uint8(this->Data[this->Cursor++])) << (i * 8);
+            return true;
+        }
+        bool GetU64(uint64 & v) {
+            if (this->Length - this->Cursor < 8) return false;
+            v = 0;
+            for (int i = 0; i < 8; i++) v |= uint64(uint8(this->Data[this->Cursor++])) << (i * 8);
+            return true;
+        }
+        bool GetString(std::string & s) {
+            uint32 len;
+            if (!this->GetU32(len)) return false;
+            if (this->Length - this->Cursor < len) return false;
+            s.assign(this->Data + this->Cursor, len);
+            this->Cursor += len;
+            return true;
+        }
+    };
+
+    bool DecodePayload(Reader & reader, JournalRecord & record) {
+        switch (record.Type) {
+        case JournalRecordType::PathSet: {
+            auto & state = record.PathState;
+            uint64 changed;
+            uint32 flags;
+            if (!reader.GetString(record.Path) || !reader.GetU64(changed) || !reader.GetU32(flags) ||
+                !reader.GetU64(state.Size) || !reader.GetU64(state.ContentHash)) return false;
+            state.Changed        = int64(changed);
+            state.HasContentHash = (flags & 1) != 0;
+            return true;
+        }
+        case JournalRecordType::PathRemoved:
+            return reader.GetString(record.Path);
+        case JournalRecordType::PipeSet:
+        case JournalRecordType::PipeRemoved: {
+            auto & pipe = record.Pipe;
+            if (!reader.GetString(pipe.Hub) || !reader.GetString(pipe.Tool) || !reader.GetString(pipe.PathIn) ||
+                !reader.GetString(pipe.PathOut) || !reader.GetString(pipe.Settings)) return false;
+            if (record.Type == JournalRecordType::PipeRemoved)
+                return true;
+
+            uint32 count;
+            if (!reader.GetU32(count)) return false;
+            pipe.Paths.resize(0);
+            for (uint32 i = 0; i < count; i++) {
+                std::string path;
+                if (!reader.GetString(path)) return false;
+                pipe.Paths.push_back(std::move(path));
+            }
+            return true;
+        }
+        }
+        return false;
+    }
+}
+
+    //  Records
+    // --------------------
+
+std::string JournalPipe::GetKey() const
+{
+        // Pipes are identified by what they do, never by what they read
+    std::string key;
+    key.reserve(this->Hub.length() + this->Tool.length() + this->PathIn.length() + this->PathOut.length() + this->Settings.length() + 4);
+    key.append(this->Hub).push_back('\0');
+    key.append(this->Tool).push_back('\0');
+    key.append(this->PathIn).push_back('\0');
+    key.append(this->PathOut).push_back('\0');
+    key.append(this->Settings);
+    return key;
+}
+
+void Hephaestus::Pipeline::Monitor::EncodeJournalRecord(std::string & out, const JournalRecord & record)
+{
+        // Reserve space for the length, which we only know afterwards
+    auto start = out.length();
+    PutU32(out, 0);
+    out.push_back(char(record.Type));
+
+    switch (record.Type) {
+    case JournalRecordType::PathSet:
+        PutString(out, record.Path);
+        PutU64(out, uint64(record.PathState.Changed));
+        PutU32(out, record.PathState.HasContentHash ? 1 : 0);
+        PutU64(out, record.PathState.Size);
+        PutU64(out, record.PathState.ContentHash);
+        break;
+    case JournalRecordType::PathRemoved:
+        PutString(out, record.Path);
+        break;
+    case JournalRecordType::PipeSet:
+    case JournalRecordType::PipeRemoved:
+        PutString(out, record.Pipe.Hub);
+        PutString(out, record.Pipe.Tool);
+        PutString(out, record.Pipe.PathIn);
+        PutString(out, record.Pipe.PathOut);
+        PutString(out, record.Pipe.Settings);
+        if (record.Type == JournalRecordType::PipeRemoved)
+            break;
+        PutU32(out, uint32(record.Pipe.Paths.size()));
+        for (auto & path : record.Pipe.Paths) {
+            PutString(out, path);
+        }
+        break;
+    }
+
+    auto length = uint32(out.length() - start - 4);
+    for (int i = 0; i < 4; i++) out[start + i] = char((length >> (i * 8)) & 0xFF);
+
+    PutU32(out, Checksum(out.data() + start + 4, length));
+}
+
+    //  State
+    // --------------------
+
+void PersistentState::SetDefault()
+{
+    this->Generation     = 0;
+    this->JournalRecords = 0;
+    this->Paths.clear();
+    this->Pipes.clear();
+    this->RemovedPaths.clear();
+    this->RemovedPipes.clear();
+}
+
+void PersistentState::Apply(const JournalRecord & record)
+{
+    switch (record.Type) {
+    case JournalRecordType::PathSet:
+        this->Paths[record.Path] = record.PathState;
+        this->RemovedPaths.erase(record.Path);
+        break;
+    case JournalRecordType::PathRemoved:
+        this->Paths.erase(record.Path);
+        this->RemovedPaths.insert(record.Path);
+        break;
+    case JournalRecordType::PipeSet: {
+        auto key = record.Pipe.GetKey();
+        this->RemovedPipes.erase(key);
+        this->Pipes[std::move(key)] = record.Pipe;
+        break;
+    }
+    case JournalRecordType::PipeRemoved: {
+        auto key = record.Pipe.GetKey();
+        this->Pipes.erase(key);
+        this->RemovedPipes.insert(std::move(key));
+        break;
+    }
+    }
+}
+
+    //  Replay
+    // --------------------
+
+std::size_t Hephaestus::Pipeline::Monitor::ReplayJournal(const BlackRoot::IO::FilePath path, PersistentState & state)
+{
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream)
+        return 0;
+
+    std::string contents((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+
+    Reader reader = { contents.data(), contents.length(), 0 };
+
+    if (contents.length() < JournalHeaderSize || 0 != std::memcmp(contents.data(), JournalMagic, 4))
+        return 0;
+    reader.Cursor = 4;
+
+    uint32 version;
+    uint64 generation;
+    reader.GetU32(version);
+    reader.GetU64(generation);
+
+        // A journal of another generation was already compacted into, or
+        // predates, the snapshot we have; either way it tells us nothing
+    if (version != JournalVersion || generation != state.Generation)
+        return 0;
+
+    std::size_t valid = reader.Cursor;
+
+    while (true) {
+        uint32 length, checksum;
+        if (!reader.GetU32(length) || length == 0)
+            break;
+        if (reader.Length - reader.Cursor < std::size_t(length) + 4)
+            break;
+
+        auto payloadStart = reader.Cursor;
+        reader.Cursor += length;
+        reader.GetU32(checksum);
+        if (checksum != Checksum(contents.data() + payloadStart, length))
+            break;
+
+        Reader payload = { contents.data(), payloadStart + length, payloadStart + 1 };
+        JournalRecord record;
+        record.Type = JournalRecordType(uint8(contents[payloadStart]));
+        if (!DecodePayload(payload, record) || payload.Cursor != payload.Length)
+            break;
+
+        state.Apply(record);
+        state.JournalRecords += 1;
+
+        valid = reader.Cursor;
+    }
+
+    return valid;
+}
+
+    //  Writer
+    // --------------------
+
+void JournalWriter::WriteHeader(uint64 generation)
+{
+    std::string header(JournalMagic, 4);
+    PutU32(header, JournalVersion);
+    PutU64(header, generation);
+    DbAssert(header.length() == JournalHeaderSize);
+
+    this->Append(header);
+}
+
+void JournalWriter::Open(const BlackRoot::IO::FilePath path, uint64 generation, std::size_t validLength)
+{
+    this->Close();
+    this->FilePath    = path;
+    this->Generation  = generation;
+    this->ValidLength = validLength;
+
+    if (validLength == 0) {
+        this->Reset(generation);
+        return;
+    }
+
+        // Cut off whatever half-written tail the last run left behind
+    std::error_code ec;
+    fs::resize_file(path, validLength, ec);
+    if (ec) {
+        this->Reset(generation);
+        return;
+    }
+
+    this->Stream.open(path, std::ios::binary | std::ios::out | std::ios::app);
+    if (!this->Stream) {
+        throw new BlackRoot::Debug::Exception("Cannot open monitor journal for appending", BRGenDbgInfo);
+    }
+}
+
+void JournalWriter::Reset(uint64 generation)
+{
+    this->Close();
+    this->Generation  = generation;
+    this->ValidLength = 0;
+
+    this->Stream.open(this->FilePath, std::ios::binary | std::ios::out | std::ios::trunc);
+    if (!this->Stream) {
+        throw new BlackRoot::Debug::Exception("Cannot create monitor journal", BRGenDbgInfo);
+    }
+
+    this->WriteHeader(generation);
+}
+
+void JournalWriter::Append(const std::string & records)
+{
+        // A failed append left the file closed at its last valid length
+    if (!this->Stream.is_open()) {
+        if (this->FilePath.empty()) {
+            throw new BlackRoot::Debug::Exception("Monitor journal is not open", BRGenDbgInfo);
+        }
+        this->Open(this->FilePath, this->Generation, this->ValidLength);
+    }
+
+    this->Stream.write(records.data(), records.length());
+    this->Stream.flush();
+
+    if (!this->Stream) {
+            // Whatever part made it to disk would end replay early, and hide
+            // every record appended after it
+        this->Close();
+        std::error_code ec;
+        fs::resize_file(this->FilePath, this->ValidLength, ec);
+        throw new BlackRoot::Debug::Exception("Cannot write to monitor journal", BRGenDbgInfo);
+    }
+
+    this->ValidLength += records.length();
+}
+
+void JournalWriter::Close()
+{
+    if (this->Stream.is_open()) {
+        this->Stream.close();
+    }
+    this->Stream.clear();
+}
\ No newline at end of file
@@ -0,0 +1,106 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+/* {quality} This is very much a sketch
+ */
+
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "BlackRoot/Pubc/Number Types.h"
+#include "BlackRoot/Pubc/Files Types.h"
+
+namespace Hephaestus {
+namespace Pipeline {
+namespace Monitor {
+
+        // The persistent state of the monitor is a snapshot plus an append-only
+        // journal of what changed since. Both carry a generation; a journal only
+        // applies to the snapshot with the same generation, so when compaction
+        // writes a new snapshot the old journal is ignored even if we crash
+        // before it is reset.
+        //
+        // A journal starts with a header ('HPJL', version, generation); every
+        // record after that is
+        //   uint32 length | uint8 type | payload (length - 1 bytes) | uint32 checksum
+        // where the checksum covers type and payload. Replay stops at the first
+        // record that is cut off or does not match its checksum; that is where
+        // we crashed mid-write, and the writer truncates the file to that point.
+
+    enum class JournalRecordType : uint8 {
+        PathSet     = 1,
+        PathRemoved = 2,
+        PipeSet     = 3,
+        PipeRemoved = 4,
+    };
+
+        // The content hash is only there if the monitor hashes contents
+    struct JournalPathState {
+        int64                       Changed;
+        uint64                      Size, ContentHash;
+        bool                        HasContentHash;
+    };
+
+        // Pipes that only differ by the hub that made them are kept apart
+    struct JournalPipe {
+        std::string                 Hub, Tool, PathIn, PathOut, Settings;
+        std::vector<std::string>    Paths;
+
+        std::string GetKey() const;
+    };
+
+    struct JournalRecord {
+        JournalRecordType   Type;
+        std::string         Path;
+        JournalPathState    PathState;
+        JournalPipe         Pipe;
+    };
+
+        // Persistent state in plain strings. When loading a binary snapshot this
+        // only holds what the journal changed on top of it, so removals are
+        // remembered as well; they hide the entry in the snapshot
+    struct PersistentState {
+        uint64                                          Generation;
+        std::size_t                                     JournalRecords;
+        std::unordered_map<std::string, JournalPathState> Paths;
+        std::unordered_map<std::string, JournalPipe>    Pipes;
+        std::unordered_set<std::string>                 RemovedPaths, RemovedPipes;
+
+        void    SetDefault();
+        void    Apply(const JournalRecord &);
+    };
+
+    void        EncodeJournalRecord(std::string & out, const JournalRecord &);
+
+        // Replays the journal into the state if it belongs to the generation of
+        // the state; returns the length of the valid part of the file, or 0 if
+        // the journal is missing or unusable
+    std::size_t ReplayJournal(const BlackRoot::IO::FilePath, PersistentState &);
+
+        // Only used from the persistence thread. An append that fails is cut
+        // off the file again, so the same records can simply be retried
+    class JournalWriter {
+    protected:
+        std::ofstream               Stream;
+        BlackRoot::IO::FilePath     FilePath;
+        uint64                      Generation;
+        std::size_t                 ValidLength;
+
+        void    WriteHeader(uint64 generation);
+
+    public:
+        void    Open(const BlackRoot::IO::FilePath, uint64 generation, std::size_t validLength);
+        void    Reset(uint64 generation);
+        void    Append(const std::string & records);
+        void    Close();
+    };
+
+}
+}
+}
\ No newline at end of file
@@ -0,0 +1,324 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "BlackRoot/Pubc/Assert.h"
+
+#include "HephaestusBase/Pubc/Monitor Snapshot.h"
+
+using namespace Hephaestus::Pipeline::Monitor;
+
+namespace {
+    const char      SnapshotMagic[4]  = { 'H', 'P', 'S', 'N' };
+    const uint32    SnapshotByteOrder = 0x01020304;
+    const uint32    SnapshotVersion   = 4;
+
+    std::size_t AlignUp(std::size_t v) {
+        return (v + 7) & ~std::size_t(7);
+    }
+
+    template<typename T>
+    void AppendSection(std::string & out, uint64 & at, const T * data, std::size_t count) {
+        out.resize(AlignUp(out.size()), '\0');
+        at = out.size();
+        out.append(reinterpret_cast<const char*>(data), count * sizeof(T));
+    }
+}
+
+    //  Builder
+    // --------------------
+
+SnapshotBuilder::SnapshotBuilder()
+{
+    this->StringOffsets.push_back(0);
+}
+
+uint32 SnapshotBuilder::AddString(const std::string & str)
+{
+    auto found = this->StringIndex.find(str);
+    if (found != this->StringIndex.end())
+        return found->second;
+
+    uint32 index = uint32(this->StringOffsets.size() - 1);
+    this->StringData.append(str);
+    this->StringOffsets.push_back(this->StringData.size());
+    this->StringIndex[str] = index;
+
+    return index;
+}
+
+uint32 SnapshotBuilder::AddPath(const std::string & path, const SnapshotPath & state)
+{
+    SnapshotPath rec = state;
+    rec.Path = this->AddString(path);
+
+    this->Paths.push_back(rec);
+    return uint32(this->Paths.size() - 1);
+}
+
+void SnapshotBuilder::AddPipe(const std::string & hub, const std::string & tool, const std::string & pathIn, const std::string & pathOut,
+                              const std::string & settings, const std::vector<uint32> & pathIndices)
+{
+    SnapshotPipe rec = {};
+    rec.Hub             = this->AddString(hub);
+    rec.Tool            = this->AddString(tool);
+    rec.PathIn          = this->AddString(pathIn);
+    rec.PathOut         = this->AddString(pathOut);
+    rec.Settings        = this->AddString(settings);
+    rec.FirstDependency = uint32(this->Dependencies.size());
+    rec.DependencyCount = uint32(pathIndices.size());
+
+    this->Dependencies.insert(this->Dependencies.end(), pathIndices.begin(), pathIndices.end());
+    this->Pipes.push_back(rec);
+}
+
+std::string SnapshotBuilder::Finish(uint64 generation)
+{
+    SnapshotHeader header = {};
+    std::memcpy(header.Magic, SnapshotMagic, 4);
+    header.ByteOrder       = SnapshotByteOrder;
+    header.Version         = SnapshotVersion;
+    header.Generation      = generation;
+    header.StringCount     = uint32(this->StringOffsets.size() - 1);
+    header.PathCount       = uint32(this->Paths.size());
+    header.PipeCount       = uint32(this->Pipes.size());
+    header.DependencyCount = uint32(this->Dependencies.size());
+
+    std::string out;
+    out.reserve(sizeof(SnapshotHeader) + this->StringData.size() + this->StringOffsets.size() * sizeof(uint64) +
+                this->Paths.size() * sizeof(SnapshotPath) + this->Pipes.size() * sizeof(SnapshotPipe) +
+                this->Dependencies.size() * sizeof(uint32) + 64);
+
+        // The header is written last, once we know where everything went
+    out.resize(sizeof(SnapshotHeader), '\0');
+
+    AppendSection(out, header.StringOffsetsAt, this->StringOffsets.data(), this->StringOffsets.size());
+    AppendSection(out, header.StringDataAt,    this->StringData.data(), this->StringData.size());
+    AppendSection(out, header.PathsAt,         this->Paths.data(), this->Paths.size());
+    AppendSection(out, header.PipesAt,         this->Pipes.data(), this->Pipes.size());
+    AppendSection(out, header.DependenciesAt,  this->Dependencies.data(), this->Dependencies.size());
+
+    header.FileSize = out.size();
+    std::memcpy(&out[0], &header, sizeof(SnapshotHeader));
+
+    return out;
+}
+
+    //  View
+    // --------------------
+
+SnapshotView::SnapshotView()
+{
+    this->Data   = nullptr;
+    this->Size   = 0;
+    this->Header = nullptr;
+#ifdef _WIN32
+    this->FileHandle    = INVALID_HANDLE_VALUE;
+    this->MappingHandle = nullptr;
+#else
+    this->FileDescriptor = -1;
+#endif
+}
+
+SnapshotView::~SnapshotView()
+{
+    this->Close();
+}
+
+bool SnapshotView::Open(const BlackRoot::IO::FilePath path)
+{
+    this->Close();
+
+    if (!this->Map(path))
+        return false;
+
+    if (!this->Validate()) {
+        this->Close();
+        return false;
+    }
+
+    return true;
+}
+
+void SnapshotView::Close()
+{
+    this->Unmap();
+    this->Data   = nullptr;
+    this->Size   = 0;
+    this->Header = nullptr;
+}
+
+#ifdef _WIN32
+
+bool SnapshotView::Map(const BlackRoot::IO::FilePath path)
+{
+    HANDLE file = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    this->FileHandle = file;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+        return false;
+
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping)
+        return false;
+    this->MappingHandle = mapping;
+
+    void * view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!view)
+        return false;
+
+    this->Data = static_cast<const char*>(view);
+    this->Size = std::size_t(size.QuadPart);
+    return true;
+}
+
+void SnapshotView::Unmap()
+{
+    if (this->Data) {
+        UnmapViewOfFile(this->Data);
+    }
+    if (this->MappingHandle) {
+        CloseHandle(this->MappingHandle);
+        this->MappingHandle = nullptr;
+    }
+    if (this->FileHandle != INVALID_HANDLE_VALUE) {
+        CloseHandle(this->FileHandle);
+        this->FileHandle = INVALID_HANDLE_VALUE;
+    }
+}
+
+#else
+
+bool SnapshotView::Map(const BlackRoot::IO::FilePath path)
+{
+    int fd = open(path.string().c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    this->FileDescriptor = fd;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+        return false;
+
+    void * view = mmap(nullptr, std::size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    if (view == MAP_FAILED)
+        return false;
+
+        // We read all of it front to back during load
+    madvise(view, std::size_t(st.st_size), MADV_SEQUENTIAL);
+    madvise(view, std::size_t(st.st_size), MADV_WILLNEED);
+
+    this->Data = static_cast<const char*>(view);
+    this->Size = std::size_t(st.st_size);
+    return true;
+}
+
+void SnapshotView::Unmap()
+{
+    if (this->Data) {
+        munmap(const_cast<char*>(this->Data), this->Size);
+    }
+    if (this->FileDescriptor >= 0) {
+        close(this->FileDescriptor);
+        this->FileDescriptor = -1;
+    }
+}
+
+#endif
+
+bool SnapshotView::Validate()
+{
+        // Everything is checked once up front, so that the accessors can
+        // trust the file even if it was cut off or scribbled over
+    if (this->Size < sizeof(SnapshotHeader))
+        return false;
+
+    auto * header = reinterpret_cast<const SnapshotHeader*>(this->Data);
+    if (0 != std::memcmp(header->Magic, SnapshotMagic, 4) ||
+        header->ByteOrder != SnapshotByteOrder ||
+        header->Version != SnapshotVersion ||
+        header->FileSize != this->Size)
+        return false;
+
+    auto fits = [&](uint64 at, std::size_t count, std::size_t size) {
+        return (at % 8) == 0 && at <= this->Size && count <= (this->Size - at) / size;
+    };
+
+    if (!fits(header->StringOffsetsAt, std::size_t(header->StringCount) + 1, sizeof(uint64)) ||
+        !fits(header->PathsAt, header->PathCount, sizeof(SnapshotPath)) ||
+        !fits(header->PipesAt, header->PipeCount, sizeof(SnapshotPipe)) ||
+        !fits(header->DependenciesAt, header->DependencyCount, sizeof(uint32)))
+        return false;
+
+    this->Header = header;
+
+    auto * offsets = reinterpret_cast<const uint64*>(this->Data + header->StringOffsetsAt);
+    if (offsets[0] != 0 || !fits(header->StringDataAt, std::size_t(offsets[header->StringCount]), 1))
+        return false;
+    for (uint32 i = 0; i < header->StringCount; i++) {
+        if (offsets[i] > offsets[i + 1])
+            return false;
+    }
+
+    for (uint32 i = 0; i < header->PathCount; i++) {
+        if (this->GetPath(i).Path >= header->StringCount)
+            return false;
+    }
+
+    auto * deps = reinterpret_cast<const uint32*>(this->Data + header->DependenciesAt);
+    for (uint32 i = 0; i < header->PipeCount; i++) {
+        auto & pipe = this->GetPipe(i);
+        if (pipe.Hub >= header->StringCount || pipe.Tool >= header->StringCount || pipe.PathIn >= header->StringCount ||
+            pipe.PathOut >= header->StringCount || pipe.Settings >= header->StringCount)
+            return false;
+        if (pipe.FirstDependency > header->DependencyCount ||
+            pipe.DependencyCount > header->DependencyCount - pipe.FirstDependency)
+            return false;
+        for (uint32 d = 0; d < pipe.DependencyCount; d++) {
+            if (deps[pipe.FirstDependency + d] >= header->PathCount)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+const SnapshotPath & SnapshotView::GetPath(uint32 index) const
+{
+    DbAssert(index < this->Header->PathCount);
+    return reinterpret_cast<const SnapshotPath*>(this->Data + this->Header->PathsAt)[index];
+}
+
+const SnapshotPipe & SnapshotView::GetPipe(uint32 index) const
+{
+    DbAssert(index < this->Header->PipeCount);
+    return reinterpret_cast<const SnapshotPipe*>(this->Data + this->Header->PipesAt)[index];
+}
+
+const uint32 * SnapshotView::GetDependencies(const SnapshotPipe & pipe) const
+{
+    return reinterpret_cast<const uint32*>(this->Data + this->Header->DependenciesAt) + pipe.FirstDependency;
+}
+
+std::string_view SnapshotView::GetString(uint32 index) const
+{
+    DbAssert(index < this->Header->StringCount);
+    auto * offsets = reinterpret_cast<const uint64*>(this->Data + this->Header->StringOffsetsAt);
+    return std::string_view(this->Data + this->Header->StringDataAt + offsets[index], std::size_t(offsets[index + 1] - offsets[index]));
+}
\ No newline at end of file
@@ -0,0 +1,121 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+/* {quality} This is very much a sketch
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+
+#include "BlackRoot/Pubc/Number Types.h"
+#include "BlackRoot/Pubc/Files Types.h"
+
+namespace Hephaestus {
+namespace Pipeline {
+namespace Monitor {
+
+        // Binary snapshot of the persistent monitor state, made to be mapped
+        // into memory and walked without parsing. The file is a header followed
+        // by 8-byte aligned sections:
+        //  - string offsets (count + 1 entries) and the string data they point in
+        //  - fixed-width path records
+        //  - fixed-width pipe records, each owning a range of dependencies
+        //  - dependencies, as indices into the path records
+        // Everything is stored in the byte order of the machine that wrote it;
+        // a snapshot with another byte order is simply not loaded.
+
+    struct SnapshotHeader {
+        char        Magic[4];
+        uint32      ByteOrder;
+        uint32      Version;
+        uint32      Reserved;
+        uint64      Generation;
+
+        uint32      StringCount, PathCount, PipeCount, DependencyCount;
+        uint64      StringOffsetsAt, StringDataAt, PathsAt, PipesAt, DependenciesAt;
+        uint64      FileSize;
+    };
+
+    struct SnapshotPath {
+        enum Flag : uint32 {
+            HasContentHash = 1,
+        };
+
+        uint32      Path;
+        uint32      Flags;
+        int64       Changed;
+        uint64      Size, ContentHash;
+    };
+
+    struct SnapshotPipe {
+        uint32      Hub, Tool, PathIn, PathOut, Settings;
+        uint32      FirstDependency, DependencyCount;
+    };
+
+        // Collects the state on the update thread, and turns it into the bytes
+        // of a snapshot; strings are shared between all records
+    class SnapshotBuilder {
+    protected:
+        std::string                             StringData;
+        std::vector<uint64>                     StringOffsets;
+        std::unordered_map<std::string, uint32> StringIndex;
+
+        std::vector<SnapshotPath>               Paths;
+        std::vector<SnapshotPipe>               Pipes;
+        std::vector<uint32>                     Dependencies;
+
+        uint32  AddString(const std::string &);
+
+    public:
+        SnapshotBuilder();
+
+        uint32  AddPath(const std::string & path, const SnapshotPath & state);
+        void    AddPipe(const std::string & hub, const std::string & tool, const std::string & pathIn, const std::string & pathOut,
+                        const std::string & settings, const std::vector<uint32> & pathIndices);
+
+        std::string Finish(uint64 generation);
+    };
+
+        // Read-only view on a mapped snapshot; everything it hands out points
+        // into the mapping and is only valid until the view is closed
+    class SnapshotView {
+    protected:
+        const char          *Data;
+        std::size_t         Size;
+        const SnapshotHeader *Header;
+
+#ifdef _WIN32
+        void                *FileHandle, *MappingHandle;
+#else
+        int                 FileDescriptor;
+#endif
+
+        bool    Map(const BlackRoot::IO::FilePath);
+        void    Unmap();
+        bool    Validate();
+
+    public:
+        SnapshotView();
+        ~SnapshotView();
+
+        bool    Open(const BlackRoot::IO::FilePath);
+        void    Close();
+
+        uint64  GetGeneration() const { return this->Header->Generation; }
+        uint32  GetPathCount() const  { return this->Header->PathCount; }
+        uint32  GetPipeCount() const  { return this->Header->PipeCount; }
+
+        const SnapshotPath & GetPath(uint32) const;
+        const SnapshotPipe & GetPipe(uint32) const;
+        const uint32 *       GetDependencies(const SnapshotPipe &) const;
+        std::string_view     GetString(uint32) const;
+    };
+
+}
+}
+}
\ No newline at end of file
@@ -0,0 +1,476 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include <map>
+#include <memory>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+extern char ** environ;
+#endif
+
+#include "BlackRoot/Pubc/Exception.h"
+#include "BlackRoot/Pubc/Threaded IO Stream.h"
+#include "BlackRoot/Pubc/Stringstream.h"
+#include "BlackRoot/Pubc/Files.h"
+
+#include "HephaestusBase/Pubc/Pipe Tool.h"
+#include "HephaestusBase/Pubc/Pipe Tool Register.h"
+
+namespace Hephaestus {
+namespace Pipeline {
+namespace Tools {
+
+    /* Command runs an external program on the in-file. Settings:
+     *   "command"    : [ "program", "fixed", "args" ]
+     *   "arguments"  : [ "per-file", "args", "{in}", "{out}" ]
+     *   "persistent" : true, to keep the program running between files
+     * A persistent program is started once per wrangler thread with
+     * "--persistent_worker" added, and is sent one json request per line on
+     * stdin; it answers one json response per line on stdout, like a Bazel
+     * worker using the json protocol:
+     *   request  { "arguments": [...], "inputs": [ { "path": ... } ], "requestId": 0 }
+     *   response { "exitCode": 0, "output": "...", "requestId": 0 }
+     * A response may also list "readFiles" and "writtenFiles"; otherwise we
+     * assume the program read the in-file and wrote the out-file.
+     */
+
+    using JSON       = BlackRoot::Format::JSON;
+    using Path       = BlackRoot::IO::FilePath;
+    using Time       = BlackRoot::IO::FileTime;
+    using StringList = std::vector<std::string>;
+
+#ifndef _WIN32
+    namespace {
+
+        struct Process {
+            pid_t   Pid;
+            int     In, Out;
+        };
+
+            // Close-on-exec from the start; another thread spawning in
+            // between would keep our ends open in its child, and a worker
+            // whose stdin is held open that way never sees it close
+        bool MakePipe(int fds[2]) {
+            return ::pipe2(fds, O_CLOEXEC) == 0;
+        }
+
+        void CloseFD(int & fd) {
+            if (fd >= 0) {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+
+            // Starts the program with our end of its stdout (and stderr) in
+            // 'Out'; if 'pipeStdin' our end of its stdin is in 'In'
+        bool SpawnProcess(const StringList & args, bool pipeStdin, Process & process) {
+            process.Pid = -1;
+            process.In  = -1;
+            process.Out = -1;
+
+            int outPipe[2], inPipe[2] = { -1, -1 };
+            if (!MakePipe(outPipe))
+                return false;
+            if (pipeStdin && !MakePipe(inPipe)) {
+                ::close(outPipe[0]);
+                ::close(outPipe[1]);
+                return false;
+            }
+
+            posix_spawn_file_actions_t actions;
+            posix_spawn_file_actions_init(&actions);
+            if (pipeStdin) {
+                posix_spawn_file_actions_adddup2(&actions, inPipe[0], 0);
+            }
+            else {
+                posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+            }
+            posix_spawn_file_actions_adddup2(&actions, outPipe[1], 1);
+            if (!pipeStdin) {
+                posix_spawn_file_actions_adddup2(&actions, outPipe[1], 2);
+            }
+
+            std::vector<char*> argv;
+            for (auto & arg : args) {
+                argv.push_back(const_cast<char*>(arg.c_str()));
+            }
+            argv.push_back(nullptr);
+
+            int error = ::posix_spawnp(&process.Pid, argv[0], &actions, nullptr, argv.data(), environ);
+            posix_spawn_file_actions_destroy(&actions);
+
+            ::close(outPipe[1]);
+            if (pipeStdin) {
+                ::close(inPipe[0]);
+            }
+
+            if (error != 0) {
+                ::close(outPipe[0]);
+                if (pipeStdin) {
+                    ::close(inPipe[1]);
+                }
+                process.Pid = -1;
+                return false;
+            }
+
+            process.Out = outPipe[0];
+            process.In  = pipeStdin ? inPipe[1] : -1;
+            return true;
+        }
+
+        int WaitProcess(Process & process) {
+            CloseFD(process.In);
+            CloseFD(process.Out);
+
+            int status = 0;
+            while (::waitpid(process.Pid, &status, 0) < 0 && errno == EINTR) {
+            }
+            process.Pid = -1;
+
+            return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+        }
+
+        void KillProcess(Process & process) {
+            if (process.Pid > 0) {
+                ::kill(process.Pid, SIGKILL);
+            }
+            WaitProcess(process);
+        }
+
+            // Appends whatever the program wrote; returns false once it closed
+            // its end. Polls, so we notice being cancelled while it works
+        bool ReadSome(int fd, std::string & out, const PipeToolInstr & instr, bool & cancelled) {
+            while (true) {
+                if (instr.IsCancelled()) {
+                    cancelled = true;
+                    return false;
+                }
+
+                pollfd pfd = { fd, POLLIN, 0 };
+                int ready = ::poll(&pfd, 1, 50);
+                if (ready < 0 && errno != EINTR)
+                    return false;
+                if (ready <= 0)
+                    continue;
+
+                char buffer[4096];
+                auto count = ::read(fd, buffer, sizeof(buffer));
+                if (count < 0 && errno == EINTR)
+                    continue;
+                if (count <= 0)
+                    return false;
+
+                out.append(buffer, std::size_t(count));
+                return true;
+            }
+        }
+
+            // A program that died would take us with it when we write to
+            // it; SIGPIPE is blocked on this thread only while we write, and
+            // one we caused is taken off again, so whoever hosts us keeps
+            // their own handling
+        bool WriteAll(int fd, const std::string & str) {
+            sigset_t pipeSet, oldSet, pending;
+            sigemptyset(&pipeSet);
+            sigaddset(&pipeSet, SIGPIPE);
+            ::pthread_sigmask(SIG_BLOCK, &pipeSet, &oldSet);
+
+            sigemptyset(&pending);
+            ::sigpending(&pending);
+            bool wasPending = sigismember(&pending, SIGPIPE);
+
+            const char * data = str.data();
+            std::size_t length = str.size();
+            bool written = true;
+            bool broken  = false;
+            while (length > 0) {
+                auto count = ::write(fd, data, length);
+                if (count < 0 && errno == EINTR)
+                    continue;
+                if (count <= 0) {
+                    broken  = count < 0 && errno == EPIPE;
+                    written = false;
+                    break;
+                }
+                data   += count;
+                length -= std::size_t(count);
+            }
+
+            if (broken && !wasPending) {
+                timespec none = { 0, 0 };
+                while (::sigtimedwait(&pipeSet, nullptr, &none) < 0 && errno == EINTR) {
+                }
+            }
+            ::pthread_sigmask(SIG_SETMASK, &oldSet, nullptr);
+
+            return written;
+        }
+
+            // A program kept running between files. Not shared; every
+            // wrangler thread has its own, so requests never interleave
+        class PersistentWorker {
+        protected:
+            Process     Child;
+            std::string Buffer;
+
+        public:
+            PersistentWorker() {
+                this->Child = { -1, -1, -1 };
+            }
+            ~PersistentWorker() {
+                if (this->Child.Pid <= 0)
+                    return;
+
+                    // Closing stdin is how a worker is told to stop
+                CloseFD(this->Child.In);
+                WaitProcess(this->Child);
+            }
+
+            bool Start(StringList args) {
+                args.push_back("--persistent_worker");
+                return SpawnProcess(args, true, this->Child);
+            }
+
+                // Returns false if the worker is gone or we were cancelled;
+                // either way the worker cannot be used again
+            bool Request(const JSON & request, JSON & response, const PipeToolInstr & instr, bool & cancelled) {
+                if (!WriteAll(this->Child.In, request.dump() + "\n"))
+                    return false;
+
+                while (true) {
+                    auto newline = this->Buffer.find('\n');
+                    if (newline != this->Buffer.npos) {
+                        auto line = this->Buffer.substr(0, newline);
+                        this->Buffer.erase(0, newline + 1);
+
+                            // Programs chatter; only json objects are answers
+                        try {
+                            response = JSON::parse(line);
+                        }
+                        catch (...) {
+                            continue;
+                        }
+                        if (response.is_object())
+                            return true;
+                        continue;
+                    }
+
+                    if (!ReadSome(this->Child.Out, this->Buffer, instr, cancelled))
+                        return false;
+                }
+            }
+
+            void Kill() {
+                KillProcess(this->Child);
+            }
+        };
+
+            // Keyed by the startup command, per wrangler thread
+        thread_local std::map<std::string, std::unique_ptr<PersistentWorker>> PersistentWorkers;
+
+    }
+#endif
+
+    class Command : public IPipeTool {
+    protected:
+        static StringList   GetStringList(const JSON &, const char * name, bool required);
+        static std::string  Substitute(std::string, const PipeToolInstr &);
+
+        void    RunOnce(PipeToolInstr &, const StringList & command) const;
+        void    RunPersistent(PipeToolInstr &, const StringList & command, const StringList & arguments) const;
+
+    public:
+        Command() : IPipeTool("command") { ; }
+
+        void Run(PipeToolInstr &) const override;
+    };
+
+    StringList Command::GetStringList(const JSON & settings, const char * name, bool required)
+    {
+        StringList list;
+
+        auto found = settings.find(name);
+        if (found == settings.end()) {
+            if (required) {
+                throw new BlackRoot::Debug::Exception((std::stringstream() << "Setting '" << name << "' is missing.").str(), BRGenDbgInfo);
+            }
+            return list;
+        }
+
+        if (!found->is_array()) {
+            throw new BlackRoot::Debug::Exception((std::stringstream() << "Setting '" << name << "' must be a list of strings.").str(), BRGenDbgInfo);
+        }
+        for (auto & it : *found) {
+            if (!it.is_string()) {
+                throw new BlackRoot::Debug::Exception((std::stringstream() << "Setting '" << name << "' must be a list of strings.").str(), BRGenDbgInfo);
+            }
+            list.push_back(it.get<std::string>());
+        }
+        return list;
+    }
+
+    std::string Command::Substitute(std::string str, const PipeToolInstr & instr)
+    {
+        const std::pair<const char*, std::string> vars[] = {
+            { "{in}",  instr.FileIn.string() },
+            { "{out}", instr.FileOut.string() }
+        };
+
+        for (auto & var : vars) {
+            std::string name = var.first;
+            for (auto pos = str.find(name); pos != str.npos; pos = str.find(name, pos + var.second.size())) {
+                str.replace(pos, name.size(), var.second);
+            }
+        }
+        return str;
+    }
+
+    void Command::Run(PipeToolInstr & instr) const
+    {
+        BlackRoot::IO::BaseFileSource fs;
+
+        auto & settings = *instr.Settings;
+
+        auto command   = GetStringList(settings, "command", true);
+        auto arguments = GetStringList(settings, "arguments", false);
+        if (command.size() == 0) {
+            throw new BlackRoot::Debug::Exception("Setting 'command' is empty.", BRGenDbgInfo);
+        }
+
+        for (auto & arg : arguments) {
+            arg = Substitute(arg, instr);
+        }
+
+            // Note the time of the in-file before the program gets to it
+        Time lastWriteIn = fs.LastWriteTime(instr.FileIn);
+
+        fs.CreateDirectories(instr.FileOut.parent_path());
+
+        auto persistent = settings.find("persistent");
+        if (persistent != settings.end() && persistent->is_boolean() && persistent->get<bool>()) {
+            this->RunPersistent(instr, command, arguments);
+        }
+        else {
+            command.insert(command.end(), arguments.begin(), arguments.end());
+            this->RunOnce(instr, command);
+        }
+
+        if (instr.IsCancelled())
+            return;
+
+            // Unless the program told us better, it read what it was given
+            // and wrote where it was told to
+        if (instr.ReadFiles.size() == 0) {
+            instr.ReadFiles.push_back({ instr.FileIn, lastWriteIn });
+        }
+        for (auto & it : instr.ReadFiles) {
+            if (it.Path == instr.FileIn) {
+                it.LastChange = lastWriteIn;
+            }
+        }
+        if (instr.WrittenFiles.size() == 0) {
+            instr.WrittenFiles.push_back({ instr.FileOut });
+        }
+    }
+
+#ifdef _WIN32
+    void Command::RunOnce(PipeToolInstr &, const StringList &) const
+    {
+        throw new BlackRoot::Debug::Exception("The command tool is not supported on this platform.", BRGenDbgInfo);
+    }
+
+    void Command::RunPersistent(PipeToolInstr &, const StringList &, const StringList &) const
+    {
+        throw new BlackRoot::Debug::Exception("The command tool is not supported on this platform.", BRGenDbgInfo);
+    }
+#else
+    void Command::RunOnce(PipeToolInstr & instr, const StringList & command) const
+    {
+        Process process;
+        if (!SpawnProcess(command, false, process)) {
+            throw new BlackRoot::Debug::Exception((std::stringstream() << "Cannot start '" << command[0] << "'.").str(), BRGenDbgInfo);
+        }
+
+        std::string output;
+        bool cancelled = false;
+        while (ReadSome(process.Out, output, instr, cancelled)) {
+        }
+
+        if (cancelled) {
+            KillProcess(process);
+            return;
+        }
+
+        int exitCode = WaitProcess(process);
+        if (exitCode != 0) {
+            throw new BlackRoot::Debug::Exception((std::stringstream() << "'" << command[0] << "' exited with " << exitCode << ":\n" << output).str(), BRGenDbgInfo);
+        }
+    }
+
+    void Command::RunPersistent(PipeToolInstr & instr, const StringList & command, const StringList & arguments) const
+    {
+        auto key = JSON(command).dump();
+
+        auto & worker = PersistentWorkers[key];
+        if (!worker) {
+            worker.reset(new PersistentWorker);
+            if (!worker->Start(command)) {
+                worker.reset();
+                PersistentWorkers.erase(key);
+                throw new BlackRoot::Debug::Exception((std::stringstream() << "Cannot start '" << command[0] << "' as a worker.").str(), BRGenDbgInfo);
+            }
+        }
+
+        JSON request = {
+            { "arguments", arguments },
+            { "inputs",    JSON::array({ { { "path", instr.FileIn.string() } } }) },
+            { "requestId", 0 }
+        };
+
+        JSON response;
+        bool cancelled = false;
+        if (!worker->Request(request, response, instr, cancelled)) {
+                // We cannot tell a worker to stop halfway, so it goes; the
+                // next file starts a new one
+            worker->Kill();
+            PersistentWorkers.erase(key);
+
+            if (cancelled)
+                return;
+            throw new BlackRoot::Debug::Exception((std::stringstream() << "Worker '" << command[0] << "' stopped unexpectedly.").str(), BRGenDbgInfo);
+        }
+
+        int exitCode = response.value("exitCode", 0);
+        if (exitCode != 0) {
+            throw new BlackRoot::Debug::Exception((std::stringstream() << "Worker '" << command[0] << "' failed with " << exitCode << ":\n" << response.value("output", std::string())).str(), BRGenDbgInfo);
+        }
+
+        BlackRoot::IO::BaseFileSource fs;
+
+            // We only hear of these reads afterwards, so take their times as
+            // of now; the in-file's time from before is fixed up by 'Run'
+        for (auto & it : GetStringList(response, "readFiles", false)) {
+            instr.ReadFiles.push_back({ it, fs.LastWriteTime(it) });
+        }
+        for (auto & it : GetStringList(response, "writtenFiles", false)) {
+            instr.WrittenFiles.push_back({ it });
+        }
+    }
+#endif
+
+    HE_PIPE_DEFINE(Command);
+
+}
+}
+}
\ No newline at end of file
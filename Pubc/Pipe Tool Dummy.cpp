@@ -72,14 +72,14 @@ namespace Tools {
         else {
             ss << "  (did not exist)" << std::endl;
         }
-        ss << " Settings: " << instr.Settings.dump() << std::endl;
+        ss << " Settings: " << instr.Settings->dump() << std::endl;
         ss << "~*~*~ this has been a dummy ~*~*~" << std::endl;
         
         cout{} << ss.str();
         
             // Check if the special string has been set to get this dummy to copy
-        auto & val = instr.Settings["special"];
-        if (val.is_string() && 0 == val.get<std::string>().compare("do it, you coward")) {
+        auto val = instr.Settings->find("special");
+        if (val != instr.Settings->end() && val->is_string() && 0 == val->get<std::string>().compare("do it, you coward")) {
                 // Ensure directory and copy file
             fs.CreateDirectories(instr.FileOut.parent_path());
             if (outExists) {
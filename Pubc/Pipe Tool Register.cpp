@@ -2,6 +2,9 @@
  * License, v. 2.0. If a copy of the MPL was not distributed with this
  * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
 
+#include "BlackRoot/Pubc/Threaded IO Stream.h"
+
+#include "HephaestusBase/Pubc/Pipe Tool.h"
 #include "HephaestusBase/Pubc/Pipe Tool Register.h"
 
 using namespace Hephaestus::Pipeline;
@@ -13,8 +16,18 @@ PipeRegistry * PipeRegistry::GetRegistry()
     return Registry ? Registry : (Registry = new PipeRegistry);
 }
         
-void PipeRegistry::AddPipe(DynLib::IPipeTool * tool)
+void PipeRegistry::AddPipe(DynLib::IPipeTool * tool, uint32 abiVersion, const char * name)
 {
+    using cout = BlackRoot::Util::Cout;
+
+        // Its vtable may not even have the slots we would call, so not even
+        // its name is asked; we go by the name it was registered under
+    if (abiVersion != DynLib::AbiVersion) {
+        cout{} << "!!Not loading tool " << name << std::endl
+            << " It was built for tool version " << abiVersion << ", we are version " << DynLib::AbiVersion << std::endl << std::endl;
+        return;
+    }
+
     GetRegistry()->Pipes.push_back(tool);
 }
 
@@ -6,6 +6,7 @@
 
 #include <vector>
 
+#include "BlackRoot/Pubc/Number Types.h"
 #include "BlackRoot/Pubc/Stringstream.h"
 
 namespace Hephaestus {
@@ -24,15 +25,20 @@ namespace Pipeline {
     public:
         static PipeRegistry * GetRegistry();
         
-        static void AddPipe(DynLib::IPipeTool*);
+            // 'abiVersion' is the DynLib::AbiVersion the tool was built
+            // with; tools of another version are left out, as we cannot
+            // safely call into them, and 'name' is what we tell about it.
+            // Tools built before there was a version do not find this
+            // function at all, and so never load
+        static void AddPipe(DynLib::IPipeTool*, uint32 abiVersion, const char * name);
         static const PipeToolList & GetPipeList();
     };
 
     namespace Helper {
 
         struct RegisterPipe {
-            RegisterPipe(DynLib::IPipeTool * pipe) {
-                PipeRegistry::AddPipe(pipe);
+            RegisterPipe(DynLib::IPipeTool * pipe, uint32 abiVersion, const char * name) {
+                PipeRegistry::AddPipe(pipe, abiVersion, name);
             }
         };
 
@@ -43,7 +49,7 @@ namespace Pipeline {
 
 #define HE_PIPE_DEFINE(x) \
     static x __PipeDec##x{}; \
-    Hephaestus::Pipeline::Helper::RegisterPipe __RegisterPipe_##x(&__PipeDec##x);
+    Hephaestus::Pipeline::Helper::RegisterPipe __RegisterPipe_##x(&__PipeDec##x, Hephaestus::Pipeline::DynLib::AbiVersion, #x);
 
     
 
@@ -2,33 +2,228 @@
  * License, v. 2.0. If a copy of the MPL was not distributed with this
  * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
 
+#include <algorithm>
+#include <cstring>
+
 #include "BlackRoot/Pubc/Assert.h"
+#include "BlackRoot/Pubc/Stringstream.h"
 
 #include "HephaestusBase/Pubc/Pipe Tool.h"
 
 using namespace Hephaestus;
 using namespace Hephaestus::Pipeline;
 
+namespace {
+        // Bump allocator the tools write their results into; every host
+        // thread keeps one and resets it per call, so once it has grown to
+        // fit the largest result, results cost no allocations at all
+    class ResultArena {
+    protected:
+        const std::size_t ChunkSize = 64 * 1024;
+
+        struct Chunk {
+            std::unique_ptr<uint8[]>    Data;
+            std::size_t                 Size;
+        };
+
+        std::vector<Chunk>  Chunks;
+        std::size_t         Current, Used;
+
+    public:
+        ResultArena() {
+            this->Current = 0;
+            this->Used    = 0;
+        }
+
+        void Reset() {
+            this->Current = 0;
+            this->Used    = 0;
+        }
+
+        void * Allocate(std::size_t size) {
+            size = (size + 7) & ~std::size_t(7);
+
+            while (this->Current < this->Chunks.size()) {
+                auto & chunk = this->Chunks[this->Current];
+                if (this->Used + size <= chunk.Size) {
+                    void * ptr = chunk.Data.get() + this->Used;
+                    this->Used += size;
+                    return ptr;
+                }
+                this->Current += 1;
+                this->Used     = 0;
+            }
+
+            Chunk chunk;
+            chunk.Size = std::max(this->ChunkSize, size);
+            chunk.Data.reset(new uint8[chunk.Size]);
+            this->Chunks.push_back(std::move(chunk));
+
+            this->Used = size;
+            return this->Chunks.back().Data.get();
+        }
+
+        DynLib::HostArena GetHostArena() {
+            DynLib::HostArena arena;
+            arena.Context  = this;
+            arena.Allocate = [](void * context, uint32 size) -> void * {
+                return static_cast<ResultArena*>(context)->Allocate(size);
+            };
+            return arena;
+        }
+    };
+
+    thread_local ResultArena HostResultArena;
+
+        // What the C-style instr points into; it must outlive the call
+    struct DynLibStrings {
+        std::string FileIn, FileOut;
+        std::shared_ptr<const EncodedSettings> Settings;
+    };
+
+    DynLib::StringView ToStringView(const std::string & str)
+    {
+        return { str.data(), (uint32)str.size() };
+    }
+
+    void ToDynLibInstr(const PipeToolInstr & in, DynLibStrings & strings, DynLib::PipeToolInstr & out)
+    {
+        strings.FileIn   = in.FileIn.string();
+        strings.FileOut  = in.FileOut.string();
+        strings.Settings = in.Encoded ? in.Encoded : EncodedSettings::Encode(*in.Settings);
+
+        out.FileIn           = ToStringView(strings.FileIn);
+        out.FileOut          = ToStringView(strings.FileOut);
+        out.SettingsData     = strings.Settings->Data.data();
+        out.SettingsLength   = (uint32)strings.Settings->Data.size();
+        out.SettingsID       = strings.Settings->ID;
+        out.ReadFiles        = nullptr;
+        out.WrittenFiles     = nullptr;
+        out.ReadFileCount    = 0;
+        out.WrittenFileCount = 0;
+        out.Arena            = HostResultArena.GetHostArena();
+        out.Exception        = nullptr;
+        out.CancelCallback   = in.CancelCallback;
+        out.CancelContext    = in.CancelContext;
+    }
+
+    void FromDynLibResult(const DynLib::PipeToolInstr & in, PipeToolInstr & out)
+    {
+        auto clock = std::chrono::system_clock::time_point{};
+
+        out.ReadFiles.resize(in.ReadFileCount);
+        for (uint32 i = 0; i < in.ReadFileCount; i++) {
+            out.ReadFiles[i].Path       = in.ReadFiles[i].Path;
+            out.ReadFiles[i].LastChange = clock + std::chrono::milliseconds(in.ReadFiles[i].LastChange);
+        }
+
+        out.WrittenFiles.resize(in.WrittenFileCount);
+        for (uint32 i = 0; i < in.WrittenFileCount; i++) {
+            out.WrittenFiles[i].Path    = in.WrittenFiles[i].Path;
+        }
+    }
+
+    struct DecodedSettings {
+        uint64                                          ID;
+        std::shared_ptr<const BlackRoot::Format::JSON>  Value;
+    };
+
+        // Tools get the cached settings themselves, not a copy; an entry
+        // pushed out of the cache lives on for as long as a tool holds it
+    std::shared_ptr<const BlackRoot::Format::JSON> DecodeSettings(const DynLib::PipeToolInstr & in)
+    {
+            // Runs of the same pipe tend to follow each other on a thread, so
+            // a handful of entries catches nearly all of them
+        const uint32 cacheSize = 8;
+        thread_local DecodedSettings cache[cacheSize];
+        thread_local uint32 next = 0;
+
+        for (auto & it : cache) {
+            if (it.ID != 0 && it.ID == in.SettingsID)
+                return it.Value;
+        }
+
+        auto & slot = cache[next++ % cacheSize];
+        slot.ID    = 0;
+        slot.Value = std::make_shared<const BlackRoot::Format::JSON>(BlackRoot::Format::JSON::from_cbor(in.SettingsData, in.SettingsData + in.SettingsLength));
+        slot.ID    = in.SettingsID;
+        return slot.Value;
+    }
+
+    void FromDynLibInstr(const DynLib::PipeToolInstr & in, PipeToolInstr & out)
+    {
+        out.FileIn   = std::string(in.FileIn.Data, in.FileIn.Length);
+        out.FileOut  = std::string(in.FileOut.Data, in.FileOut.Length);
+        out.Settings = DecodeSettings(in);
+        out.CancelCallback = in.CancelCallback;
+        out.CancelContext  = in.CancelContext;
+    }
+
+    void ToDynLibResult(const PipeToolInstr & in, DynLib::PipeToolInstr & out)
+    {
+        auto clock = std::chrono::system_clock::time_point{};
+
+        auto & arena = out.Arena;
+        auto addPath = [&](const BlackRoot::IO::FilePath & path) -> const char * {
+            auto str  = path.u8string();
+            auto size = (uint32)str.size();
+            char * copy = (char*)arena.Allocate(arena.Context, size + 1);
+            memcpy(copy, (const char*)str.c_str(), size + 1);
+            return copy;
+        };
+
+        out.ReadFileCount = (uint32)in.ReadFiles.size();
+        out.ReadFiles = (DynLib::PipeToolInstr::ReadFile*)arena.Allocate(arena.Context, sizeof(DynLib::PipeToolInstr::ReadFile) * out.ReadFileCount);
+        for (uint32 i = 0; i < out.ReadFileCount; i++) {
+            auto & orFile = in.ReadFiles[i];
+            auto & cvFile = out.ReadFiles[i];
+            cvFile.Path = addPath(orFile.Path);
+            cvFile.LastChange = std::chrono::duration_cast<std::chrono::milliseconds>(orFile.LastChange - clock).count();
+        }
+        out.WrittenFileCount = (uint32)in.WrittenFiles.size();
+        out.WrittenFiles = (DynLib::PipeToolInstr::WrittenFile*)arena.Allocate(arena.Context, sizeof(DynLib::PipeToolInstr::WrittenFile) * out.WrittenFileCount);
+        for (uint32 i = 0; i < out.WrittenFileCount; i++) {
+            auto & cvFile = out.WrittenFiles[i];
+            cvFile.Path = addPath(in.WrittenFiles[i].Path);
+        }
+    }
+}
+
+    //  Settings
+    // --------------------
+
+std::shared_ptr<const EncodedSettings> EncodedSettings::Encode(const BlackRoot::Format::JSON & json)
+{
+        // Zero is never handed out, so it can mean 'nothing decoded yet'
+    static std::atomic<uint64> nextID(1);
+
+    auto encoded = std::make_shared<EncodedSettings>();
+    encoded->ID   = nextID++;
+    encoded->Data = BlackRoot::Format::JSON::to_cbor(json);
+    return encoded;
+}
+
     //  Exe functions
     // --------------------
 
+ void DynLib::IPipeTool::CheckAbiVersion() const
+ {
+     if (this->InternalGetAbiVersion() != DynLib::AbiVersion) {
+         throw new BlackRoot::Debug::Exception((std::stringstream() << "The tool '" << this->GetToolName() << "' was built for another version of the pipe tool interface.").str(), BRGenDbgInfo);
+     }
+ }
+
  void DynLib::IPipeTool::Run(Pipeline::PipeToolInstr & _instr) const
  {
-        // Get string version of settings
-     std::string settings = _instr.Settings.dump();
-     std::string fileIn   = _instr.FileIn.string();
-     std::string fileOut  = _instr.FileOut.string();
+     this->CheckAbiVersion();
+
+        // Whatever the last call left in the arena has been read by now
+     HostResultArena.Reset();
 
         // Create the instr in C-style for passing the lib border
+     DynLibStrings strings;
      DynLib::PipeToolInstr instr;
-     instr.FileIn           = fileIn.c_str();
-     instr.FileOut          = fileOut.c_str();
-     instr.Settings         = settings.c_str();
-     instr.ReadFiles        = nullptr;
-     instr.WrittenFiles     = nullptr;
-     instr.ReadFileCount    = 0;
-     instr.WrittenFileCount = 0;
-     instr.Exception        = nullptr;
+     ToDynLibInstr(_instr, strings, instr);
 
         // Call a function which converts back and runs; the
         // virtual pointer calls across to the dynlib side
@@ -41,22 +236,49 @@ using namespace Hephaestus::Pipeline;
          throw e;
      }
 
-     auto clock = std::chrono::system_clock::time_point{};
+        // Translate the C-style version back into C++; this reads straight
+        // from our arena, so paths are only copied the once
+     FromDynLibResult(instr, _instr);
 
-        // Translate the C-style version back into C++
-     _instr.ReadFiles.resize(instr.ReadFileCount);
-     for (uint32 i = 0; i < instr.ReadFileCount; i++) {
-         _instr.ReadFiles[i].Path       = instr.ReadFiles[i].Path;
-         _instr.ReadFiles[i].LastChange = clock + std::chrono::milliseconds(instr.ReadFiles[i].LastChange);
-     }
+        // Clean up elements allocated by the lib
+     this->InternalCleanup(instr);
+ }
 
-     _instr.WrittenFiles.resize(instr.WrittenFileCount);
-     for (uint32 i = 0; i < instr.WrittenFileCount; i++) {
-         _instr.WrittenFiles[i].Path    = instr.WrittenFiles[i].Path;
+ bool DynLib::IPipeTool::SupportsBatch() const
+ {
+     if (this->InternalGetAbiVersion() != DynLib::AbiVersion)
+         return false;
+     return this->InternalSupportsBatch() != 0;
+ }
+
+ void DynLib::IPipeTool::RunBatch(std::vector<Pipeline::PipeToolInstr*> & _instrs, std::vector<BlackRoot::Debug::Exception*> & errors) const
+ {
+     this->CheckAbiVersion();
+
+     auto count = _instrs.size();
+     errors.assign(count, nullptr);
+
+     HostResultArena.Reset();
+
+     std::vector<DynLibStrings> strings(count);
+     std::vector<DynLib::PipeToolInstr> instrs(count);
+     for (std::size_t i = 0; i < count; i++) {
+         ToDynLibInstr(*_instrs[i], strings[i], instrs[i]);
      }
 
-        // Clean up elements allocated by the lib
-     this->InternalCleanup(instr);
+        // One call across the border for the lot; every instr reports
+        // its own exception
+     this->InternalRunBatch(instrs.data(), (uint32)count);
+
+     for (std::size_t i = 0; i < count; i++) {
+         if (instrs[i].Exception) {
+             errors[i] = new BlackRoot::Debug::Exception(instrs[i].Exception, BRGenDbgInfo);
+         }
+         else {
+             FromDynLibResult(instrs[i], *_instrs[i]);
+         }
+         this->InternalCleanup(instrs[i]);
+     }
  }
 
     //  Dynlib functions
@@ -72,15 +294,19 @@ const char * IPipeTool::GetToolName() const noexcept
     return this->Name.c_str();
 }
 
+uint32 IPipeTool::InternalGetAbiVersion() const noexcept
+{
+    return DynLib::AbiVersion;
+}
+
 void IPipeTool::InternalRun(DynLib::PipeToolInstr & _instr) const noexcept
 {
        // We are across the border; create the instr in C++ style
     PipeToolInstr instr;
-    instr.FileIn   = _instr.FileIn;
-    instr.FileOut  = _instr.FileOut;
-    instr.Settings = BlackRoot::Format::JSON::parse(_instr.Settings);
 
     try {
+        FromDynLibInstr(_instr, instr);
+
             // Run the conversion
         this->Run(instr);
     }
@@ -97,39 +323,99 @@ void IPipeTool::InternalRun(DynLib::PipeToolInstr & _instr) const noexcept
         return;
     }
 
-    auto clock = std::chrono::system_clock::time_point{};
-
        // Translate the C++ into C style
-    _instr.ReadFileCount = (uint32)instr.ReadFiles.size();
-    _instr.ReadFiles = (DynLib::PipeToolInstr::ReadFile*)malloc(sizeof(DynLib::PipeToolInstr::ReadFile) * _instr.ReadFileCount);
-    for (uint32 i = 0; i < _instr.ReadFileCount; i++) {
-        auto & orFile = instr.ReadFiles[i];
-        auto & cvFile = _instr.ReadFiles[i];
-        cvFile.Path = _strdup(orFile.Path.u8string().c_str());
-        cvFile.LastChange = std::chrono::duration_cast<std::chrono::milliseconds>(orFile.LastChange - clock).count();
-    }
-    _instr.WrittenFileCount = (uint32)instr.WrittenFiles.size();
-    _instr.WrittenFiles = (DynLib::PipeToolInstr::WrittenFile*)malloc(sizeof(DynLib::PipeToolInstr::WrittenFile) * _instr.WrittenFileCount);
-    for (uint32 i = 0; i < _instr.WrittenFileCount; i++) {
-        auto & orFile = instr.WrittenFiles[i];
-        auto & cvFile = _instr.WrittenFiles[i];
-        cvFile.Path = _strdup(orFile.Path.u8string().c_str());
+    ToDynLibResult(instr, _instr);
+}
+
+int IPipeTool::InternalSupportsBatch() const noexcept
+{
+    return this->SupportsBatch() ? 1 : 0;
+}
+
+void IPipeTool::InternalRunBatch(DynLib::PipeToolInstr * _instrs, uint32 count) const noexcept
+{
+    std::vector<const char*> failed(count, nullptr);
+
+       // An instr we cannot even read fails by itself; the rest still run
+    std::vector<std::size_t> valid;
+    std::vector<PipeToolInstr> batch;
+    for (uint32 i = 0; i < count; i++) {
+        try {
+            PipeToolInstr instr;
+            instr.SetDefault();
+            FromDynLibInstr(_instrs[i], instr);
+            batch.push_back(std::move(instr));
+            valid.push_back(i);
+        }
+        catch (...) {
+            failed[i] = "Cannot read settings";
+        }
+    }
+
+    std::vector<BlackRoot::Debug::Exception*> errors(batch.size(), nullptr);
+
+    try {
+        this->RunBatch(batch, errors);
+    }
+    catch (BlackRoot::Debug::Exception * e) {
+        for (auto i : valid) {
+            _instrs[i].Exception = _strdup(e->what());
+        }
+        return;
+    }
+    catch (std::exception e) {
+        for (auto i : valid) {
+            _instrs[i].Exception = _strdup(e.what());
+        }
+        return;
+    }
+    catch (...) {
+        for (auto i : valid) {
+            _instrs[i].Exception = _strdup("Unknown exception!");
+        }
+        return;
+    }
+
+    for (uint32 i = 0; i < count; i++) {
+        if (failed[i]) {
+            _instrs[i].Exception = _strdup(failed[i]);
+        }
+    }
+    for (std::size_t b = 0; b < batch.size(); b++) {
+        auto & _instr = _instrs[valid[b]];
+        if (errors[b]) {
+            _instr.Exception = _strdup(errors[b]->what());
+            delete errors[b];
+            continue;
+        }
+        ToDynLibResult(batch[b], _instr);
+    }
+}
+
+void IPipeTool::RunBatch(std::vector<PipeToolInstr> & instrs, std::vector<BlackRoot::Debug::Exception*> & errors) const
+{
+        // Tools without a batch of their own just run every instr
+    for (std::size_t i = 0; i < instrs.size(); i++) {
+        try {
+            this->Run(instrs[i]);
+        }
+        catch (BlackRoot::Debug::Exception * e) {
+            errors[i] = e;
+        }
+        catch (std::exception e) {
+            errors[i] = new BlackRoot::Debug::Exception(e.what(), BRGenDbgInfo);
+        }
+        catch (...) {
+            errors[i] = new BlackRoot::Debug::Exception("Unknown exception!", BRGenDbgInfo);
+        }
     }
 }
 
 void IPipeTool::InternalCleanup(DynLib::PipeToolInstr & instr) const noexcept
 {
-        // All of these are allocated on our side (the dynlib),
-        // and all with c-style allocation
+        // Only the exception is ours (the dynlib's), allocated c-style;
+        // the results live in the host's arena
     free((void*)(instr.Exception));
-    for (uint32 i = 0; i < instr.ReadFileCount; i++) {
-        free((void*)(instr.ReadFiles[i].Path));
-    }
-    for (uint32 i = 0; i < instr.WrittenFileCount; i++) {
-        free((void*)(instr.WrittenFiles[i].Path));
-    }
-    free((void*)(instr.ReadFiles));
-    free((void*)(instr.WrittenFiles));
 }
 
     //  Util
@@ -137,7 +423,27 @@ void IPipeTool::InternalCleanup(DynLib::PipeToolInstr & instr) const noexcept
 
 void PipeToolInstr::SetDefault()
 {
-    this->Settings = {};
+    static const auto noSettings = std::make_shared<const JSON>();
+
+    this->Settings = noSettings;
     this->ReadFiles.resize(0);
     this->WrittenFiles.resize(0);
+    this->CancelCallback = nullptr;
+    this->CancelContext  = nullptr;
+}
+
+void PipeToolInstr::SetCancelFlag(const std::atomic<bool> * flag)
+{
+        // A plain function pointer, so that it can cross the dynlib border
+    this->CancelContext  = flag;
+    this->CancelCallback = [](const void * context) -> int {
+        return static_cast<const std::atomic<bool>*>(context)->load(std::memory_order_relaxed) ? 1 : 0;
+    };
+}
+
+bool PipeToolInstr::IsCancelled() const
+{
+    if (!this->CancelCallback)
+        return false;
+    return this->CancelCallback(this->CancelContext) != 0;
 }
\ No newline at end of file
@@ -7,6 +7,11 @@
 
 #pragma once
 
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "BlackRoot/Pubc/Exception.h"
 #include "BlackRoot/Pubc/JSON.h"
 #include "BlackRoot/Pubc/Number Types.h"
 #include "BlackRoot/Pubc/Files.h"
@@ -14,6 +19,15 @@
 namespace Hephaestus {
 namespace Pipeline {
 
+        // Settings of a pipe, encoded once and shared by every run of it;
+        // 'ID' is unique per encoding, and never reused
+    struct EncodedSettings {
+        uint64                  ID;
+        std::vector<uint8>      Data;
+
+        static std::shared_ptr<const EncodedSettings> Encode(const BlackRoot::Format::JSON &);
+    };
+
         // Writing a pipe tool, these the instructions are given to you in the
         // 'run' function, which the tool can (and often must) modify in return
     struct PipeToolInstr {
@@ -22,7 +36,14 @@ namespace Pipeline {
         using Time = BlackRoot::IO::FileTime;
             
         Path     FileIn, FileOut;
-        JSON     Settings;
+
+            // Shared with every other run of the pipe on this thread, so
+            // tools read it but never change it
+        std::shared_ptr<const JSON>             Settings;
+
+            // If set, the encoded form of 'Settings' that is passed to the
+            // tool; if not, it is encoded for this run only
+        std::shared_ptr<const EncodedSettings>  Encoded;
 
         struct ReadFile {
             Path  Path;
@@ -34,16 +55,47 @@ namespace Pipeline {
         std::vector<ReadFile>    ReadFiles;
         std::vector<WrittenFile> WrittenFiles;
 
+            // Long running tools should check this now and then; if it returns
+            // true the result will be thrown away, so the tool may as well stop
+        int      (*CancelCallback)(const void *);
+        const void *CancelContext;
+
         void SetDefault();
+        void SetCancelFlag(const std::atomic<bool> *);
+        bool IsCancelled() const;
     };
 
         // Because pipe tools can be loaded across DLL boundaries, we have to
         // use a C-like interface which we translate to and from. The final
         // pipe tool can remain ignorant of this part.
     namespace DynLib {
+            // Bumped whenever PipeToolInstr or IPipeTool change shape; tools
+            // built against another version are refused, first when they
+            // register (see PipeRegistry), and again before every call
+        const uint32 AbiVersion = 3;
+
+            // Not null-terminated
+        struct StringView {
+            const char *Data;
+            uint32      Length;
+        };
+
+            // Memory the host lends the tool for its results; it stays valid
+            // until the host has read them, and is never freed by the tool
+        struct HostArena {
+            void *  (*Allocate)(void * context, uint32 size);
+            void    *Context;
+        };
+
         struct PipeToolInstr {
-            const char *FileIn, *FileOut;
-            const char *Settings;
+            StringView  FileIn, FileOut;
+
+                // Settings as CBOR; the tool side keeps what it decoded per
+                // 'SettingsID', so a pipe's settings are read once, not per run
+            const uint8 *SettingsData;
+            uint32      SettingsLength;
+            uint64      SettingsID;
+
             const char *Exception;
 
             struct ReadFile {
@@ -58,17 +110,38 @@ namespace Pipeline {
             };
             uint32   WrittenFileCount;
             WrittenFile *WrittenFiles;
+
+                // Both lists and their paths are allocated from here
+            HostArena   Arena;
+
+                // Returns non-zero once the task is cancelled; may be null
+            int      (*CancelCallback)(const void *);
+            const void *CancelContext;
         };
 
         class IPipeTool {
         protected:
+                // Keep this the first slot in every version, so it can always
+                // be asked
+            virtual uint32 InternalGetAbiVersion() const noexcept = 0;
+
             virtual void InternalRun(PipeToolInstr &) const noexcept = 0;
             virtual void InternalCleanup(PipeToolInstr &) const noexcept = 0;
 
+                // Every instr in a batch is cleaned up with 'InternalCleanup'
+            virtual int  InternalSupportsBatch() const noexcept = 0;
+            virtual void InternalRunBatch(PipeToolInstr *, uint32 count) const noexcept = 0;
+
+            void CheckAbiVersion() const;
+
         public:
             virtual const char * GetToolName() const noexcept = 0;
-            
+
             void Run(Pipeline::PipeToolInstr &) const;
+
+                // Every instr gets its own error, or null if it went fine
+            bool SupportsBatch() const;
+            void RunBatch(std::vector<Pipeline::PipeToolInstr*> &, std::vector<BlackRoot::Debug::Exception*> & errors) const;
         };
     }
 
@@ -82,10 +155,20 @@ namespace Pipeline {
 
         const char * GetToolName() const noexcept override;
 
+        uint32 InternalGetAbiVersion() const noexcept final override;
+
         void InternalRun(DynLib::PipeToolInstr &) const noexcept final override;
         void InternalCleanup(DynLib::PipeToolInstr &) const noexcept final override;
+        int  InternalSupportsBatch() const noexcept final override;
+        void InternalRunBatch(DynLib::PipeToolInstr *, uint32 count) const noexcept final override;
             
         virtual void Run(PipeToolInstr &) const = 0;
+
+            // Tools with heavy setup can take many instrs with the same
+            // settings in one go; set 'errors[i]' for any instr that failed.
+            // Throwing fails the whole batch
+        virtual bool SupportsBatch() const { return false; }
+        virtual void RunBatch(std::vector<PipeToolInstr> &, std::vector<BlackRoot::Debug::Exception*> & errors) const;
     };
 
 }
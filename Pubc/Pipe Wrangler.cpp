@@ -2,6 +2,8 @@
  * License, v. 2.0. If a copy of the MPL was not distributed with this
  * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
 
+#include <algorithm>
+
 #include "BlackRoot/Pubc/Assert.h"
 #include "BlackRoot/Pubc/Threaded IO Stream.h"
 #include "BlackRoot/Pubc/Stringstream.h"
@@ -17,47 +19,224 @@ using namespace Hephaestus::Pipeline::Wrangler;
     // --------------------
 
 PipeWrangler::PipeWrangler()
-: Caller([&](){this->ThreadedCall();})
 {
     this->MaxThreadCount    = std::thread::hardware_concurrency();
+    this->QueuedTaskCount   = 0;
+    this->NextSequence      = 0;
+    this->NextWorker        = 0;
+    this->MaxBatchSize      = 64;
+    this->Stopping          = false;
 }
 
 PipeWrangler::~PipeWrangler()
 {
 }
 
-    //  Cycle
+    //  Workers
     // --------------------
 
-void PipeWrangler::ThreadedCall()
+void PipeWrangler::WorkerLoop(std::size_t index)
 {
-    using cout = BlackRoot::Util::Cout;
+    while (true) {
+        Task task;
 
-    std::unique_lock<std::mutex> lk(this->MxTasks);
+        if (this->TakeTask(index, task) ||
+            this->StealTask(index, task, false)) {
+            this->RunTaskOrBatch(index, task);
+            continue;
+        }
+
+            // Somebody may hold a lock we skipped; only if a blocking pass
+            // also finds nothing is there really nothing to do
+        if (this->QueuedTaskCount > 0 && this->StealTask(index, task, true)) {
+            this->RunTaskOrBatch(index, task);
+            continue;
+        }
+
+            // Park until new tasks arrive; the count is checked under the
+            // same lock the submitter notifies under, so no wake is lost
+        std::unique_lock<std::mutex> lk(this->MxPark);
+        this->CvPark.wait(lk, [&]{ return this->Stopping || this->QueuedTaskCount > 0; });
+        if (this->Stopping)
+            return;
+    }
+}
 
-    if (this->Tasks.size() == 0)
+void PipeWrangler::RunTaskOrBatch(std::size_t index, Task & task)
+{
+    if (task.BatchKey.size() == 0) {
+        this->RunTask(task);
         return;
-    
-    auto task = std::move(this->Tasks.front());
-    this->Tasks.erase(this->Tasks.begin());
+    }
+
+        // Take along whatever else waits for the same tool and settings
+    std::vector<Task> batch;
+    batch.push_back(std::move(task));
+    this->CollectBatch(index, batch);
+    this->RunBatch(batch);
+}
+
+bool PipeWrangler::TakeTask(std::size_t index, Task & task)
+{
+    auto & worker = *this->Workers[index];
+
+    std::unique_lock<std::mutex> lk(worker.MxTasks);
+    if (worker.Tasks.size() == 0)
+        return false;
+
+    std::pop_heap(worker.Tasks.begin(), worker.Tasks.end());
+    task = std::move(worker.Tasks.back());
+    worker.Tasks.pop_back();
     lk.unlock();
 
-    WranglerTaskResult result;
-    result.Exception = nullptr;
-    result.UniqueID = task.OriginTask->UniqueID;
+    this->QueuedTaskCount -= 1;
+    return true;
+}
+
+bool PipeWrangler::StealTask(std::size_t index, Task & task, bool block)
+{
+        // Start with our neighbour, so thieves spread out over the victims
+    auto count = this->Workers.size();
+    for (std::size_t i = 1; i < count; i++) {
+        auto & victim = *this->Workers[(index + i) % count];
+
+        std::unique_lock<std::mutex> lk(victim.MxTasks, std::defer_lock);
+        if (block) {
+            lk.lock();
+        }
+        else if (!lk.try_lock()) {
+            continue;
+        }
+
+        if (victim.Tasks.size() == 0)
+            continue;
+
+            // We take the top of the heap; the victim is busy, so it is best
+            // if the most urgent of its tasks starts now
+        std::pop_heap(victim.Tasks.begin(), victim.Tasks.end());
+        task = std::move(victim.Tasks.back());
+        victim.Tasks.pop_back();
+        lk.unlock();
+
+        this->QueuedTaskCount -= 1;
+        return true;
+    }
+
+    return false;
+}
+
+bool PipeWrangler::StartTask(Task & task, std::string & settings, WranglerTaskResult & result)
+{
+    result.Exception  = nullptr;
+    result.UniqueID   = task.OriginTask->UniqueID;
+    result.Generation = task.OriginTask->Generation;
+    result.Cancelled  = false;
+    result.FromCache  = false;
+    result.ProcessDuration = std::chrono::milliseconds(0);
+
+    auto & cancel = task.OriginTask->Cancel;
     
+        // A task superseded while it was queued is not worth starting
+    if (cancel && cancel->load()) {
+        result.Cancelled = true;
+        task.OriginTask->Callback(std::move(result));
+        delete task.OriginTask;
+        return false;
+    }
+
+        // The tool takes the settings, so keep what the cache needs
+    if (this->Cache.IsEnabled()) {
+        settings = task.OriginTask->Settings.dump();
+    }
+
+        // If nothing the previous run read has changed since some run we
+        // remember, we can put back what that run wrote
+    auto startTime = std::chrono::system_clock::now();
+    if (this->Cache.Restore(*task.OriginTask, settings, task.OriginTask->PreviousReads, result)) {
+        result.FromCache       = true;
+        result.ProcessDuration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - startTime);
+        task.OriginTask->Callback(std::move(result));
+        delete task.OriginTask;
+        return false;
+    }
+
+    return true;
+}
+
+void PipeWrangler::PrepareInstr(Task & task, Pipeline::PipeToolInstr & instr)
+{
+    instr.SetDefault();
+    if (task.OriginTask->Cancel) {
+        instr.SetCancelFlag(task.OriginTask->Cancel.get());
+    }
+
+    instr.FileIn    = task.OriginTask->FileIn;
+    instr.FileOut   = task.OriginTask->FileOut;
+    instr.Settings  = std::make_shared<const BlackRoot::Format::JSON>(std::move(task.OriginTask->Settings));
+    instr.Encoded   = task.OriginTask->Encoded;
+}
+
+void PipeWrangler::FinishTask(Task & task, const std::string & settings, Pipeline::PipeToolInstr & instr, WranglerTaskResult & result)
+{
+    using cout = BlackRoot::Util::Cout;
+
+    auto & cancel = task.OriginTask->Cancel;
+
+        // Whatever a cancelled tool did, nobody is waiting for it
+    if (cancel && cancel->load()) {
+        result.Cancelled = true;
+        delete result.Exception;
+        result.Exception = nullptr;
+    }
+
+    if (result.Exception) {
+        cout{} << std::endl << "Pipe error: " << task.OriginTask->ToolName << std::endl
+            << " " << task.OriginTask->FileIn << std::endl
+            << " " << task.OriginTask->FileOut << std::endl
+            << " " << instr.Settings->dump() << std::endl
+            << " " << result.Exception->GetPrettyDescription() << std::endl;
+    }
+
+        // The instr is done with, so its paths can be moved rather than copied
+    result.ReadFiles.reserve(instr.ReadFiles.size());
+    for (auto & it : instr.ReadFiles) {
+        result.ReadFiles.push_back({ std::move(it.Path), it.LastChange });
+    }
+    result.WrittenFiles.reserve(instr.WrittenFiles.size());
+    for (auto & it : instr.WrittenFiles) {
+        result.WrittenFiles.push_back({ std::move(it.Path) });
+    }
+
+    if (!result.Exception && !result.Cancelled) {
+        this->Cache.Store(*task.OriginTask, settings, result);
+    }
+
+    task.OriginTask->Callback(std::move(result));
+    delete task.OriginTask;
+}
+
+void PipeWrangler::RunTask(Task & task)
+{
+    WranglerTaskResult result;
+    std::string settings;
+    if (!this->StartTask(task, settings, result))
+        return;
+
     Pipeline::PipeToolInstr instr;
+    this->PrepareInstr(task, instr);
 
     try {
         auto tool = this->FindTool(task.OriginTask->ToolName);
 
-        instr.FileIn    = task.OriginTask->FileIn;
-        instr.FileOut   = task.OriginTask->FileOut;
-        instr.Settings  = std::move(task.OriginTask->Settings);
-
         auto startTime = std::chrono::system_clock::now();
         tool->Run(instr);
         result.ProcessDuration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - startTime);
+
+            // A cancelled run may have stopped early, so it says nothing
+            // about how long this task takes
+        if (!instr.IsCancelled()) {
+            this->RecordDuration(*task.OriginTask, result.ProcessDuration);
+        }
     }
     catch (BlackRoot::Debug::Exception * e) {
         result.Exception = e;
@@ -69,36 +248,157 @@ void PipeWrangler::ThreadedCall()
         result.Exception = new BlackRoot::Debug::Exception("Unknown error trying to process task", {});
     }
 
-    if (result.Exception) {
-        cout{} << std::endl << "Pipe error: " << task.OriginTask->ToolName << std::endl
-            << " " << task.OriginTask->FileIn << std::endl
-            << " " << task.OriginTask->FileOut << std::endl
-            << " " << task.OriginTask->Settings.dump() << std::endl
-            << " " << result.Exception->GetPrettyDescription() << std::endl;
+    this->FinishTask(task, settings, instr, result);
+}
+
+void PipeWrangler::RunBatch(std::vector<Task> & tasks)
+{
+    std::vector<Task> batch;
+    std::vector<std::string> settings;
+    std::vector<WranglerTaskResult> results;
+
+    for (auto & task : tasks) {
+        WranglerTaskResult result;
+        std::string taskSettings;
+        if (!this->StartTask(task, taskSettings, result))
+            continue;
+
+        batch.push_back(std::move(task));
+        settings.push_back(std::move(taskSettings));
+        results.push_back(std::move(result));
     }
 
-    for (auto & it : instr.ReadFiles) {
-        result.ReadFiles.push_back({ it.Path, it.LastChange });
+    if (batch.size() == 0)
+        return;
+
+    std::vector<Pipeline::PipeToolInstr> instrs(batch.size());
+    std::vector<Pipeline::PipeToolInstr*> instrPtrs;
+    std::vector<BlackRoot::Debug::Exception*> errors(batch.size(), nullptr);
+    for (std::size_t i = 0; i < batch.size(); i++) {
+        this->PrepareInstr(batch[i], instrs[i]);
+        instrPtrs.push_back(&instrs[i]);
     }
-    for (auto & it : instr.WrittenFiles) {
-        result.WrittenFiles.push_back({ it.Path });
+
+    std::chrono::milliseconds duration(0);
+    try {
+        auto tool = this->FindTool(batch[0].OriginTask->ToolName);
+
+        auto startTime = std::chrono::system_clock::now();
+        tool->RunBatch(instrPtrs, errors);
+        duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - startTime);
+    }
+    catch (BlackRoot::Debug::Exception * e) {
+        for (auto & error : errors) {
+            delete error;
+            error = new BlackRoot::Debug::Exception(e->what(), {});
+        }
+        delete e;
+    }
+    catch (std::exception e) {
+        for (auto & error : errors) {
+            delete error;
+            error = new BlackRoot::Debug::Exception(e.what(), {});
+        }
+    }
+    catch (...) {
+        for (auto & error : errors) {
+            delete error;
+            error = new BlackRoot::Debug::Exception("Unknown error trying to process task", {});
+        }
     }
 
-    task.OriginTask->Callback(result);
-    delete task.OriginTask;
+        // We only know how long the batch took; every task gets its share
+    auto share = std::chrono::milliseconds(duration.count() / int64(batch.size()));
+
+    for (std::size_t i = 0; i < batch.size(); i++) {
+        results[i].Exception       = errors[i];
+        results[i].ProcessDuration = share;
+
+        if (!errors[i] && !instrs[i].IsCancelled()) {
+            this->RecordDuration(*batch[i].OriginTask, share);
+        }
+
+        this->FinishTask(batch[i], settings[i], instrs[i], results[i]);
+    }
+}
+
+void PipeWrangler::CollectBatch(std::size_t index, std::vector<Task> & batch)
+{
+    auto & worker = *this->Workers[index];
+    auto key      = batch[0].BatchKey;
+
+        // Only our own heap; a wildcard's tasks are dealt out over all
+        // workers, so every worker finds its share of them here
+    std::unique_lock<std::mutex> lk(worker.MxTasks);
+
+    std::size_t kept = 0, taken = 0;
+    for (std::size_t i = 0; i < worker.Tasks.size(); i++) {
+        auto & task = worker.Tasks[i];
+        if (batch.size() < this->MaxBatchSize && task.BatchKey == key) {
+            batch.push_back(std::move(task));
+            taken++;
+            continue;
+        }
+        if (kept != i) {
+            worker.Tasks[kept] = std::move(task);
+        }
+        kept++;
+    }
+
+    if (taken == 0)
+        return;
+
+    worker.Tasks.resize(kept);
+    std::make_heap(worker.Tasks.begin(), worker.Tasks.end());
+    lk.unlock();
+
+    this->QueuedTaskCount -= taken;
 }
 
     //  Control
     // --------------------
 
+void PipeWrangler::SetActionCacheDirectory(const BlackRoot::IO::FilePath path)
+{
+    this->Cache.SetDirectory(path);
+}
+
 void PipeWrangler::Begin()
 {
-    this->Caller.SetMaxThreadCount(this->MaxThreadCount);
+    this->Stopping = false;
+
+    auto count = std::max(1, this->MaxThreadCount);
+    for (int i = 0; i < count; i++) {
+        this->Workers.push_back(std::make_unique<Worker>());
+    }
+    for (int i = 0; i < count; i++) {
+        this->Workers[i]->Thread = std::thread([this, i] {
+            this->WorkerLoop(std::size_t(i));
+        });
+    }
 }
 
 void PipeWrangler::EndAndWait()
 {
-    this->Caller.EndAndWait();
+    std::unique_lock<std::mutex> lk(this->MxPark);
+    this->Stopping = true;
+    lk.unlock();
+
+    this->CvPark.notify_all();
+
+    for (auto & worker : this->Workers) {
+        worker->Thread.join();
+    }
+
+        // Tasks nobody got to are dropped; we are shutting down, and whoever
+        // sent them will send them again next time
+    for (auto & worker : this->Workers) {
+        for (auto & task : worker->Tasks) {
+            delete task.OriginTask;
+        }
+    }
+    this->Workers.clear();
+    this->QueuedTaskCount = 0;
 }
 
     //  Tools
@@ -110,6 +410,22 @@ void PipeWrangler::RegisterTool(const DynLib::IPipeTool * tool)
     this->Tools[tool->GetToolName()] = tool;
 }
 
+std::string PipeWrangler::GetBatchKey(const Pipeline::WranglerTask & task)
+{
+    std::shared_lock<std::shared_mutex> lk(this->MxTools);
+
+    auto found = this->Tools.find(task.ToolName);
+    if (found == this->Tools.end() || !found->second->SupportsBatch())
+        return {};
+    lk.unlock();
+
+        // Only tasks with equal settings go in one batch
+    std::string key = task.ToolName;
+    key.push_back('\0');
+    key.append(task.Settings.dump());
+    return key;
+}
+
 const DynLib::IPipeTool * PipeWrangler::FindTool(std::string str)
 {
     std::shared_lock<std::shared_mutex> lk(this->MxTools);
@@ -131,18 +447,105 @@ void PipeWrangler::AsynchReceiveTasks(const WranglerTaskList &list)
     for (auto & inTask : list) {
         Task task;
         task.OriginTask = new WranglerTask(inTask);
+        task.Priority   = this->GetExpectedDuration(inTask) + inTask.DownstreamEstimate.count();
+        task.BatchKey   = this->GetBatchKey(inTask);
         newTasks.push_back(std::move(task));
     }
 
-    std::unique_lock<std::mutex> lk(this->MxTasks);
-    this->Tasks.insert(this->Tasks.end(), std::make_move_iterator(newTasks.begin()), 
-                                          std::make_move_iterator(newTasks.end()));
+    if (newTasks.size() == 0)
+        return;
 
-    // TODO: sort
+    DbAssertMsgFatal(this->Workers.size() > 0, "Wrangler received tasks before it began");
 
+    for (auto & task : newTasks) {
+        task.Sequence = this->NextSequence++;
+    }
+
+        // Count first, so a worker that finds a task never sees fewer than
+        // zero queued; at worst one briefly looks for a task not yet dealt
+    this->QueuedTaskCount += newTasks.size();
+
+        // Deal the batch out round-robin, taking every worker's lock once;
+        // workers steal to even out whatever the durations make uneven.
+        // Only the monitor sends tasks, so 'NextWorker' needs no lock.
+    auto count = this->Workers.size();
+    auto first = this->NextWorker;
+    this->NextWorker = (first + newTasks.size()) % count;
+
+    for (std::size_t w = 0; w < count && w < newTasks.size(); w++) {
+        auto & worker = *this->Workers[(first + w) % count];
+
+        std::unique_lock<std::mutex> lk(worker.MxTasks);
+        for (std::size_t i = w; i < newTasks.size(); i += count) {
+            worker.Tasks.push_back(std::move(newTasks[i]));
+            std::push_heap(worker.Tasks.begin(), worker.Tasks.end());
+        }
+    }
+
+        // Pass through the park lock, so no worker is between checking the
+        // count and starting to wait when we notify
+    std::unique_lock<std::mutex> lk(this->MxPark);
     lk.unlock();
 
-    this->Caller.RequestCalls(newTasks.size());
+    if (newTasks.size() == 1) {
+        this->CvPark.notify_one();
+    }
+    else {
+        this->CvPark.notify_all();
+    }
+}
+
+    //  History
+    // --------------------
+
+void PipeWrangler::DurationHistory::Add(double duration)
+{
+        // Weigh recent runs heavier, as inputs tend to grow over time
+    if (this->Samples == 0) {
+        this->Average = duration;
+    }
+    else {
+        this->Average += (duration - this->Average) * 0.3;
+    }
+    this->Samples += 1;
+}
+
+std::string PipeWrangler::GetHistoryKey(const Pipeline::WranglerTask & task)
+{
+    std::string key = task.ToolName;
+    key.push_back('\0');
+    key.append(task.FileIn.string());
+    return key;
+}
+
+int64 PipeWrangler::GetExpectedDuration(const Pipeline::WranglerTask & task)
+{
+    std::shared_lock<std::shared_mutex> lk(this->MxHistory);
+
+        // If we never ran this input, assume it takes as long as the tool
+        // usually does
+    auto found = this->TaskHistory.find(this->GetHistoryKey(task));
+    if (found != this->TaskHistory.end())
+        return int64(found->second.Average);
+
+    found = this->ToolHistory.find(task.ToolName);
+    if (found != this->ToolHistory.end())
+        return int64(found->second.Average);
+
+    return 0;
+}
+
+void PipeWrangler::RecordDuration(const Pipeline::WranglerTask & task, std::chrono::milliseconds duration)
+{
+    auto key = this->GetHistoryKey(task);
+
+    std::unique_lock<std::shared_mutex> lk(this->MxHistory);
+
+    auto & history = this->TaskHistory.emplace(std::move(key), DurationHistory{ 0.0, 0 }).first->second;
+    history.Add(double(duration.count()));
+
+    auto & tool = this->ToolHistory.emplace(task.ToolName, DurationHistory{ 0.0, 0 }).first->second;
+    tool.Add(double(duration.count()));
 }
     //  Util
     // --------------------
@@ -9,16 +9,20 @@
 
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
 #include <vector>
 #include <map>
+#include <unordered_map>
 
 #include "BlackRoot/Pubc/Number Types.h"
 #include "BlackRoot/Pubc/Files Types.h"
 #include "BlackRoot/Pubc/JSON.h"
-#include "BlackRoot/Pubc/Threaded Caller.h"
 
 #include "HephaestusBase/Pubc/Pipeline Meta.h"
 #include "HephaestusBase/Pubc/Pipe Tool.h"
+#include "HephaestusBase/Pubc/Action Cache.h"
 
 #include <shared_mutex>
 
@@ -33,31 +37,92 @@ namespace Wrangler {
     protected:
         struct Task {
             Pipeline::WranglerTask  *OriginTask;
+
+                // Expected duration of this task and everything waiting on it;
+                // ties go to whoever came first
+            int64                   Priority;
+            uint64                  Sequence;
+
+                // Tool and settings, if the tool can run a batch at once;
+                // tasks with the same key may run in one call
+            std::string             BatchKey;
+
+            bool operator<(const Task & rh) const {
+                if (this->Priority != rh.Priority)
+                    return this->Priority < rh.Priority;
+                return this->Sequence > rh.Sequence;
+            }
         };
 
-        BlackRoot::Util::ThreadedCaller     Caller;
+            // Running average of how long things took, per tool and input
+        struct DurationHistory {
+            double      Average;
+            uint32      Samples;
 
-        int      MaxThreadCount;
+            void    Add(double);
+        };
+        using HistoryMap = std::unordered_map<std::string, DurationHistory>;
+
+            // Every worker has its own max-heap on 'Priority', so it always
+            // runs the longest chain it has; a worker that runs dry steals
+            // the top of somebody else's heap before it parks
+        struct Worker {
+            std::mutex          MxTasks;
+            std::vector<Task>   Tasks;
+            std::thread         Thread;
+        };
+
+        int          MaxThreadCount;
+        std::size_t  MaxBatchSize;
 
         std::shared_mutex   MxTools;
         ToolMap             Tools;
         
-        std::mutex          MxTasks;
-        std::vector<Task>   Tasks;
+        std::vector<std::unique_ptr<Worker>>    Workers;
+        std::atomic<std::size_t>                QueuedTaskCount;
+        std::atomic<uint64>                     NextSequence;
+        std::size_t                             NextWorker;
+
+        std::mutex                  MxPark;
+        std::condition_variable     CvPark;
+        bool                        Stopping;
+
+        void    WorkerLoop(std::size_t);
+        bool    TakeTask(std::size_t, Task &);
+        bool    StealTask(std::size_t, Task &, bool block);
+        void    RunTaskOrBatch(std::size_t, Task &);
+        void    RunTask(Task &);
+        void    RunBatch(std::vector<Task> &);
+        void    CollectBatch(std::size_t, std::vector<Task> &);
+
+        bool    StartTask(Task &, std::string & settings, Pipeline::WranglerTaskResult &);
+        void    PrepareInstr(Task &, Pipeline::PipeToolInstr &);
+        void    FinishTask(Task &, const std::string & settings, Pipeline::PipeToolInstr &, Pipeline::WranglerTaskResult &);
+
+        std::shared_mutex   MxHistory;
+        HistoryMap          TaskHistory, ToolHistory;
+
+        std::string  GetHistoryKey(const Pipeline::WranglerTask &);
+        int64        GetExpectedDuration(const Pipeline::WranglerTask &);
+        void         RecordDuration(const Pipeline::WranglerTask &, std::chrono::milliseconds);
+
+            // Disabled until given a directory; only set before 'Begin'
+        ActionCache         Cache;
 
     public:
         PipeWrangler();
         ~PipeWrangler();
 
-        void    ThreadedCall();
-        
         void    AsynchReceiveTasks(const WranglerTaskList&) override;
 
+        void    SetActionCacheDirectory(const BlackRoot::IO::FilePath);
+
         void    Begin();
         void    EndAndWait();
 
         void    RegisterTool(const DynLib::IPipeTool*);
         const DynLib::IPipeTool * FindTool(std::string);
+        std::string GetBatchKey(const Pipeline::WranglerTask &);
 
         std::string GetAvailableTools();
     };
@@ -8,6 +8,8 @@
 #pragma once
 
 #include <functional>
+#include <memory>
+#include <atomic>
 #include <vector>
 
 #include "BlackRoot/Pubc/Exception.h"
@@ -19,6 +21,12 @@ namespace Pipeline {
     
     using ID    = std::size_t;
 
+    struct EncodedSettings;
+
+        // Shared between whoever sent a task and whoever runs it; once set,
+        // the task is superseded and its result is of no use to anybody
+    using CancelToken = std::shared_ptr<std::atomic<bool>>;
+
     struct WranglerTaskResult {
         using Path      = BlackRoot::IO::FilePath;
         using JSON      = BlackRoot::Format::JSON;
@@ -26,8 +34,17 @@ namespace Pipeline {
         using Duration  = std::chrono::milliseconds;
 
         std::size_t  UniqueID;
+        uint64       Generation;
         Duration     ProcessDuration;
 
+            // Set if the task was cancelled before or while running; its
+            // outputs may be incomplete
+        bool         Cancelled;
+
+            // Set if the outputs were put back from the action cache, and
+            // the tool never ran
+        bool         FromCache;
+
         BlackRoot::Debug::Exception * Exception;
         
         struct ReadFile {
@@ -46,13 +63,27 @@ namespace Pipeline {
         using JSON  = BlackRoot::Format::JSON;
 
         std::size_t  UniqueID;
+        uint64       Generation;
+        CancelToken  Cancel;
         
         std::string  ToolName;
         Path         FileIn, FileOut;
 
         JSON         Settings;
 
-        std::function<void(const WranglerTaskResult)> Callback;
+            // 'Settings' encoded for the tool; shared by every run of a pipe
+        std::shared_ptr<const EncodedSettings>  Encoded;
+
+            // What the previous run of this pipe read; the action cache looks
+            // up outputs by their current contents
+        std::vector<Path>   PreviousReads;
+
+            // How long whatever waits on our output is expected to take; the
+            // wrangler adds this to our own expected duration when ordering
+        std::chrono::milliseconds   DownstreamEstimate{ 0 };
+
+            // Called from a worker thread; the result is handed over, not copied
+        std::function<void(WranglerTaskResult&&)> Callback;
     };
 
     using WranglerTaskList = std::vector<WranglerTask>;
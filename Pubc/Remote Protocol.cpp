@@ -0,0 +1,487 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include <cstring>
+#include <mutex>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+#include "BlackRoot/Pubc/Exception.h"
+#include "BlackRoot/Pubc/Stringstream.h"
+
+#include "HephaestusBase/Pubc/Remote Protocol.h"
+
+using namespace Hephaestus::Pipeline;
+using namespace Hephaestus::Pipeline::Remote;
+
+namespace {
+#ifdef _WIN32
+    const Socket::Handle InvalidHandle = Socket::Handle(INVALID_SOCKET);
+
+    void CloseHandle(Socket::Handle handle) {
+        ::closesocket(SOCKET(handle));
+    }
+
+    void EnsureSocketsStarted() {
+        static std::once_flag once;
+        std::call_once(once, [] {
+            WSADATA data;
+            ::WSAStartup(MAKEWORD(2, 2), &data);
+        });
+    }
+#else
+    const Socket::Handle InvalidHandle = -1;
+
+    void CloseHandle(Socket::Handle handle) {
+        ::close(handle);
+    }
+
+    void EnsureSocketsStarted() {
+    }
+#endif
+
+    struct Endpoint {
+        bool        IsUnix;
+        std::string Host, Port, Path;
+    };
+
+    Endpoint ParseEndpoint(const std::string str) {
+        Endpoint endpoint;
+        endpoint.IsUnix = false;
+
+        if (str.compare(0, 5, "unix:") == 0) {
+            endpoint.IsUnix = true;
+            endpoint.Path   = str.substr(5);
+                // Allow "unix:///path" as well as "unix:/path"
+            if (endpoint.Path.compare(0, 2, "//") == 0) {
+                endpoint.Path = endpoint.Path.substr(2);
+            }
+            return endpoint;
+        }
+
+        auto address = str;
+        if (address.compare(0, 6, "tcp://") == 0) {
+            address = address.substr(6);
+        }
+
+        auto colon = address.rfind(':');
+        if (colon == address.npos || colon + 1 == address.size()) {
+            throw new BlackRoot::Debug::Exception((std::stringstream() << "Endpoint '" << str << "' has no port.").str(), BRGenDbgInfo);
+        }
+        endpoint.Host = address.substr(0, colon);
+        endpoint.Port = address.substr(colon + 1);
+        if (endpoint.Host.size() == 0) {
+            endpoint.Host = "localhost";
+        }
+        return endpoint;
+    }
+
+    uint64 EncodeTime(BlackRoot::IO::FileTime time) {
+        return uint64(std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count());
+    }
+
+    BlackRoot::IO::FileTime DecodeTime(uint64 time) {
+        return BlackRoot::IO::FileTime(std::chrono::duration_cast<BlackRoot::IO::FileTime::duration>(std::chrono::nanoseconds(int64(time))));
+    }
+}
+
+    //  Socket
+    // --------------------
+
+Socket::Socket()
+{
+    this->Descriptor = InvalidHandle;
+}
+
+Socket::Socket(Socket && other)
+{
+    this->Descriptor = other.Descriptor;
+    this->UnixPath   = std::move(other.UnixPath);
+    other.Descriptor = InvalidHandle;
+    other.UnixPath.clear();
+}
+
+Socket::~Socket()
+{
+    this->Close();
+}
+
+Socket & Socket::operator=(Socket && other)
+{
+    if (this != &other) {
+        this->Close();
+        this->Descriptor = other.Descriptor;
+        this->UnixPath   = std::move(other.UnixPath);
+        other.Descriptor = InvalidHandle;
+        other.UnixPath.clear();
+    }
+    return *this;
+}
+
+Socket Socket::Connect(const std::string str)
+{
+    EnsureSocketsStarted();
+
+    auto endpoint = ParseEndpoint(str);
+    Socket sock;
+
+    if (endpoint.IsUnix) {
+#ifdef _WIN32
+        throw new BlackRoot::Debug::Exception("UNIX sockets are not supported on this platform.", BRGenDbgInfo);
+#else
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (endpoint.Path.size() >= sizeof(addr.sun_path)) {
+            throw new BlackRoot::Debug::Exception((std::stringstream() << "Socket path '" << endpoint.Path << "' is too long.").str(), BRGenDbgInfo);
+        }
+        std::strcpy(addr.sun_path, endpoint.Path.c_str());
+
+        sock.Descriptor = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (sock.Descriptor == InvalidHandle ||
+            ::connect(sock.Descriptor, (sockaddr*)&addr, sizeof(addr)) != 0) {
+            throw new BlackRoot::Debug::Exception((std::stringstream() << "Cannot connect to '" << str << "'.").str(), BRGenDbgInfo);
+        }
+        return sock;
+#endif
+    }
+
+    addrinfo hints = {};
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo * found = nullptr;
+    if (::getaddrinfo(endpoint.Host.c_str(), endpoint.Port.c_str(), &hints, &found) != 0) {
+        throw new BlackRoot::Debug::Exception((std::stringstream() << "Cannot resolve '" << str << "'.").str(), BRGenDbgInfo);
+    }
+
+    for (auto * it = found; it; it = it->ai_next) {
+        auto handle = Handle(::socket(it->ai_family, it->ai_socktype, it->ai_protocol));
+        if (handle == InvalidHandle)
+            continue;
+        if (::connect(handle, it->ai_addr, int(it->ai_addrlen)) == 0) {
+            sock.Descriptor = handle;
+            break;
+        }
+        CloseHandle(handle);
+    }
+    ::freeaddrinfo(found);
+
+    if (!sock.IsValid()) {
+        throw new BlackRoot::Debug::Exception((std::stringstream() << "Cannot connect to '" << str << "'.").str(), BRGenDbgInfo);
+    }
+
+        // Frames are small and we wait on every answer
+    int noDelay = 1;
+    ::setsockopt(sock.Descriptor, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+
+    return sock;
+}
+
+Socket Socket::Listen(const std::string str)
+{
+    EnsureSocketsStarted();
+
+    auto endpoint = ParseEndpoint(str);
+    Socket sock;
+
+    if (endpoint.IsUnix) {
+#ifdef _WIN32
+        throw new BlackRoot::Debug::Exception("UNIX sockets are not supported on this platform.", BRGenDbgInfo);
+#else
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (endpoint.Path.size() >= sizeof(addr.sun_path)) {
+            throw new BlackRoot::Debug::Exception((std::stringstream() << "Socket path '" << endpoint.Path << "' is too long.").str(), BRGenDbgInfo);
+        }
+        std::strcpy(addr.sun_path, endpoint.Path.c_str());
+
+            // A socket left behind by a worker that died is in our way
+        ::unlink(endpoint.Path.c_str());
+
+        sock.Descriptor = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (sock.Descriptor == InvalidHandle ||
+            ::bind(sock.Descriptor, (sockaddr*)&addr, sizeof(addr)) != 0 ||
+            ::listen(sock.Descriptor, 16) != 0) {
+            throw new BlackRoot::Debug::Exception((std::stringstream() << "Cannot listen on '" << str << "'.").str(), BRGenDbgInfo);
+        }
+        sock.UnixPath = endpoint.Path;
+        return sock;
+#endif
+    }
+
+    addrinfo hints = {};
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags    = AI_PASSIVE;
+
+        // Without a host we only listen on this machine; every interface
+        // has to be asked for with "*"
+    addrinfo * found = nullptr;
+    auto * host = endpoint.Host != "*" ? endpoint.Host.c_str() : nullptr;
+    if (::getaddrinfo(host, endpoint.Port.c_str(), &hints, &found) != 0) {
+        throw new BlackRoot::Debug::Exception((std::stringstream() << "Cannot resolve '" << str << "'.").str(), BRGenDbgInfo);
+    }
+
+    for (auto * it = found; it; it = it->ai_next) {
+        auto handle = Handle(::socket(it->ai_family, it->ai_socktype, it->ai_protocol));
+        if (handle == InvalidHandle)
+            continue;
+
+        int reuse = 1;
+        ::setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+        if (::bind(handle, it->ai_addr, int(it->ai_addrlen)) == 0 &&
+            ::listen(handle, 16) == 0) {
+            sock.Descriptor = handle;
+            break;
+        }
+        CloseHandle(handle);
+    }
+    ::freeaddrinfo(found);
+
+    if (!sock.IsValid()) {
+        throw new BlackRoot::Debug::Exception((std::stringstream() << "Cannot listen on '" << str << "'.").str(), BRGenDbgInfo);
+    }
+    return sock;
+}
+
+Socket Socket::Accept()
+{
+    Socket sock;
+    if (!this->IsValid())
+        return sock;
+
+    auto handle = Handle(::accept(this->Descriptor, nullptr, nullptr));
+    if (handle == InvalidHandle)
+        return sock;
+    sock.Descriptor = handle;
+
+    int noDelay = 1;
+    ::setsockopt(sock.Descriptor, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+
+    return sock;
+}
+
+bool Socket::IsValid() const
+{
+    return this->Descriptor != InvalidHandle;
+}
+
+bool Socket::SendAll(const void * data, std::size_t length)
+{
+    auto * bytes = static_cast<const char*>(data);
+    while (length > 0) {
+#ifdef _WIN32
+        auto sent = ::send(SOCKET(this->Descriptor), bytes, int(length), 0);
+#else
+        auto sent = ::send(this->Descriptor, bytes, length, MSG_NOSIGNAL);
+#endif
+        if (sent <= 0)
+            return false;
+        bytes  += sent;
+        length -= std::size_t(sent);
+    }
+    return true;
+}
+
+bool Socket::ReceiveAll(void * data, std::size_t length)
+{
+    auto * bytes = static_cast<char*>(data);
+    while (length > 0) {
+#ifdef _WIN32
+        auto received = ::recv(SOCKET(this->Descriptor), bytes, int(length), 0);
+#else
+        auto received = ::recv(this->Descriptor, bytes, length, 0);
+#endif
+        if (received <= 0)
+            return false;
+        bytes  += received;
+        length -= std::size_t(received);
+    }
+    return true;
+}
+
+bool Socket::SendFrame(const JSON & json)
+{
+    if (!this->IsValid())
+        return false;
+
+    auto body = json.dump();
+    if (body.size() > MaxFrameLength)
+        return false;
+
+        // Length and body go out in one buffer, so small frames are one packet
+    std::string frame(4 + body.size(), '\0');
+    uint32 length = uint32(body.size());
+    for (int i = 0; i < 4; i++) {
+        frame[i] = char((length >> (8 * i)) & 0xFF);
+    }
+    std::memcpy(&frame[4], body.data(), body.size());
+
+    return this->SendAll(frame.data(), frame.size());
+}
+
+bool Socket::ReceiveFrame(JSON & json, uint32 maxLength)
+{
+    if (!this->IsValid())
+        return false;
+
+    uint8 header[4];
+    if (!this->ReceiveAll(header, 4))
+        return false;
+
+    uint32 length = uint32(header[0]) | (uint32(header[1]) << 8) | (uint32(header[2]) << 16) | (uint32(header[3]) << 24);
+    if (length > maxLength)
+        return false;
+
+    std::string body(length, '\0');
+    if (length > 0 && !this->ReceiveAll(&body[0], length))
+        return false;
+
+    try {
+        json = JSON::parse(body);
+    }
+    catch (...) {
+        return false;
+    }
+    return json.is_object();
+}
+
+void Socket::Shutdown()
+{
+    if (!this->IsValid())
+        return;
+#ifdef _WIN32
+    ::shutdown(SOCKET(this->Descriptor), SD_BOTH);
+#else
+    ::shutdown(this->Descriptor, SHUT_RDWR);
+#endif
+}
+
+void Socket::Close()
+{
+    if (!this->IsValid())
+        return;
+
+    CloseHandle(this->Descriptor);
+    this->Descriptor = InvalidHandle;
+
+#ifndef _WIN32
+    if (this->UnixPath.size() > 0) {
+        ::unlink(this->UnixPath.c_str());
+        this->UnixPath.clear();
+    }
+#endif
+}
+
+    //  Messages
+    // --------------------
+
+bool Hephaestus::Pipeline::Remote::SecretsMatch(const std::string & lh, const std::string & rh)
+{
+        // Look at every byte of the longer one, so neither the length nor
+        // the first difference can be timed
+    std::size_t length = lh.size() > rh.size() ? lh.size() : rh.size();
+    unsigned char diff = lh.size() == rh.size() ? 0 : 1;
+    for (std::size_t i = 0; i < length; i++) {
+        unsigned char l = i < lh.size() ? (unsigned char)lh[i] : 0;
+        unsigned char r = i < rh.size() ? (unsigned char)rh[i] : 0;
+        diff |= l ^ r;
+    }
+    return diff == 0;
+}
+
+Socket::JSON Hephaestus::Pipeline::Remote::EncodeTask(uint64 wireID, const WranglerTask & task)
+{
+    Socket::JSON reads = Socket::JSON::array();
+    for (auto & it : task.PreviousReads) {
+        reads.push_back(it.string());
+    }
+
+    return {
+        { "type",       "task" },
+        { "id",         wireID },
+        { "tool",       task.ToolName },
+        { "in",         task.FileIn.string() },
+        { "out",        task.FileOut.string() },
+        { "settings",   task.Settings },
+        { "reads",      std::move(reads) },
+        { "downstream", task.DownstreamEstimate.count() }
+    };
+}
+
+void Hephaestus::Pipeline::Remote::DecodeTask(const Socket::JSON & json, WranglerTask & task)
+{
+    task.UniqueID   = std::size_t(json.at("id").get<uint64>());
+    task.Generation = 0;
+    task.ToolName   = json.at("tool").get<std::string>();
+    task.FileIn     = json.at("in").get<std::string>();
+    task.FileOut    = json.at("out").get<std::string>();
+    task.Settings   = json.at("settings");
+    task.DownstreamEstimate = std::chrono::milliseconds(json.value("downstream", int64(0)));
+
+    task.PreviousReads.clear();
+    for (auto & it : json.at("reads")) {
+        task.PreviousReads.push_back(it.get<std::string>());
+    }
+}
+
+Socket::JSON Hephaestus::Pipeline::Remote::EncodeResult(uint64 wireID, const WranglerTaskResult & result)
+{
+    Socket::JSON reads = Socket::JSON::array();
+    for (auto & it : result.ReadFiles) {
+        reads.push_back(Socket::JSON::array({ it.Path.string(), EncodeTime(it.LastChange) }));
+    }
+
+    Socket::JSON written = Socket::JSON::array();
+    for (auto & it : result.WrittenFiles) {
+        written.push_back(it.Path.string());
+    }
+
+    Socket::JSON json = {
+        { "type",       "result" },
+        { "id",         wireID },
+        { "duration",   result.ProcessDuration.count() },
+        { "cancelled",  result.Cancelled },
+        { "cached",     result.FromCache },
+        { "reads",      std::move(reads) },
+        { "written",    std::move(written) }
+    };
+    if (result.Exception) {
+        json["error"] = result.Exception->GetPrettyDescription();
+    }
+    return json;
+}
+
+void Hephaestus::Pipeline::Remote::DecodeResult(const Socket::JSON & json, WranglerTaskResult & result)
+{
+    result.ProcessDuration = std::chrono::milliseconds(json.value("duration", int64(0)));
+    result.Cancelled  = json.value("cancelled", false);
+    result.FromCache  = json.value("cached", false);
+    result.Exception  = nullptr;
+
+    for (auto & it : json.at("reads")) {
+        result.ReadFiles.push_back({ it.at(0).get<std::string>(), DecodeTime(it.at(1).get<uint64>()) });
+    }
+    for (auto & it : json.at("written")) {
+        result.WrittenFiles.push_back({ it.get<std::string>() });
+    }
+
+    auto error = json.find("error");
+    if (error != json.end() && error->is_string()) {
+        result.Exception = new BlackRoot::Debug::Exception(error->get<std::string>(), BRGenDbgInfo);
+    }
+}
\ No newline at end of file
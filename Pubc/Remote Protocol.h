@@ -0,0 +1,101 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+/* {quality} This is very much a sketch
+ */
+
+#pragma once
+
+#include <string>
+
+#include "BlackRoot/Pubc/Number Types.h"
+#include "BlackRoot/Pubc/JSON.h"
+
+#include "HephaestusBase/Pubc/Pipeline Meta.h"
+
+namespace Hephaestus {
+namespace Pipeline {
+namespace Remote {
+
+        // Every message is a json object, sent as a 4-byte little-endian
+        // length followed by that many bytes of json.
+        //  hello   both ways on connect; the wrangler sends the worker's
+        //          secret, the worker answers with its tools and slots, or
+        //          hangs up if the secret is wrong
+        //  task    wrangler to worker, one WranglerTask under a wire id
+        //  cancel  wrangler to worker, the task with that wire id is superseded
+        //  result  worker to wrangler, one WranglerTaskResult per task
+        // Paths are sent as they are; workers are expected to see the same
+        // file system under the same paths (a shared drive, or localhost).
+        // Nothing is encrypted; the secret only keeps out whoever does not
+        // know it, so keep workers on networks you trust.
+    const uint32 ProtocolVersion = 2;
+
+        // Frames larger than this are surely garbage
+    const uint32 MaxFrameLength = 64 * 1024 * 1024;
+
+        // Workers read the wrangler's hello with this cap, as whoever sends
+        // it has not shown the secret yet
+    const uint32 MaxHelloLength = 4 * 1024;
+
+        // Endpoints look like "tcp://host:port" or "unix:/path/to/socket";
+        // UNIX sockets are not available on Windows. Without a host, tcp
+        // means localhost; a host of "*" listens on every interface
+    class Socket {
+    public:
+#ifdef _WIN32
+        using Handle = uintptr_t;
+#else
+        using Handle = int;
+#endif
+        using JSON = BlackRoot::Format::JSON;
+
+    protected:
+        Handle      Descriptor;
+        std::string UnixPath;
+
+        bool    SendAll(const void *, std::size_t);
+        bool    ReceiveAll(void *, std::size_t);
+
+    public:
+        Socket();
+        Socket(const Socket &) = delete;
+        Socket(Socket &&);
+        ~Socket();
+
+        Socket & operator=(Socket &&);
+
+            // Both throw if the endpoint cannot be used
+        static Socket Connect(const std::string endpoint);
+        static Socket Listen(const std::string endpoint);
+
+            // Returns an invalid socket once the listener is shut down
+        Socket  Accept();
+
+        bool    IsValid() const;
+
+            // Both return false once the connection is gone; neither throws.
+            // Sending is not thread safe, receiving is done by a single thread;
+            // frames longer than maxLength end the connection
+        bool    SendFrame(const JSON &);
+        bool    ReceiveFrame(JSON &, uint32 maxLength = MaxFrameLength);
+
+            // Wakes whoever is blocked on this socket; closing is left to
+            // whoever owns it, once nobody else uses it
+        void    Shutdown();
+        void    Close();
+    };
+
+        // Compares in time that does not depend on where they differ
+    bool            SecretsMatch(const std::string &, const std::string &);
+
+    Socket::JSON    EncodeTask(uint64 wireID, const WranglerTask &);
+    void            DecodeTask(const Socket::JSON &, WranglerTask &);
+
+    Socket::JSON    EncodeResult(uint64 wireID, const WranglerTaskResult &);
+    void            DecodeResult(const Socket::JSON &, WranglerTaskResult &);
+
+}
+}
+}
\ No newline at end of file
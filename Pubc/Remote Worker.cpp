@@ -0,0 +1,217 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include "BlackRoot/Pubc/Assert.h"
+#include "BlackRoot/Pubc/Threaded IO Stream.h"
+#include "BlackRoot/Pubc/Stringstream.h"
+
+#include "HephaestusBase/Pubc/Remote Worker.h"
+
+using namespace Hephaestus::Pipeline;
+using namespace Hephaestus::Pipeline::Wrangler;
+
+    //  Setup
+    // --------------------
+
+RemoteWorker::RemoteWorker()
+{
+    this->Stopping = false;
+}
+
+RemoteWorker::~RemoteWorker()
+{
+}
+
+void RemoteWorker::RegisterTool(const DynLib::IPipeTool * tool)
+{
+    this->Wrangler.RegisterTool(tool);
+}
+
+void RemoteWorker::SetActionCacheDirectory(const BlackRoot::IO::FilePath path)
+{
+    this->Wrangler.SetActionCacheDirectory(path);
+}
+
+bool RemoteWorker::IsRunning() const
+{
+    return this->Listener.IsValid();
+}
+
+    //  Control
+    // --------------------
+
+void RemoteWorker::Begin(const std::string endpoint, const std::string secret)
+{
+    using cout = BlackRoot::Util::Cout;
+
+    DbAssertMsgFatal(!this->Listener.IsValid(), "Worker is already running");
+
+    if (secret.size() == 0) {
+        throw new BlackRoot::Debug::Exception("A worker needs a secret to check connections against.", BRGenDbgInfo);
+    }
+
+    this->Secret   = secret;
+    this->Listener = Remote::Socket::Listen(endpoint);
+    this->Stopping = false;
+
+    this->Wrangler.Begin();
+
+    this->AcceptThread = std::thread([this] {
+        this->AcceptLoop();
+    });
+
+    cout{} << "Worker listening on " << endpoint << std::endl
+        << " " << this->Wrangler.GetAvailableTools() << std::endl << std::endl;
+}
+
+void RemoteWorker::EndAndWait()
+{
+    if (!this->Listener.IsValid())
+        return;
+
+    this->Stopping = true;
+    this->Listener.Shutdown();
+    this->AcceptThread.join();
+    this->Listener.Close();
+
+    std::unique_lock<std::mutex> lk(this->MxConnections);
+    auto connections = std::move(this->Connections);
+    this->Connections.clear();
+    lk.unlock();
+
+    for (auto & connection : connections) {
+        connection->Socket.Shutdown();
+    }
+    for (auto & connection : connections) {
+        connection->Reader.join();
+    }
+
+        // Results of tasks still running have nowhere to go; the wrangler
+        // runs them out, and their callbacks find the connections closed
+    this->Wrangler.EndAndWait();
+}
+
+    //  Connections
+    // --------------------
+
+void RemoteWorker::AcceptLoop()
+{
+    while (!this->Stopping) {
+        auto socket = this->Listener.Accept();
+        if (!socket.IsValid()) {
+            if (this->Stopping)
+                return;
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+
+        auto connection = std::make_shared<Connection>();
+        connection->Socket = std::move(socket);
+        connection->Open   = true;
+
+        std::unique_lock<std::mutex> lk(this->MxConnections);
+
+            // Forget connections that are long gone
+        for (auto it = this->Connections.begin(); it != this->Connections.end(); ) {
+            if ((*it)->Open) {
+                ++it;
+                continue;
+            }
+            (*it)->Reader.join();
+            it = this->Connections.erase(it);
+        }
+
+        connection->Reader = std::thread([this, connection] {
+            this->ConnectionLoop(connection);
+        });
+        this->Connections.push_back(std::move(connection));
+    }
+}
+
+void RemoteWorker::ConnectionLoop(ConnectionPtr connection)
+{
+    Remote::Socket::JSON frame;
+
+        // Nobody learns anything about us, nor gets us to read much, before
+        // showing the secret
+    if (connection->Socket.ReceiveFrame(frame, Remote::MaxHelloLength) &&
+        frame.is_object() &&
+        frame.value("type", "") == "hello" &&
+        frame.value("version", uint32(0)) == Remote::ProtocolVersion &&
+        Remote::SecretsMatch(frame.value("secret", std::string()), this->Secret)) {
+        std::unique_lock<std::mutex> lk(connection->MxSend);
+        connection->Socket.SendFrame({
+            { "type",    "hello" },
+            { "version", Remote::ProtocolVersion },
+            { "slots",   std::max(1u, std::thread::hardware_concurrency()) },
+            { "tools",   this->Wrangler.GetAvailableTools() }
+        });
+    }
+    else {
+        frame = nullptr;
+    }
+
+        // Anything but a matching hello and we stop talking
+    bool valid = frame.is_object();
+
+    while (valid && connection->Socket.ReceiveFrame(frame)) {
+        auto type = frame.value("type", "");
+
+        if (type == "task") {
+            try {
+                this->ReceiveTask(connection, frame);
+            }
+            catch (...) {
+                break;
+            }
+        }
+        else if (type == "cancel") {
+            std::unique_lock<std::mutex> lk(connection->MxRunning);
+            auto found = connection->Running.find(frame.value("id", uint64(0)));
+            if (found != connection->Running.end()) {
+                found->second->store(true);
+            }
+        }
+    }
+
+        // Nobody is waiting for what this connection asked of us
+    connection->Open = false;
+    connection->Socket.Shutdown();
+
+    std::unique_lock<std::mutex> lk(connection->MxRunning);
+    for (auto & it : connection->Running) {
+        it.second->store(true);
+    }
+}
+
+void RemoteWorker::ReceiveTask(ConnectionPtr connection, const Remote::Socket::JSON & frame)
+{
+    WranglerTask task;
+    Remote::DecodeTask(frame, task);
+
+    uint64 wireID = uint64(task.UniqueID);
+    task.Cancel   = std::make_shared<std::atomic<bool>>(false);
+
+    std::unique_lock<std::mutex> lk(connection->MxRunning);
+    connection->Running[wireID] = task.Cancel;
+    lk.unlock();
+
+        // The callback keeps the connection alive, so its socket is never
+        // closed under a worker thread still sending on it
+    task.Callback = [connection, wireID](WranglerTaskResult && result) {
+        std::unique_lock<std::mutex> lk(connection->MxRunning);
+        connection->Running.erase(wireID);
+        lk.unlock();
+
+        if (connection->Open) {
+            std::unique_lock<std::mutex> sendLock(connection->MxSend);
+            connection->Socket.SendFrame(Remote::EncodeResult(wireID, result));
+        }
+
+        delete result.Exception;
+    };
+
+    std::unique_lock<std::mutex> wranglerLock(this->MxWrangler);
+    this->Wrangler.AsynchReceiveTasks({ task });
+}
\ No newline at end of file
@@ -0,0 +1,84 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+/* {quality} This is very much a sketch
+ */
+
+#pragma once
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <string>
+#include <unordered_map>
+
+#include "BlackRoot/Pubc/Number Types.h"
+#include "BlackRoot/Pubc/Files Types.h"
+
+#include "HephaestusBase/Pubc/Pipeline Meta.h"
+#include "HephaestusBase/Pubc/Pipe Wrangler.h"
+#include "HephaestusBase/Pubc/Remote Protocol.h"
+
+namespace Hephaestus {
+namespace Pipeline {
+namespace Wrangler {
+
+        // The other end of RemoteWrangler; listens on an endpoint and runs
+        // whatever tasks come in on its own local wrangler, sending results
+        // back over the connection the task came from.
+        // Any number of pipelines may connect, as long as their hello
+        // carries our secret; tasks of a connection that goes away are
+        // cancelled.
+        // Tools may run programs and write files as we are, so the secret is
+        // not optional.
+    class RemoteWorker {
+    protected:
+        struct Connection {
+            Remote::Socket      Socket;
+            std::mutex          MxSend;
+            std::thread         Reader;
+            std::atomic<bool>   Open;
+
+            std::mutex          MxRunning;
+            std::unordered_map<uint64, CancelToken>  Running;
+        };
+        using ConnectionPtr = std::shared_ptr<Connection>;
+
+        PipeWrangler                Wrangler;
+
+            // The local wrangler expects a single sender
+        std::mutex                  MxWrangler;
+
+        std::string                 Secret;
+
+        Remote::Socket              Listener;
+        std::thread                 AcceptThread;
+        std::atomic<bool>           Stopping;
+
+        std::mutex                  MxConnections;
+        std::vector<ConnectionPtr>  Connections;
+
+        void    AcceptLoop();
+        void    ConnectionLoop(ConnectionPtr);
+        void    ReceiveTask(ConnectionPtr, const Remote::Socket::JSON &);
+
+    public:
+        RemoteWorker();
+        ~RemoteWorker();
+
+        void    RegisterTool(const DynLib::IPipeTool*);
+        void    SetActionCacheDirectory(const BlackRoot::IO::FilePath);
+
+        bool    IsRunning() const;
+
+            // Throws if we cannot listen on the endpoint, or have no secret
+        void    Begin(const std::string endpoint, const std::string secret);
+        void    EndAndWait();
+    };
+
+}
+}
+}
\ No newline at end of file
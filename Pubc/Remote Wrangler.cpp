@@ -0,0 +1,365 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include <algorithm>
+
+#include "BlackRoot/Pubc/Assert.h"
+#include "BlackRoot/Pubc/Threaded IO Stream.h"
+#include "BlackRoot/Pubc/Stringstream.h"
+
+#include "HephaestusBase/Pubc/Remote Wrangler.h"
+
+using namespace Hephaestus::Pipeline;
+using namespace Hephaestus::Pipeline::Wrangler;
+
+namespace {
+        // How often tokens of tasks in flight are looked at
+    const auto CancelPollInterval = std::chrono::milliseconds(50);
+
+        // Longest chain on top
+    bool QueuedBefore(const WranglerTask & lh, const WranglerTask & rh) {
+        return lh.DownstreamEstimate < rh.DownstreamEstimate;
+    }
+}
+
+    //  Setup
+    // --------------------
+
+RemoteWrangler::RemoteWrangler()
+{
+    this->NextWireID = 1;
+    this->Stopping   = false;
+}
+
+RemoteWrangler::~RemoteWrangler()
+{
+}
+
+void RemoteWrangler::SetEndpoints(std::vector<std::string> endpoints)
+{
+    this->Endpoints = std::move(endpoints);
+}
+
+void RemoteWrangler::SetSecret(const std::string secret)
+{
+    this->Secret = secret;
+}
+
+    //  Control
+    // --------------------
+
+void RemoteWrangler::Begin()
+{
+    using cout = BlackRoot::Util::Cout;
+
+    this->Stopping = false;
+
+    for (auto & endpoint : this->Endpoints) {
+        auto connection = std::make_unique<Connection>();
+        connection->Endpoint = endpoint;
+        connection->Slots    = 1;
+        connection->Alive    = false;
+
+            // A worker that is not there now is simply not used
+        try {
+            connection->Socket = Remote::Socket::Connect(endpoint);
+
+            Remote::Socket::JSON hello;
+                // A worker that does not like our secret just hangs up
+            if (!connection->Socket.SendFrame({ { "type", "hello" }, { "version", Remote::ProtocolVersion }, { "secret", this->Secret } }) ||
+                !connection->Socket.ReceiveFrame(hello) ||
+                !hello.is_object() ||
+                hello.value("type", "") != "hello") {
+                throw new BlackRoot::Debug::Exception("Worker did not say hello; is the secret right?", BRGenDbgInfo);
+            }
+            if (hello.value("version", uint32(0)) != Remote::ProtocolVersion) {
+                throw new BlackRoot::Debug::Exception("Worker speaks a different protocol version.", BRGenDbgInfo);
+            }
+
+            connection->Slots = std::max(uint32(1), hello.value("slots", uint32(1)));
+            connection->Alive = true;
+
+            cout{} << "Connected to worker " << endpoint << " (" << connection->Slots << " slots)" << std::endl
+                << " " << hello.value("tools", std::string()) << std::endl << std::endl;
+        }
+        catch (BlackRoot::Debug::Exception * e) {
+            cout{} << "Cannot use worker " << endpoint << std::endl
+                << " " << e->GetPrettyDescription() << std::endl << std::endl;
+            delete e;
+            connection->Socket.Close();
+        }
+
+        this->Connections.push_back(std::move(connection));
+    }
+
+    for (auto & connection : this->Connections) {
+        if (!connection->Alive)
+            continue;
+
+        auto * ptr = connection.get();
+        connection->Reader = std::thread([this, ptr] {
+            this->ReaderLoop(*ptr);
+        });
+    }
+
+    this->CancelPoller = std::thread([this] {
+        this->CancelPollLoop();
+    });
+}
+
+void RemoteWrangler::EndAndWait()
+{
+    std::unique_lock<std::mutex> stopLock(this->MxRemote);
+    this->Stopping = true;
+    stopLock.unlock();
+    this->CvStopping.notify_all();
+
+    if (this->CancelPoller.joinable()) {
+        this->CancelPoller.join();
+    }
+
+    for (auto & connection : this->Connections) {
+        connection->Socket.Shutdown();
+    }
+    for (auto & connection : this->Connections) {
+        if (connection->Reader.joinable()) {
+            connection->Reader.join();
+        }
+        connection->Socket.Close();
+    }
+
+        // Like the local wrangler, whatever did not finish is dropped; the
+        // monitor sends it again next time
+    std::unique_lock<std::mutex> lk(this->MxRemote);
+    this->Connections.clear();
+    this->Queued.clear();
+}
+
+    //  Connections
+    // --------------------
+
+void RemoteWrangler::ReaderLoop(Connection & connection)
+{
+    using cout = BlackRoot::Util::Cout;
+
+    Remote::Socket::JSON frame;
+    while (connection.Socket.ReceiveFrame(frame)) {
+        if (frame.value("type", "") != "result")
+            continue;
+
+        Finished finished;
+
+        std::unique_lock<std::mutex> lk(this->MxRemote);
+
+        auto found = connection.InFlight.find(frame.value("id", uint64(0)));
+        if (found == connection.InFlight.end())
+            continue;
+
+        auto task = std::move(found->second.Task);
+        connection.InFlight.erase(found);
+
+        WranglerTaskResult result;
+        result.ProcessDuration = std::chrono::milliseconds(0);
+        result.Cancelled       = false;
+        result.FromCache       = false;
+        result.Exception       = nullptr;
+        try {
+            Remote::DecodeResult(frame, result);
+        }
+        catch (...) {
+            delete result.Exception;
+            result.ReadFiles.clear();
+            result.WrittenFiles.clear();
+            result.Exception = new BlackRoot::Debug::Exception("Worker sent a malformed result.", BRGenDbgInfo);
+        }
+        result.UniqueID   = task.UniqueID;
+        result.Generation = task.Generation;
+        finished.push_back({ std::move(task), std::move(result) });
+
+            // A slot opened up
+        this->Dispatch(finished);
+        lk.unlock();
+
+        this->Complete(finished);
+    }
+
+        // Whatever it was doing goes to somebody else, unless we are the
+        // ones hanging up
+    Finished finished;
+    std::unique_lock<std::mutex> lk(this->MxRemote);
+    connection.Alive = false;
+    if (this->Stopping)
+        return;
+
+    cout{} << "Lost connection to worker " << connection.Endpoint << std::endl << std::endl;
+
+    for (auto & it : connection.InFlight) {
+        this->Queued.push_back(std::move(it.second.Task));
+        std::push_heap(this->Queued.begin(), this->Queued.end(), QueuedBefore);
+    }
+    connection.InFlight.clear();
+
+    this->Dispatch(finished);
+    lk.unlock();
+
+    this->Complete(finished);
+}
+
+void RemoteWrangler::CancelPollLoop()
+{
+        // Tokens are set by whoever supersedes a task, without telling us
+    std::unique_lock<std::mutex> lk(this->MxRemote);
+    while (!this->Stopping) {
+        this->CvStopping.wait_for(lk, CancelPollInterval);
+        if (this->Stopping)
+            break;
+        this->SendCancels();
+    }
+}
+
+void RemoteWrangler::SendCancels()
+{
+        // Tell workers about superseded tasks; they report back as cancelled
+    for (auto & connection : this->Connections) {
+        if (!connection->Alive)
+            continue;
+        for (auto & it : connection->InFlight) {
+            if (it.second.CancelSent || !it.second.Task.Cancel || !it.second.Task.Cancel->load())
+                continue;
+            it.second.CancelSent = true;
+
+            std::unique_lock<std::mutex> lk(connection->MxSend);
+            connection->Socket.SendFrame({ { "type", "cancel" }, { "id", it.first } });
+        }
+    }
+}
+
+void RemoteWrangler::Dispatch(Finished & finished)
+{
+    this->SendCancels();
+
+    while (this->Queued.size() > 0) {
+            // The worker with the most room gets the next task; a worker
+            // never has more tasks than it has slots
+        Connection * target = nullptr;
+        bool anyAlive = false;
+        for (auto & connection : this->Connections) {
+            if (!connection->Alive)
+                continue;
+            anyAlive = true;
+
+            if (connection->InFlight.size() >= connection->Slots)
+                continue;
+            if (!target || connection->InFlight.size() * target->Slots < target->InFlight.size() * connection->Slots) {
+                target = connection.get();
+            }
+        }
+
+        if (!anyAlive) {
+            for (auto & task : this->Queued) {
+                this->Fail(task, "No remote worker is connected.", finished);
+            }
+            this->Queued.clear();
+            return;
+        }
+        if (!target)
+            return;
+
+        std::pop_heap(this->Queued.begin(), this->Queued.end(), QueuedBefore);
+        auto task = std::move(this->Queued.back());
+        this->Queued.pop_back();
+
+        if (task.Cancel && task.Cancel->load()) {
+            WranglerTaskResult result;
+            result.UniqueID        = task.UniqueID;
+            result.Generation      = task.Generation;
+            result.ProcessDuration = std::chrono::milliseconds(0);
+            result.Cancelled       = true;
+            result.FromCache       = false;
+            result.Exception       = nullptr;
+            finished.push_back({ std::move(task), std::move(result) });
+            continue;
+        }
+
+        auto wireID = this->NextWireID++;
+
+        std::unique_lock<std::mutex> lk(target->MxSend);
+        bool sent = target->Socket.SendFrame(Remote::EncodeTask(wireID, task));
+        lk.unlock();
+
+            // The reader will notice the connection is gone and clean up;
+            // this task just goes back in line
+        if (!sent) {
+            target->Alive = false;
+            target->Socket.Shutdown();
+            this->Queued.push_back(std::move(task));
+            std::push_heap(this->Queued.begin(), this->Queued.end(), QueuedBefore);
+            continue;
+        }
+
+        target->InFlight.emplace(wireID, InFlightTask{ std::move(task), false });
+    }
+}
+
+void RemoteWrangler::Fail(WranglerTask & task, const std::string message, Finished & finished)
+{
+    WranglerTaskResult result;
+    result.UniqueID        = task.UniqueID;
+    result.Generation      = task.Generation;
+    result.ProcessDuration = std::chrono::milliseconds(0);
+    result.Cancelled       = false;
+    result.FromCache       = false;
+    result.Exception       = new BlackRoot::Debug::Exception(message, BRGenDbgInfo);
+    finished.push_back({ std::move(task), std::move(result) });
+}
+
+void RemoteWrangler::Complete(Finished & finished)
+{
+        // Never call back under our lock; whoever we call may send more
+    for (auto & it : finished) {
+        it.first.Callback(std::move(it.second));
+    }
+    finished.clear();
+}
+
+    //  Asynch
+    // --------------------
+
+void RemoteWrangler::AsynchReceiveTasks(const WranglerTaskList & list)
+{
+    if (list.size() == 0)
+        return;
+
+    Finished finished;
+
+    std::unique_lock<std::mutex> lk(this->MxRemote);
+    for (auto & task : list) {
+        this->Queued.push_back(task);
+        std::push_heap(this->Queued.begin(), this->Queued.end(), QueuedBefore);
+    }
+
+    this->Dispatch(finished);
+    lk.unlock();
+
+    this->Complete(finished);
+}
+
+    //  Util
+    // --------------------
+
+std::string RemoteWrangler::GetConnectedWorkers()
+{
+    std::stringstream ss;
+
+    std::unique_lock<std::mutex> lk(this->MxRemote);
+    bool first = true;
+    for (auto & it : this->Connections) {
+        if (!first) ss << ", ";
+        ss << it->Endpoint << (it->Alive ? "" : " (lost)") << " [" << it->InFlight.size() << "/" << it->Slots << "]";
+        first = false;
+    }
+    lk.unlock();
+
+    return ss.str();
+}
\ No newline at end of file
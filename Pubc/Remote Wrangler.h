@@ -0,0 +1,91 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+/* {quality} This is very much a sketch
+ */
+
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <vector>
+#include <string>
+#include <unordered_map>
+
+#include "BlackRoot/Pubc/Number Types.h"
+
+#include "HephaestusBase/Pubc/Pipeline Meta.h"
+#include "HephaestusBase/Pubc/Remote Protocol.h"
+
+namespace Hephaestus {
+namespace Pipeline {
+namespace Wrangler {
+
+        // Sends tasks to worker processes (see RemoteWorker) instead of
+        // running them here. Every worker gets as many tasks in flight as it
+        // has slots, and orders them itself; the rest wait here, longest
+        // chain first.
+        // A worker that goes away has its tasks handed to the others; with
+        // no worker left, tasks fail and the monitor retries them later.
+        // Cancel tokens of tasks in flight are polled, so workers hear about
+        // superseded tasks within a tick even when nothing else happens.
+    class RemoteWrangler : public Pipeline::IWrangler {
+    protected:
+        struct InFlightTask {
+            Pipeline::WranglerTask  Task;
+            bool                    CancelSent;
+        };
+
+        struct Connection {
+            std::string         Endpoint;
+            Remote::Socket      Socket;
+            std::mutex          MxSend;
+            std::thread         Reader;
+            uint32              Slots;
+            bool                Alive;
+
+            std::unordered_map<uint64, InFlightTask>  InFlight;
+        };
+
+        using Finished = std::vector<std::pair<Pipeline::WranglerTask, Pipeline::WranglerTaskResult>>;
+
+        std::vector<std::string>                    Endpoints;
+        std::string                                 Secret;
+        std::vector<std::unique_ptr<Connection>>    Connections;
+        std::thread                                 CancelPoller;
+
+            // Guards everything but the sockets themselves
+        std::mutex                                  MxRemote;
+        std::condition_variable                     CvStopping;
+        std::vector<Pipeline::WranglerTask>         Queued;
+        uint64                                      NextWireID;
+        bool                                        Stopping;
+
+        void    ReaderLoop(Connection &);
+        void    CancelPollLoop();
+        void    SendCancels();
+        void    Dispatch(Finished &);
+        void    Fail(Pipeline::WranglerTask &, const std::string, Finished &);
+        void    Complete(Finished &);
+
+    public:
+        RemoteWrangler();
+        ~RemoteWrangler();
+
+        void    SetEndpoints(std::vector<std::string>);
+        void    SetSecret(const std::string);
+
+        void    AsynchReceiveTasks(const WranglerTaskList&) override;
+
+        void    Begin();
+        void    EndAndWait();
+
+        std::string GetConnectedWorkers();
+    };
+
+}
+}
+}
\ No newline at end of file
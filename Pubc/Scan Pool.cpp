@@ -0,0 +1,120 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include "BlackRoot/Pubc/Assert.h"
+
+#include "HephaestusBase/Pubc/Scan Pool.h"
+
+using namespace Hephaestus::Pipeline::Monitor;
+
+    //  Setup
+    // --------------------
+
+ScanPool::ScanPool()
+{
+    this->CurrentJob = nullptr;
+    this->JobCount   = 0;
+    this->Busy       = 0;
+    this->NextItem   = 0;
+    this->Generation = 0;
+    this->Stopping   = false;
+}
+
+ScanPool::~ScanPool()
+{
+    this->EndAndWait();
+}
+
+void ScanPool::Begin(std::size_t threads)
+{
+    DbAssertMsgFatal(this->Threads.size() == 0, "Scan pool is already running");
+
+    this->Stopping = false;
+
+        // Slot 0 is whoever calls 'ForEach'
+    for (std::size_t i = 0; i < threads; i++) {
+        this->Threads.push_back(std::thread([this, i] {
+            this->ThreadLoop(i + 1);
+        }));
+    }
+}
+
+void ScanPool::EndAndWait()
+{
+    std::unique_lock<std::mutex> lk(this->MxJob);
+    this->Stopping = true;
+    lk.unlock();
+    this->CvJob.notify_all();
+
+    for (auto & thread : this->Threads) {
+        thread.join();
+    }
+    this->Threads.clear();
+}
+
+std::size_t ScanPool::GetSlotCount() const
+{
+    return this->Threads.size() + 1;
+}
+
+    //  Work
+    // --------------------
+
+void ScanPool::ForEach(std::size_t count, const Job & job)
+{
+        // Not worth waking anybody for
+    if (this->Threads.size() == 0 || count <= 1) {
+        for (std::size_t i = 0; i < count; i++) {
+            job(i, 0);
+        }
+        return;
+    }
+
+    std::unique_lock<std::mutex> lk(this->MxJob);
+    this->CurrentJob = &job;
+    this->JobCount   = count;
+    this->NextItem   = 0;
+    this->Busy       = this->Threads.size();
+    this->Generation += 1;
+    lk.unlock();
+    this->CvJob.notify_all();
+
+    this->RunItems(0);
+
+    lk.lock();
+    this->CvDone.wait(lk, [this] { return this->Busy == 0; });
+    this->CurrentJob = nullptr;
+}
+
+void ScanPool::ThreadLoop(std::size_t slot)
+{
+    uint64 seen = 0;
+
+    std::unique_lock<std::mutex> lk(this->MxJob);
+    while (true) {
+        this->CvJob.wait(lk, [this, seen] { return this->Stopping || this->Generation != seen; });
+        if (this->Stopping)
+            return;
+        seen = this->Generation;
+
+        lk.unlock();
+        this->RunItems(slot);
+        lk.lock();
+
+        if (--this->Busy == 0) {
+            this->CvDone.notify_one();
+        }
+    }
+}
+
+void ScanPool::RunItems(std::size_t slot)
+{
+    auto & job = *this->CurrentJob;
+    while (true) {
+        std::size_t item = this->NextItem++;
+        if (item >= this->JobCount)
+            return;
+        job(item, slot);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,62 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+/* {quality} This is very much a sketch
+ */
+
+#pragma once
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+
+#include "BlackRoot/Pubc/Number Types.h"
+
+namespace Hephaestus {
+namespace Pipeline {
+namespace Monitor {
+
+        // A few threads that help the monitor with file system calls; stats
+        // and directory listings mostly wait on the disk, so a handful in
+        // flight at once go a lot faster than one after the other.
+        // 'ForEach' blocks until every item is done, and the calling thread
+        // takes items too; with no threads it simply runs them in order.
+    class ScanPool {
+    public:
+            // Called with the item and the slot doing it, below 'GetSlotCount';
+            // a slot only ever runs one item at a time. Must not throw
+        using Job = std::function<void(std::size_t item, std::size_t slot)>;
+
+    protected:
+        std::vector<std::thread>    Threads;
+
+        std::mutex                  MxJob;
+        std::condition_variable     CvJob, CvDone;
+        const Job                   *CurrentJob;
+        std::size_t                 JobCount, Busy;
+        std::atomic<std::size_t>    NextItem;
+        uint64                      Generation;
+        bool                        Stopping;
+
+        void    ThreadLoop(std::size_t slot);
+        void    RunItems(std::size_t slot);
+
+    public:
+        ScanPool();
+        ~ScanPool();
+
+        void    Begin(std::size_t threads);
+        void    EndAndWait();
+
+        std::size_t GetSlotCount() const;
+
+        void    ForEach(std::size_t count, const Job &);
+    };
+
+}
+}
+}
\ No newline at end of file
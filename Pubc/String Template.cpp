@@ -0,0 +1,125 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include "HephaestusBase/Pubc/String Template.h"
+
+using namespace Hephaestus::Pipeline::Monitor;
+
+    //  Setup
+    // --------------------
+
+StringTemplate::StringTemplate()
+{
+    this->Interpret     = false;
+    this->LiteralLength = 0;
+    this->HasLast       = false;
+}
+
+void StringTemplate::Compile(const std::string & str)
+{
+    this->Segments.resize(0);
+    this->Interpret     = false;
+    this->LiteralLength = 0;
+    this->HasLast       = false;
+    this->LastValues.resize(0);
+
+    std::size_t pos = 0;
+    while (pos < str.size()) {
+        std::size_t start = str.find('{', pos);
+        if (start == std::string::npos)
+            break;
+
+            // Unclosed and nested braces are rare enough to not bother
+        std::size_t end = str.find('}', start + 1);
+        if (end == std::string::npos || str.find('{', start + 1) < end) {
+            this->Interpret = true;
+            return;
+        }
+
+        if (start > pos) {
+            this->Segments.push_back({ str.substr(pos, start - pos), false });
+            this->LiteralLength += start - pos;
+        }
+        this->Segments.push_back({ str.substr(start + 1, end - start - 1), true });
+
+        pos = end + 1;
+    }
+
+    if (pos < str.size()) {
+        this->Segments.push_back({ str.substr(pos), false });
+        this->LiteralLength += str.size() - pos;
+    }
+
+    this->LastValues.resize(this->Segments.size());
+}
+
+    //  Render
+    // --------------------
+
+bool StringTemplate::Render(const Variables & variables, std::string & out)
+{
+    if (this->Interpret)
+        return false;
+
+        // Look up everything first; an unknown variable or a value that
+        // needs processing itself is for the caller
+    bool        changed = !this->HasLast;
+    std::size_t length  = this->LiteralLength;
+
+    thread_local std::vector<const std::string*> values;
+    values.assign(this->Segments.size(), nullptr);
+
+    for (std::size_t i = 0; i < this->Segments.size(); i++) {
+        auto & segment = this->Segments[i];
+        if (!segment.IsVariable)
+            continue;
+
+        auto * found = variables.Find(segment.Text);
+        if (!found)
+            return false;
+        if (found->find('{') != std::string::npos)
+            return false;
+
+        values[i] = found;
+        length   += found->size();
+        changed   = changed || this->LastValues[i] != *found;
+    }
+
+    if (!changed) {
+        out = this->LastResult;
+        return true;
+    }
+
+    out.clear();
+    out.reserve(length);
+    for (std::size_t i = 0; i < this->Segments.size(); i++) {
+        if (values[i]) {
+            out += *values[i];
+            this->LastValues[i] = *values[i];
+        }
+        else {
+            out += this->Segments[i].Text;
+        }
+    }
+
+    this->LastResult = out;
+    this->HasLast    = true;
+    return true;
+}
+
+StringTemplate & StringTemplate::FindCompiled(const std::string & str)
+{
+        // Hubs and wildcards only have so many strings; if there are
+        // more than this something is generating them, so start over
+    thread_local std::unordered_map<std::string, StringTemplate> compiled;
+    if (compiled.size() > 16 * 1024) {
+        compiled.clear();
+    }
+
+    auto inserted = compiled.emplace(str, StringTemplate());
+    if (inserted.second) {
+        inserted.first->second.Compile(str);
+    }
+    return inserted.first->second;
+}
\ No newline at end of file
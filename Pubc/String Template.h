@@ -0,0 +1,58 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+/* {quality} This is very much a sketch
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "HephaestusBase/Pubc/Variable Scope.h"
+
+namespace Hephaestus {
+namespace Pipeline {
+namespace Monitor {
+
+        // A string with '{variable}' parts, split up once into text and
+        // variables; rendering is then a lookup per variable and a single
+        // append each. The last render is remembered, and given back as is
+        // as long as none of the variables it used changed.
+        // Nested braces ('{a{b}}') and values that hold braces themselves
+        // are left to the caller to interpret the slow way.
+    class StringTemplate {
+    public:
+        using Variables = VariableScope;
+
+    protected:
+        struct Segment {
+            std::string Text;
+            bool        IsVariable;
+        };
+
+        std::vector<Segment>        Segments;
+        bool                        Interpret;
+        std::size_t                 LiteralLength;
+
+        bool                        HasLast;
+        std::vector<std::string>    LastValues;
+        std::string                 LastResult;
+
+    public:
+        StringTemplate();
+
+        void    Compile(const std::string &);
+
+            // Returns false if the string has to be interpreted instead
+        bool    Render(const Variables &, std::string & out);
+
+            // Compiled templates are kept per thread, by their text
+        static StringTemplate & FindCompiled(const std::string &);
+    };
+
+}
+}
+}
\ No newline at end of file
@@ -0,0 +1,132 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include <vector>
+
+#include "HephaestusBase/Pubc/Variable Scope.h"
+
+using namespace Hephaestus::Pipeline::Monitor;
+
+namespace {
+        // Past this many frames lookups walk too far; the chain is then
+        // folded into a single frame of its own
+    const std::size_t MaxDepth = 16;
+}
+
+    //  Frames
+    // --------------------
+
+void VariableScope::Clear()
+{
+    this->Top.reset();
+}
+
+const std::string * VariableScope::Find(const std::string & key) const
+{
+    for (auto * frame = this->Top.get(); frame; frame = frame->Parent.get()) {
+        auto found = frame->Overrides.find(key);
+        if (found != frame->Overrides.end())
+            return &found->second;
+    }
+    return nullptr;
+}
+
+void VariableScope::Set(const std::string & key, std::string value)
+{
+        // Setting what is already visible changes nothing, and should not
+        // cost a frame
+    auto * current = this->Find(key);
+    if (current && *current == value)
+        return;
+
+        // A frame only we hold can be changed in place
+    if (this->Top && this->Top.use_count() == 1) {
+        this->Top->Overrides[key] = std::move(value);
+        this->Top->HasFingerprint = false;
+        return;
+    }
+
+    auto frame = std::make_shared<Frame>();
+    frame->HasFingerprint = false;
+
+    if (this->Top && this->Top->Depth + 1 >= MaxDepth) {
+        frame->Overrides = this->Flatten();
+        frame->Depth     = 0;
+    }
+    else {
+        frame->Parent = this->Top;
+        frame->Depth  = this->Top ? this->Top->Depth + 1 : 0;
+    }
+
+    frame->Overrides[key] = std::move(value);
+    this->Top = std::move(frame);
+}
+
+VariableScope::Map VariableScope::Flatten() const
+{
+        // Walk from the root up, so that overrides win
+    std::vector<const Frame*> frames;
+    for (auto * frame = this->Top.get(); frame; frame = frame->Parent.get()) {
+        frames.push_back(frame);
+    }
+
+    Map map;
+    for (auto it = frames.rbegin(); it != frames.rend(); ++it) {
+        for (auto & kv : (*it)->Overrides) {
+            map[kv.first] = kv.second;
+        }
+    }
+    return map;
+}
+
+    //  Compare
+    // --------------------
+
+std::size_t VariableScope::PairFingerprint(const std::string & key, const std::string & value)
+{
+    std::size_t pair = std::hash<std::string>{}(key);
+    pair ^= std::hash<std::string>{}(value) + 0x9e3779b9 + (pair << 6) + (pair >> 2);
+    return pair;
+}
+
+std::size_t VariableScope::GetFingerprint() const
+{
+    auto * frame = this->Top.get();
+    if (!frame)
+        return 0;
+    if (frame->HasFingerprint)
+        return frame->Fingerprint;
+
+        // Pairs are summed up, so the result does not depend on order;
+        // from the parent's, take out what we hide and add what we set
+    VariableScope parent;
+    parent.Top = frame->Parent;
+
+    std::size_t fingerprint = parent.GetFingerprint();
+    for (auto & kv : frame->Overrides) {
+        auto * hidden = parent.Find(kv.first);
+        if (hidden) {
+            fingerprint -= PairFingerprint(kv.first, *hidden);
+        }
+        fingerprint += PairFingerprint(kv.first, kv.second);
+    }
+
+    frame->Fingerprint    = fingerprint;
+    frame->HasFingerprint = true;
+    return fingerprint;
+}
+
+bool VariableScope::operator==(const VariableScope & rh) const
+{
+    if (this->Top == rh.Top)
+        return true;
+    if (this->GetFingerprint() != rh.GetFingerprint())
+        return false;
+    return this->Flatten() == rh.Flatten();
+}
+
+bool VariableScope::operator!=(const VariableScope & rh) const
+{
+    return !(*this == rh);
+}
\ No newline at end of file
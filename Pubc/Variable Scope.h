@@ -0,0 +1,63 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+/* {quality} This is very much a sketch
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace Hephaestus {
+namespace Pipeline {
+namespace Monitor {
+
+        // String variables as a chain of frames, each holding only what it
+        // sets on top of its parent. Copies share their frames; setting a
+        // variable on a scope whose top frame is shared puts a new frame on
+        // top instead of touching it, so every hub and wildcard match costs
+        // only the variables it adds.
+    class VariableScope {
+    public:
+        using Map = std::unordered_map<std::string, std::string>;
+
+    protected:
+        struct Frame {
+            std::shared_ptr<Frame>  Parent;
+            Map                     Overrides;
+            std::size_t             Depth;
+
+                // Of the whole chain, not just the overrides; frames only
+                // change while nobody else holds them, which drops this
+            bool                    HasFingerprint;
+            std::size_t             Fingerprint;
+        };
+
+        std::shared_ptr<Frame>  Top;
+
+        static std::size_t  PairFingerprint(const std::string &, const std::string &);
+
+    public:
+        void    Clear();
+
+        const std::string * Find(const std::string &) const;
+        void    Set(const std::string & key, std::string value);
+
+            // Every visible variable, with overrides applied
+        Map     Flatten() const;
+
+            // Independent of the order variables were set in, and of how
+            // they are spread over frames
+        std::size_t GetFingerprint() const;
+
+            // Scopes sharing their top frame are equal without looking
+        bool    operator==(const VariableScope &) const;
+        bool    operator!=(const VariableScope &) const;
+    };
+
+}
+}
+}
\ No newline at end of file
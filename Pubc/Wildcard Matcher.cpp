@@ -0,0 +1,351 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include <algorithm>
+#include <iterator>
+
+#include "BlackRoot/Pubc/Assert.h"
+
+#include "HephaestusBase/Pubc/Wildcard Matcher.h"
+
+using namespace Hephaestus::Pipeline::Monitor;
+
+namespace fs = std::experimental::filesystem;
+
+    //  Setup
+    // --------------------
+
+WildcardMatcher::WildcardMatcher()
+{
+    this->Wildcard       = "*";
+    this->DelimiterOpen  = "~";
+    this->DelimiterClose = "~";
+    this->Compiled       = false;
+}
+
+void WildcardMatcher::SetCheckPath(Path path)
+{
+    this->CheckPath = path;
+    this->Compiled  = false;
+}
+
+WildcardMatcher::Path WildcardMatcher::GetCheckPath() const
+{
+    return this->CheckPath;
+}
+
+void WildcardMatcher::SetWildcard(std::string wildcard)
+{
+    this->Wildcard = wildcard;
+    this->Compiled = false;
+}
+
+void WildcardMatcher::SetDelimiters(std::string open, std::string close)
+{
+    this->DelimiterOpen  = open;
+    this->DelimiterClose = close;
+    this->Compiled       = false;
+}
+
+bool WildcardMatcher::Found::operator==(const Found & rh) const
+{
+    return this->FoundPath == rh.FoundPath && this->Replacements == rh.Replacements;
+}
+
+    //  Compile
+    // --------------------
+
+void WildcardMatcher::Compile()
+{
+    std::string path = this->CheckPath.string();
+
+        // Split in segments, remembering a leading root
+    std::string root = (path.size() > 0 && (path[0] == '/' || path[0] == '\\')) ? "/" : "";
+
+    std::vector<std::string> parts;
+    std::size_t start = 0;
+    while (start <= path.size()) {
+        std::size_t end = path.find_first_of("/\\", start);
+        if (end == std::string::npos)
+            end = path.size();
+        if (end > start) {
+            parts.push_back(path.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+
+        // Everything before the first segment with a wildcard or delimiter is
+        // fixed; with neither, only the last segment is matched
+    std::size_t first = 0;
+    while (first < parts.size() &&
+           parts[first].find(this->Wildcard) == std::string::npos &&
+           parts[first].find(this->DelimiterOpen) == std::string::npos) {
+        first++;
+    }
+    if (first == parts.size() && first > 0) {
+        first--;
+    }
+
+    std::string base = root;
+    for (std::size_t i = 0; i < first; i++) {
+        if (i > 0) base += "/";
+        base += parts[i];
+    }
+    this->BaseDirectory = base.size() > 0 ? Path(base) : Path(".");
+
+    this->Segments.resize(0);
+    for (std::size_t i = first; i < parts.size(); i++) {
+        this->Segments.push_back(this->CompileSegment(parts[i]));
+    }
+
+    this->Compiled = true;
+}
+
+WildcardMatcher::Segment WildcardMatcher::CompileSegment(const std::string & text) const
+{
+    Segment segment;
+    segment.IsRecursive = this->Wildcard.size() > 0 && text == this->Wildcard + this->Wildcard;
+    segment.MinLength   = 0;
+
+    std::string literal;
+    auto flushLiteral = [&]() {
+        if (literal.size() == 0)
+            return;
+        segment.Tokens.push_back({ Token::Kind::Literal, literal });
+        segment.MinLength += literal.size();
+        literal.clear();
+    };
+
+    std::size_t pos = 0;
+    while (pos < text.size()) {
+            // '~name~' captures; without a closing delimiter it is just text
+        if (this->DelimiterOpen.size() > 0 && text.compare(pos, this->DelimiterOpen.size(), this->DelimiterOpen) == 0) {
+            std::size_t nameStart = pos + this->DelimiterOpen.size();
+            std::size_t nameEnd   = text.find(this->DelimiterClose, nameStart);
+            if (nameEnd != std::string::npos && nameEnd > nameStart) {
+                flushLiteral();
+                segment.Tokens.push_back({ Token::Kind::Capture, text.substr(nameStart, nameEnd - nameStart) });
+                segment.MinLength += 1;
+                pos = nameEnd + this->DelimiterClose.size();
+                continue;
+            }
+        }
+
+        if (this->Wildcard.size() > 0 && text.compare(pos, this->Wildcard.size(), this->Wildcard) == 0) {
+            flushLiteral();
+                // Two wildcards in a row match no more than one does
+            if (segment.Tokens.size() == 0 || segment.Tokens.back().Type != Token::Kind::Any) {
+                segment.Tokens.push_back({ Token::Kind::Any, "" });
+            }
+            pos += this->Wildcard.size();
+            continue;
+        }
+
+        literal += text[pos++];
+    }
+    flushLiteral();
+
+    segment.IsLiteral = segment.Tokens.size() == 1 && segment.Tokens[0].Type == Token::Kind::Literal;
+
+    if (segment.Tokens.size() > 0 && segment.Tokens.front().Type == Token::Kind::Literal) {
+        segment.Prefix = segment.Tokens.front().Text;
+    }
+    if (segment.Tokens.size() > 1 && segment.Tokens.back().Type == Token::Kind::Literal) {
+        segment.Suffix = segment.Tokens.back().Text;
+    }
+
+    return segment;
+}
+
+    //  Matching
+    // --------------------
+
+bool WildcardMatcher::MatchSegment(const Segment & segment, const std::string & name, std::map<std::string, std::string> & captures) const
+{
+    if (name.size() < segment.MinLength)
+        return false;
+    if (name.compare(0, segment.Prefix.size(), segment.Prefix) != 0)
+        return false;
+    if (segment.Suffix.size() > 0 &&
+        name.compare(name.size() - segment.Suffix.size(), segment.Suffix.size(), segment.Suffix) != 0)
+        return false;
+
+    return this->MatchTokens(segment, 0, name, 0, captures);
+}
+
+bool WildcardMatcher::MatchTokens(const Segment & segment, std::size_t token, const std::string & name, std::size_t pos, std::map<std::string, std::string> & captures) const
+{
+    if (token == segment.Tokens.size())
+        return pos == name.size();
+
+    auto & tok = segment.Tokens[token];
+
+    if (tok.Type == Token::Kind::Literal) {
+        if (name.compare(pos, tok.Text.size(), tok.Text) != 0)
+            return false;
+        return this->MatchTokens(segment, token + 1, name, pos + tok.Text.size(), captures);
+    }
+
+    std::size_t minEnd = pos + (tok.Type == Token::Kind::Capture ? 1 : 0);
+    if (minEnd > name.size())
+        return false;
+
+        // Last token takes all that is left
+    if (token + 1 == segment.Tokens.size()) {
+        if (tok.Type == Token::Kind::Capture) {
+            captures[tok.Text] = name.substr(pos);
+        }
+        return true;
+    }
+
+        // Otherwise, if the next token is a literal we only need to try
+        // the places where it occurs. If it is another wildcard or capture,
+        // as in '*~ext~' or '~a~~b~', its 'Text' is no literal at all, and
+        // we try every split in turn. Either way the shortest match wins
+    auto & next = segment.Tokens[token + 1];
+    bool nextLiteral = next.Type == Token::Kind::Literal;
+    auto advance = [&](std::size_t from) {
+        if (!nextLiteral)
+            return from <= name.size() ? from : std::string::npos;
+        return name.find(next.Text, from);
+    };
+
+    for (std::size_t end = advance(minEnd); end != std::string::npos; end = advance(end + 1)) {
+        if (!this->MatchTokens(segment, token + 1, name, end, captures))
+            continue;
+        if (tok.Type == Token::Kind::Capture) {
+            captures[tok.Text] = name.substr(pos, end - pos);
+        }
+        return true;
+    }
+
+    return false;
+}
+
+    //  Walk
+    // --------------------
+
+void WildcardMatcher::Walk(BlackRoot::IO::IFileSource * source, const Path & dir, std::size_t index, std::map<std::string, std::string> & captures, std::vector<Found> & found, std::vector<Branch> * defer) const
+{
+    auto & segment = this->Segments[index];
+    bool   last    = index + 1 == this->Segments.size();
+
+        // A plain name does not need the directory listed. Without a file
+        // source we may be on a pool thread, which must not throw; a path we
+        // cannot look at is taken not to be there
+    if (segment.IsLiteral) {
+        Path path = dir / segment.Tokens[0].Text;
+        std::error_code ec;
+        if (last) {
+            if (source ? source->FileExists(path) : fs::is_regular_file(path, ec)) {
+                found.push_back({ path, captures });
+            }
+        }
+        else if (source ? source->DirectoryExists(path) : fs::is_directory(path, ec)) {
+            this->Walk(source, path, index + 1, captures, found, defer);
+        }
+        return;
+    }
+
+        // '**' may also match no directory at all
+    if (segment.IsRecursive && !last) {
+        this->Walk(source, dir, index + 1, captures, found, defer);
+    }
+
+    std::error_code ec;
+    for (auto it = fs::directory_iterator(dir, ec); !ec && it != fs::directory_iterator(); it.increment(ec)) {
+        auto status = it->status(ec);
+        if (ec) {
+            ec.clear();
+            continue;
+        }
+
+        bool isDir = fs::is_directory(status);
+
+        if (segment.IsRecursive) {
+                // Do not follow links around in circles
+            if (isDir) {
+                if (!fs::is_symlink(it->symlink_status(ec))) {
+                    if (defer)
+                        defer->push_back({ it->path(), index, captures });
+                    else
+                        this->Walk(source, it->path(), index, captures, found, nullptr);
+                }
+                ec.clear();
+            }
+            else if (last && fs::is_regular_file(status)) {
+                found.push_back({ it->path(), captures });
+            }
+            continue;
+        }
+
+            // Directories that cannot match are never entered
+        if (last ? !fs::is_regular_file(status) : !isDir)
+            continue;
+
+        auto branch = captures;
+        if (!this->MatchSegment(segment, it->path().filename().string(), branch))
+            continue;
+
+        if (last) {
+            found.push_back({ it->path(), std::move(branch) });
+        }
+        else if (defer) {
+            defer->push_back({ it->path(), index + 1, std::move(branch) });
+        }
+        else {
+            this->Walk(source, it->path(), index + 1, branch, found, nullptr);
+        }
+    }
+}
+
+bool WildcardMatcher::Check(BlackRoot::IO::IFileSource * source, ScanPool * pool)
+{
+    if (!this->Compiled) {
+        this->Compile();
+    }
+
+    std::vector<Found> found;
+    if (this->Segments.size() > 0) {
+        std::map<std::string, std::string> captures;
+
+        std::vector<Branch> branches;
+        this->Walk(source, this->BaseDirectory, 0, captures, found, pool ? &branches : nullptr);
+
+            // Every branch is walked on its own; the file source stays
+            // with us, so branches go to the file system directly
+        if (branches.size() > 0) {
+            std::vector<std::vector<Found>> branchFound(branches.size());
+            pool->ForEach(branches.size(), [&](std::size_t item, std::size_t) {
+                auto & branch = branches[item];
+                this->Walk(nullptr, branch.Directory, branch.Segment, branch.Captures, branchFound[item], nullptr);
+            });
+
+            for (auto & list : branchFound) {
+                std::move(list.begin(), list.end(), std::back_inserter(found));
+            }
+        }
+    }
+
+        // Listing order is up to the file system
+    std::sort(found.begin(), found.end(), [](const Found & a, const Found & b) {
+        return a.FoundPath < b.FoundPath;
+    });
+
+    if (found == this->FoundList)
+        return false;
+
+    this->FoundList = std::move(found);
+    return true;
+}
+
+const std::vector<WildcardMatcher::Found> & WildcardMatcher::GetFound() const
+{
+    return this->FoundList;
+}
+
+void WildcardMatcher::RemoveFound()
+{
+    this->FoundList.clear();
+}
\ No newline at end of file
@@ -0,0 +1,102 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+/* {quality} This is very much a sketch
+ */
+
+#pragma once
+
+#include <map>
+#include <vector>
+#include <string>
+
+#include "BlackRoot/Pubc/Files.h"
+
+#include "HephaestusBase/Pubc/Scan Pool.h"
+
+namespace Hephaestus {
+namespace Pipeline {
+namespace Monitor {
+
+        // Finds all files matching a path like 'art/~set~/*.png', where '*'
+        // matches anything and '~name~' matches anything and captures it as
+        // a replacement. A segment of just '**' matches any number of
+        // directories. Nothing matches across a '/'. Where more than one
+        // split fits, as with '~a~~b~', earlier parts take as little as they
+        // can; a capture takes at least one character.
+        // The path is compiled once into per-segment matchers; the walk
+        // only lists directories a segment could still match, and never
+        // descends into any that cannot.
+    class WildcardMatcher {
+    public:
+        using Path = BlackRoot::IO::FilePath;
+
+        struct Found {
+            Path    FoundPath;
+            std::map<std::string, std::string>  Replacements;
+
+            bool    operator==(const Found &) const;
+        };
+
+    protected:
+        struct Token {
+            enum class Kind { Literal, Any, Capture };
+
+            Kind        Type;
+            std::string Text;
+        };
+
+        struct Segment {
+            std::vector<Token>  Tokens;
+            bool        IsLiteral, IsRecursive;
+
+                // Cheap rejection before any real matching
+            std::string Prefix, Suffix;
+            std::size_t MinLength;
+        };
+
+        Path        CheckPath;
+        std::string Wildcard, DelimiterOpen, DelimiterClose;
+
+        bool        Compiled;
+        Path        BaseDirectory;
+        std::vector<Segment>    Segments;
+
+        std::vector<Found>      FoundList;
+
+            // Where a walk continues; with a pool, the first directory listed
+            // hands its subdirectories out as branches to walk in parallel
+        struct Branch {
+            Path        Directory;
+            std::size_t Segment;
+            std::map<std::string, std::string>  Captures;
+        };
+
+        void    Compile();
+        Segment CompileSegment(const std::string &) const;
+
+        bool    MatchSegment(const Segment &, const std::string &, std::map<std::string, std::string> &) const;
+        bool    MatchTokens(const Segment &, std::size_t token, const std::string &, std::size_t pos, std::map<std::string, std::string> &) const;
+
+        void    Walk(BlackRoot::IO::IFileSource *, const Path &, std::size_t segment, std::map<std::string, std::string> &, std::vector<Found> &, std::vector<Branch> * defer) const;
+
+    public:
+        WildcardMatcher();
+
+        void    SetCheckPath(Path);
+        Path    GetCheckPath() const;
+        void    SetWildcard(std::string);
+        void    SetDelimiters(std::string open, std::string close);
+
+            // Returns whether what was found differs from the last check; the
+            // file source is only used from the calling thread
+        bool    Check(BlackRoot::IO::IFileSource *, ScanPool * pool = nullptr);
+
+        const std::vector<Found> & GetFound() const;
+        void    RemoveFound();
+    };
+
+}
+}
+}
\ No newline at end of file